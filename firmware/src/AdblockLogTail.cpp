@@ -0,0 +1,110 @@
+#include "AdblockLogTail.h"
+#include "TextTokenizer.h"
+
+AdblockLogTail::AdblockLogTail() {
+    _lock = nullptr;
+    _head = 0;
+    _count = 0;
+    _nextSeq = 1;
+}
+
+void AdblockLogTail::begin() {
+    _lock = xSemaphoreCreateMutex();
+}
+
+int AdblockLogTail::ingest(const String& output) {
+    const char* text = output.c_str();
+    size_t length = output.length();
+    if (length == 0) return 0;
+
+    // 1. Find where the unseen part of the tail starts. If the lines we read
+    //    last are no longer in the tail (log rotated or we fell behind), take it all.
+    const char* start = text;
+    if (_cursor.valid()) {
+        bool found;
+        start = _cursor.resume(text, length, found);
+    }
+
+    // 2. Parse and store the new lines
+    int added = 0;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    LineReader lines(start, length - (start - text));
+    TextSpan line;
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (line.empty()) continue;
+        _cursor.seen(line);
+        if (store(line.data, line.len)) {
+            added++;
+        }
+    }
+    xSemaphoreGive(_lock);
+
+    return added;
+}
+
+bool AdblockLogTail::store(const char* line, size_t len) {
+    // Log line format: "<date> <facility> adblock-<ver>[pid]: message"
+    const char* colon = TextSpan(line, len).find(": ");
+    if (colon == nullptr || colon == line) return false;
+
+    Entry& entry = _entries[_head];
+    entry.seq = _nextSeq++;
+
+    size_t tsLen = colon - line;
+    if (tsLen >= TIMESTAMP_LEN) tsLen = TIMESTAMP_LEN - 1;
+    memcpy(entry.timestamp, line, tsLen);
+    entry.timestamp[tsLen] = '\0';
+
+    const char* message = colon + 2;
+    size_t msgLen = len - (message - line);
+    if (msgLen >= MESSAGE_LEN) msgLen = MESSAGE_LEN - 1;
+    memcpy(entry.message, message, msgLen);
+    entry.message[msgLen] = '\0';
+
+    entry.level = classify(entry.message);
+
+    _head = (_head + 1) % CAPACITY;
+    if (_count < CAPACITY) _count++;
+    return true;
+}
+
+int AdblockLogTail::countSince(uint32_t since) const {
+    // Seqs are consecutive, so the newer entries are the last (newest - since)
+    if (since >= cursor()) return 0;
+    uint32_t newer = cursor() - since;
+    return newer < (uint32_t)_count ? (int)newer : _count;
+}
+
+void AdblockLogTail::append(JsonArray& target, uint32_t since) const {
+    static const char* levelNames[] = {"info", "success", "error"};
+
+    int oldest = (_head - _count + CAPACITY) % CAPACITY;
+    for (int i = 0; i < _count; i++) {
+        const Entry& entry = _entries[(oldest + i) % CAPACITY];
+        if (entry.seq <= since) continue;
+
+        JsonObject logEntry = target.createNestedObject();
+        logEntry["seq"] = entry.seq;
+        logEntry["timestamp"] = entry.timestamp;
+        logEntry["message"] = entry.message;
+        logEntry["level"] = levelNames[entry.level];
+    }
+}
+
+AdblockLogTail::Level AdblockLogTail::classify(const char* message) {
+    char lower[MESSAGE_LEN];
+    size_t i = 0;
+    for (; message[i] != '\0' && i < MESSAGE_LEN - 1; i++) {
+        lower[i] = tolower((unsigned char)message[i]);
+    }
+    lower[i] = '\0';
+
+    if (strstr(lower, "failed") || strstr(lower, "error")) {
+        return LEVEL_ERROR;
+    }
+    if (strstr(lower, "successfully") || strstr(lower, "loaded")) {
+        return LEVEL_SUCCESS;
+    }
+    return LEVEL_INFO;
+}
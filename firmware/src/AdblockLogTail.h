@@ -0,0 +1,61 @@
+#ifndef ADBLOCK_LOG_TAIL_H
+#define ADBLOCK_LOG_TAIL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "LogCursor.h"
+
+// Keeps the most recent adblock syslog entries in a fixed-size ring buffer.
+// Each poll hands over the tail of `logread`; lines up to and including the
+// last ones we read are skipped (see LogCursor), so only new lines are parsed. Every stored
+// entry gets a sequence number that clients pass back as `?since=`.
+// ingest() runs in the loop task and toJson() in a request handler, so both
+// take _lock.
+class AdblockLogTail {
+public:
+    static const int CAPACITY = 50;
+    static const int TIMESTAMP_LEN = 64;
+    static const int MESSAGE_LEN = 160;
+
+    AdblockLogTail();
+
+    void begin();
+    int ingest(const String& output); // Returns number of new entries stored
+
+    // Entries with seq > since, oldest first. alloc(count) is called with the
+    // number of such entries and returns the array to fill; both happen under
+    // one lock, so an ingest() in between can't outgrow the caller's document.
+    template <typename Alloc>
+    void toJson(uint32_t since, Alloc alloc) const {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        JsonArray target = alloc(countSince(since));
+        append(target, since);
+        xSemaphoreGive(_lock);
+    }
+
+    uint32_t cursor() const { return _nextSeq - 1; } // Sequence of the newest entry
+
+private:
+    enum Level : uint8_t { LEVEL_INFO, LEVEL_SUCCESS, LEVEL_ERROR };
+
+    struct Entry {
+        uint32_t seq;
+        Level level;
+        char timestamp[TIMESTAMP_LEN];
+        char message[MESSAGE_LEN];
+    };
+
+    SemaphoreHandle_t _lock;
+    Entry _entries[CAPACITY];
+    int _head;   // Index of the next slot to overwrite
+    int _count;
+    uint32_t _nextSeq;
+    LogCursor _cursor; // Into the router log
+
+    bool store(const char* line, size_t len); // `line` trimmed
+    int countSince(uint32_t since) const;
+    void append(JsonArray& target, uint32_t since) const;
+    static Level classify(const char* message);
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "AdmissionControl.h"
+
+AdmissionControl::AdmissionControl() {
+    _routeCount = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        _clients[i].ip = 0;
+        _clients[i].lastRefill = 0;
+    }
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        _inFlight[i].request = nullptr;
+    }
+    for (int i = 0; i < SHARED_SLOTS; i++) {
+        _shared[i].body = nullptr;
+        _shared[i].refs = 0;
+    }
+    _rateLimited = 0;
+    _heapRejects = 0;
+    _sharedHits = 0;
+}
+
+int AdmissionControl::addRoute(const char* name, uint8_t maxInFlight) {
+    if (_routeCount >= MAX_ROUTES) return -1;
+    Route& route = _routes[_routeCount];
+    route.name = name;
+    route.maxInFlight = maxInFlight;
+    route.inFlight = 0;
+    route.admitted = 0;
+    route.rejected = 0;
+    return _routeCount++;
+}
+
+bool AdmissionControl::admit(AsyncWebServerRequest* request, int route) {
+    if (ESP.getFreeHeap() < MIN_FREE_HEAP) {
+        _heapRejects++;
+        if (route >= 0) _routes[route].rejected++;
+        reject(request, 503, 1);
+        return false;
+    }
+
+    uint32_t retryAfter;
+    if (!takeToken((uint32_t)request->client()->remoteIP(), millis(), retryAfter)) {
+        _rateLimited++;
+        if (route >= 0) _routes[route].rejected++;
+        reject(request, 429, retryAfter);
+        return false;
+    }
+
+    if (route < 0) return true; // Unregistered: rate limited only
+
+    int slot = -1;
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        if (_inFlight[i].request == nullptr) {
+            slot = i;
+            break;
+        }
+    }
+    Route& limits = _routes[route];
+    if (slot < 0 || limits.inFlight >= limits.maxInFlight) {
+        limits.rejected++;
+        reject(request, 503, 1);
+        return false;
+    }
+
+    _inFlight[slot].request = request;
+    _inFlight[slot].route = route;
+    _inFlight[slot].shared = -1;
+    limits.inFlight++;
+    limits.admitted++;
+    request->onDisconnect([this, request]() { release(request); });
+    return true;
+}
+
+bool AdmissionControl::admitted(AsyncWebServerRequest* request) const {
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        if (_inFlight[i].request == request) return true;
+    }
+    return false;
+}
+
+bool AdmissionControl::takeToken(uint32_t ip, unsigned long now, uint32_t& retryAfter) {
+    // Find the client, else take a free slot or the one idle longest
+    int slot = -1;
+    int victim = 0;
+    for (int i = 0; i < MAX_CLIENTS && slot < 0; i++) {
+        if (_clients[i].ip == ip) {
+            slot = i;
+        } else if (_clients[victim].ip != 0 &&
+                   (_clients[i].ip == 0 || now - _clients[i].lastRefill > now - _clients[victim].lastRefill)) {
+            victim = i;
+        }
+    }
+    Client& client = _clients[slot >= 0 ? slot : victim];
+    if (client.ip != ip) {
+        client.ip = ip;
+        client.milliTokens = BUCKET_SIZE * 1000;
+        client.lastRefill = now;
+    }
+
+    // Refill in thousandths so short gaps still count
+    unsigned long elapsed = now - client.lastRefill;
+    if (elapsed > BUCKET_SIZE * 1000UL / BUCKET_RATE) elapsed = BUCKET_SIZE * 1000UL / BUCKET_RATE;
+    client.milliTokens += elapsed * BUCKET_RATE;
+    if (client.milliTokens > BUCKET_SIZE * 1000) client.milliTokens = BUCKET_SIZE * 1000;
+    client.lastRefill = now;
+
+    if (client.milliTokens < 1000) {
+        retryAfter = (1000 - client.milliTokens + BUCKET_RATE * 1000 - 1) / (BUCKET_RATE * 1000);
+        if (retryAfter == 0) retryAfter = 1;
+        return false;
+    }
+    client.milliTokens -= 1000;
+    return true;
+}
+
+void AdmissionControl::release(AsyncWebServerRequest* request) {
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        InFlight& entry = _inFlight[i];
+        if (entry.request != request) continue;
+
+        _routes[entry.route].inFlight--;
+        if (entry.shared >= 0) {
+            Shared& shared = _shared[entry.shared];
+            if (--shared.refs == 0) {
+                free(shared.body);
+                shared.body = nullptr;
+            }
+        }
+        entry.request = nullptr;
+        return;
+    }
+}
+
+void AdmissionControl::reject(AsyncWebServerRequest* request, int code, uint32_t retryAfter) {
+    AsyncWebServerResponse* response = request->beginResponse(code, "text/plain", code == 429 ? "Too many requests" : "Busy");
+    response->addHeader("Retry-After", String(retryAfter));
+    request->send(response);
+}
+
+int AdmissionControl::findShared(uint32_t key) const {
+    for (int i = 0; i < SHARED_SLOTS; i++) {
+        if (_shared[i].body != nullptr && _shared[i].key == key) return i;
+    }
+    return -1;
+}
+
+int AdmissionControl::storeShared(uint32_t key, const String& body) {
+    for (int i = 0; i < SHARED_SLOTS; i++) {
+        Shared& shared = _shared[i];
+        if (shared.body != nullptr) continue;
+
+        shared.body = (char*)malloc(body.length() + 1);
+        if (shared.body == nullptr) return -1;
+        memcpy(shared.body, body.c_str(), body.length() + 1);
+        shared.key = key;
+        shared.len = body.length();
+        shared.refs = 0;
+        return i;
+    }
+    return -1;
+}
+
+bool AdmissionControl::attachShared(AsyncWebServerRequest* request, int slot, const String& etag) {
+    Shared& shared = _shared[slot];
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        InFlight& entry = _inFlight[i];
+        if (entry.request != request) continue;
+
+        // Sent straight from the shared buffer, which lives until the last
+        // request using it is torn down
+        AsyncWebServerResponse* response = request->beginResponse_P(200, "application/json", (const uint8_t*)shared.body, shared.len);
+        response->addHeader("ETag", etag);
+        response->addHeader("Cache-Control", "no-cache");
+        entry.shared = slot;
+        shared.refs++;
+        request->send(response);
+        return true;
+    }
+
+    // Not admitted through us, so nothing would release the buffer
+    if (shared.refs == 0) {
+        String body(shared.body);
+        free(shared.body);
+        shared.body = nullptr;
+        sendPrivate(request, body, etag);
+        return true;
+    }
+    return false;
+}
+
+void AdmissionControl::sendPrivate(AsyncWebServerRequest* request, const String& body, const String& etag) {
+    AsyncWebServerResponse* response = request->beginResponse(200, "application/json", body);
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+void AdmissionControl::toJson(JsonObject& target) const {
+    target["rateLimited"] = _rateLimited;
+    target["heapRejects"] = _heapRejects;
+    target["sharedHits"] = _sharedHits;
+    JsonObject routes = target["routes"].to<JsonObject>();
+    for (int i = 0; i < _routeCount; i++) {
+        JsonObject route = routes[_routes[i].name].to<JsonObject>();
+        route["inFlight"] = _routes[i].inFlight;
+        route["max"] = _routes[i].maxInFlight;
+        route["admitted"] = _routes[i].admitted;
+        route["rejected"] = _routes[i].rejected;
+    }
+}
+
+uint32_t AdmissionControl::key(const String& text) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < text.length(); i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,112 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+// Keeps bursts of API requests from running the heap dry. admit() checks,
+// in order, and answers the request itself when it says no:
+//   - free heap above MIN_FREE_HEAP                      else 503
+//   - the client's token bucket (per IP, BUCKET_SIZE
+//     requests of burst, refilled at BUCKET_RATE/s)      else 429
+//   - the route's in-flight limit and MAX_IN_FLIGHT      else 503
+// Both carry Retry-After. A request counts as in flight until AsyncWebServer
+// tears it down, i.e. until its response has gone out.
+//
+// sendShared() lets identical GETs share one response body while any of them
+// is still being sent, so ten dashboards polling /api/stats cost one build
+// and one buffer.
+//
+// Handlers and request teardown both run on the async_tcp task, so there is
+// no locking here.
+class AdmissionControl {
+public:
+    static const int MAX_ROUTES = 12;
+    static const int MAX_IN_FLIGHT = 8;
+    static const int MAX_CLIENTS = 8;
+    static const int BUCKET_SIZE = 20;
+    static const int BUCKET_RATE = 5; // Tokens per second
+    static const int SHARED_SLOTS = 2;
+    static const uint32_t MIN_FREE_HEAP = 32768;
+
+    AdmissionControl();
+
+    int addRoute(const char* name, uint8_t maxInFlight); // Route id, -1 if the table is full
+    bool admit(AsyncWebServerRequest* request, int route); // false: already answered
+    bool admitted(AsyncWebServerRequest* request) const;  // For later body chunks
+
+    // Sends `build()` as a 200 JSON response with `etag`, reusing the body of
+    // an in-flight response with the same key instead of building it again.
+    // The key must cover everything the body depends on.
+    template <typename Build>
+    void sendShared(AsyncWebServerRequest* request, uint32_t key, const String& etag, Build build) {
+        int slot = findShared(key);
+        if (slot < 0) {
+            String body = build();
+            slot = storeShared(key, body);
+            if (slot < 0) {
+                sendPrivate(request, body, etag);
+                return;
+            }
+        } else {
+            _sharedHits++;
+        }
+        if (!attachShared(request, slot, etag)) {
+            sendPrivate(request, String(_shared[slot].body), etag);
+        }
+    }
+
+    void toJson(JsonObject& target) const;
+
+    static uint32_t key(const String& text); // FNV-1a, for sendShared keys
+
+private:
+    struct Route {
+        const char* name;
+        uint8_t maxInFlight;
+        uint8_t inFlight;
+        uint32_t admitted;
+        uint32_t rejected;
+    };
+
+    struct Client {
+        uint32_t ip; // 0 = free
+        uint32_t milliTokens;
+        unsigned long lastRefill;
+    };
+
+    struct InFlight {
+        AsyncWebServerRequest* request; // nullptr = free
+        int8_t route;
+        int8_t shared; // Slot in _shared, -1 if none
+    };
+
+    struct Shared {
+        uint32_t key;
+        char* body; // nullptr = free
+        size_t len;
+        uint8_t refs;
+    };
+
+    Route _routes[MAX_ROUTES];
+    int _routeCount;
+    Client _clients[MAX_CLIENTS];
+    InFlight _inFlight[MAX_IN_FLIGHT];
+    Shared _shared[SHARED_SLOTS];
+
+    uint32_t _rateLimited;
+    uint32_t _heapRejects;
+    uint32_t _sharedHits;
+
+    bool takeToken(uint32_t ip, unsigned long now, uint32_t& retryAfter);
+    void release(AsyncWebServerRequest* request);
+    void reject(AsyncWebServerRequest* request, int code, uint32_t retryAfter);
+
+    int findShared(uint32_t key) const;
+    int storeShared(uint32_t key, const String& body);
+    bool attachShared(AsyncWebServerRequest* request, int slot, const String& etag);
+    static void sendPrivate(AsyncWebServerRequest* request, const String& body, const String& etag);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "AppBundles.h"
+#include <Preferences.h>
+
+AppBundles::AppBundles() {
+    _enabled = 0;
+    memset(_refs, 0, sizeof(_refs));
+}
+
+void AppBundles::begin() {
+    Preferences prefs;
+    prefs.begin("apps", true);
+    uint32_t enabled = prefs.getULong("enabled", 0);
+    prefs.end();
+
+    for (int app = 0; app < APP_BUNDLE_COUNT; app++) {
+        if (!(enabled & (1UL << app))) continue;
+        const AppBundleDef& bundle = APP_BUNDLES[app];
+        for (int i = 0; i < bundle.count; i++) {
+            _refs[APP_BUNDLE_MEMBERS[bundle.first + i]]++;
+        }
+        _enabled |= 1UL << app;
+    }
+}
+
+int AppBundles::find(const String& name) const {
+    for (int app = 0; app < APP_BUNDLE_COUNT; app++) {
+        if (name == APP_BUNDLES[app].name) return app;
+    }
+    return -1;
+}
+
+bool AppBundles::covers(const char* domain) const {
+    int low = 0;
+    int high = APP_DOMAIN_COUNT - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(domainAt(mid), domain);
+        if (cmp == 0) return _refs[mid] > 0;
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return false;
+}
+
+void AppBundles::toJson(JsonObject& target) const {
+    for (int app = 0; app < APP_BUNDLE_COUNT; app++) {
+        target[APP_BUNDLES[app].name] = isEnabled(app);
+    }
+}
+
+void AppBundles::save() const {
+    Preferences prefs;
+    prefs.begin("apps", false);
+    prefs.putULong("enabled", _enabled);
+    prefs.end();
+}
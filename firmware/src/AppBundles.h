@@ -0,0 +1,70 @@
+#ifndef APP_BUNDLES_H
+#define APP_BUNDLES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "AppBundlesData.h"
+
+// App categories (youtube, tiktok, ...) blocked as a unit. The domain lists
+// are compiled in from tools/app_bundles.json (see AppBundlesData.h); each
+// domain carries a count of enabled bundles that contain it, so a domain
+// shared by two apps is added once and only removed when neither is blocked.
+//
+// setEnabled() reports just the domains whose coverage changed, so the
+// caller can send them to the router as one batched blocklist change.
+class AppBundles {
+public:
+    AppBundles();
+
+    void begin(); // Restores which apps are blocked (NVS)
+
+    int find(const String& name) const; // -1 if unknown
+    int count() const { return APP_BUNDLE_COUNT; }
+    const char* name(int app) const { return APP_BUNDLES[app].name; }
+    bool isEnabled(int app) const { return _enabled & (1UL << app); }
+    bool covers(const char* domain) const; // In any enabled bundle
+
+    // Enables/disables a bundle; fn(const char* domain, bool blocked) is
+    // called for each domain that became covered or uncovered.
+    template <typename Fn>
+    bool setEnabled(int app, bool enabled, Fn fn) {
+        if (app < 0 || app >= APP_BUNDLE_COUNT || isEnabled(app) == enabled) return false;
+
+        const AppBundleDef& bundle = APP_BUNDLES[app];
+        for (int i = 0; i < bundle.count; i++) {
+            uint16_t domain = APP_BUNDLE_MEMBERS[bundle.first + i];
+            if (enabled) {
+                if (_refs[domain]++ == 0) fn(domainAt(domain), true);
+            } else {
+                if (--_refs[domain] == 0) fn(domainAt(domain), false);
+            }
+        }
+
+        if (enabled) {
+            _enabled |= 1UL << app;
+        } else {
+            _enabled &= ~(1UL << app);
+        }
+        save();
+        return true;
+    }
+
+    // Visits every covered domain: fn(const char* domain)
+    template <typename Fn>
+    void forEachCovered(Fn fn) const {
+        for (int i = 0; i < APP_DOMAIN_COUNT; i++) {
+            if (_refs[i] > 0) fn(domainAt(i));
+        }
+    }
+
+    void toJson(JsonObject& target) const; // {"youtube": true, ...}
+
+private:
+    uint32_t _enabled; // Bit per bundle
+    uint8_t _refs[APP_DOMAIN_COUNT];
+
+    static const char* domainAt(int index) { return APP_DOMAIN_POOL + APP_DOMAIN_OFFSETS[index]; }
+    void save() const;
+};
+
+#endif
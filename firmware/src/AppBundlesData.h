@@ -0,0 +1,70 @@
+// Generated by tools/gen_app_bundles.py from tools/app_bundles.json. Do not edit.
+#ifndef APP_BUNDLES_DATA_H
+#define APP_BUNDLES_DATA_H
+
+#include <stdint.h>
+
+struct AppBundleDef {
+    const char* name;
+    uint16_t first; // Into APP_BUNDLE_MEMBERS
+    uint16_t count;
+};
+
+constexpr int APP_DOMAIN_COUNT = 30;
+constexpr int APP_BUNDLE_COUNT = 4;
+
+// Sorted, NUL-separated
+constexpr char APP_DOMAIN_POOL[] =
+    "byteoversea.com\0"
+    "cdninstagram.com\0"
+    "fbcdn.net\0"
+    "googlevideo.com\0"
+    "ibytedtos.com\0"
+    "ig.me\0"
+    "instagr.am\0"
+    "instagram.com\0"
+    "muscdn.com\0"
+    "musical.ly\0"
+    "rbx.com\0"
+    "rbxcdn.com\0"
+    "rbxtrk.com\0"
+    "roblox.com\0"
+    "robloxdev.com\0"
+    "robloxlabs.com\0"
+    "tiktok.com\0"
+    "tiktokcdn-us.com\0"
+    "tiktokcdn.com\0"
+    "tiktokv.com\0"
+    "tiktokw.us\0"
+    "ttwstatic.com\0"
+    "youtu.be\0"
+    "youtube-nocookie.com\0"
+    "youtube.com\0"
+    "youtube.googleapis.com\0"
+    "youtubei.googleapis.com\0"
+    "youtubekids.com\0"
+    "yt3.ggpht.com\0"
+    "ytimg.com\0"
+    ;
+
+constexpr uint16_t APP_DOMAIN_OFFSETS[APP_DOMAIN_COUNT] = {
+    0, 16, 33, 43, 59, 73, 79, 90, 104, 115, 126, 134,
+    145, 156, 167, 181, 196, 207, 224, 238, 250, 261, 275, 284,
+    305, 317, 340, 364, 380, 394,
+};
+
+constexpr uint16_t APP_BUNDLE_MEMBERS[] = {
+    1, 2, 5, 6, 7, // instagram
+    10, 11, 12, 13, 14, 15, // roblox
+    0, 4, 8, 9, 16, 17, 18, 19, 20, 21, // tiktok
+    3, 22, 23, 24, 25, 26, 27, 28, 29, // youtube
+};
+
+constexpr AppBundleDef APP_BUNDLES[APP_BUNDLE_COUNT] = {
+    {"instagram", 0, 5},
+    {"roblox", 5, 6},
+    {"tiktok", 11, 10},
+    {"youtube", 21, 9},
+};
+
+#endif
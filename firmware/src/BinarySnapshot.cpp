@@ -0,0 +1,87 @@
+#include "BinarySnapshot.h"
+#include "Crc32.h"
+#include <LittleFS.h>
+
+static const size_t HEADER_SIZE = 16;
+
+bool writeSnapshot(const char* path, const char magic[4], uint16_t formatVersion,
+                   const SnapshotPart* parts, int partCount) {
+    uint32_t payloadSize = 0;
+    uint32_t crc = 0;
+    for (int i = 0; i < partCount; i++) {
+        payloadSize += parts[i].size;
+        crc = crc32Update(crc, (const uint8_t*)parts[i].data, parts[i].size);
+    }
+
+    uint8_t header[HEADER_SIZE];
+    uint16_t reserved = 0;
+    memcpy(header, magic, 4);
+    memcpy(header + 4, &formatVersion, 2);
+    memcpy(header + 6, &reserved, 2);
+    memcpy(header + 8, &payloadSize, 4);
+    memcpy(header + 12, &crc, 4);
+
+    String tmpPath = String(path) + ".tmp";
+    File file = LittleFS.open(tmpPath, "w");
+    if (!file) return false;
+
+    bool ok = file.write(header, HEADER_SIZE) == HEADER_SIZE;
+    for (int i = 0; ok && i < partCount; i++) {
+        ok = file.write((const uint8_t*)parts[i].data, parts[i].size) == parts[i].size;
+    }
+    file.close();
+
+    if (!ok || !LittleFS.rename(tmpPath, path)) {
+        Serial.print("Snapshot write failed: ");
+        Serial.println(path);
+        LittleFS.remove(tmpPath);
+        return false;
+    }
+    return true;
+}
+
+uint8_t* readSnapshot(const char* path, const char magic[4], uint16_t formatVersion, size_t& payloadSize) {
+    payloadSize = 0;
+    if (!LittleFS.exists(path)) return nullptr;
+
+    File file = LittleFS.open(path, "r");
+    if (!file) return nullptr;
+
+    uint8_t header[HEADER_SIZE];
+    uint16_t version;
+    uint32_t size, expectedCrc;
+    if (file.read(header, HEADER_SIZE) != HEADER_SIZE || memcmp(header, magic, 4) != 0) {
+        file.close();
+        return nullptr;
+    }
+    memcpy(&version, header + 4, 2);
+    memcpy(&size, header + 8, 4);
+    memcpy(&expectedCrc, header + 12, 4);
+
+    if (version != formatVersion || size != file.size() - HEADER_SIZE) {
+        Serial.print("Snapshot version/size mismatch: ");
+        Serial.println(path);
+        file.close();
+        return nullptr;
+    }
+
+    // One allocation for the whole payload; callers index into it in place
+    uint8_t* payload = (uint8_t*)malloc(size > 0 ? size : 1);
+    if (payload == nullptr) {
+        file.close();
+        return nullptr;
+    }
+
+    bool ok = file.read(payload, size) == size;
+    file.close();
+
+    if (!ok || crc32Update(0, payload, size) != expectedCrc) {
+        Serial.print("Snapshot corrupt: ");
+        Serial.println(path);
+        free(payload);
+        return nullptr;
+    }
+
+    payloadSize = size;
+    return payload;
+}
@@ -0,0 +1,26 @@
+#ifndef BINARY_SNAPSHOT_H
+#define BINARY_SNAPSHOT_H
+
+#include <Arduino.h>
+
+// Versioned binary snapshot files on LittleFS, used to restore state at boot
+// with a single read instead of parsing entry by entry.
+//
+//   magic[4] | formatVersion u16 | reserved u16 | payloadSize u32 | crc32 u32 | payload
+//
+// Writes go to <path>.tmp and are renamed over <path>, so a reader never sees
+// a half-written snapshot.
+
+struct SnapshotPart {
+    const void* data;
+    size_t size;
+};
+
+bool writeSnapshot(const char* path, const char magic[4], uint16_t formatVersion,
+                   const SnapshotPart* parts, int partCount);
+
+// Returns the validated payload in one malloc'd buffer (caller frees), or
+// nullptr if the file is missing, has another magic/version, or fails its CRC.
+uint8_t* readSnapshot(const char* path, const char magic[4], uint16_t formatVersion, size_t& payloadSize);
+
+#endif
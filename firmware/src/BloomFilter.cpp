@@ -0,0 +1,93 @@
+#include "BloomFilter.h"
+#include <math.h>
+
+BloomFilter::BloomFilter() {
+    _bits = 0;
+    _capacity = 0;
+    _entries = 0;
+    _setBits = 0;
+    _lookups = 0;
+    _negatives = 0;
+    _falsePositives = 0;
+}
+
+void BloomFilter::reset(uint32_t capacity) {
+    uint32_t bits = capacity * BITS_PER_ENTRY;
+    if (bits < MIN_BITS) bits = MIN_BITS;
+    bits = (bits + 31) & ~31u;
+
+    _words.assign(bits / 32, 0);
+    _bits = bits;
+    _capacity = bits / BITS_PER_ENTRY;
+    _entries = 0;
+    _setBits = 0;
+}
+
+void BloomFilter::clear() {
+    std::vector<uint32_t>().swap(_words);
+    _bits = 0;
+    _capacity = 0;
+    _entries = 0;
+    _setBits = 0;
+}
+
+void BloomFilter::add(const char* item) {
+    if (_bits == 0) return;
+
+    uint64_t h = hash(item);
+    for (int i = 0; i < PROBES; i++) {
+        uint32_t bit = probe(h, i);
+        uint32_t mask = 1u << (bit & 31);
+        if ((_words[bit >> 5] & mask) == 0) {
+            _words[bit >> 5] |= mask;
+            _setBits++;
+        }
+    }
+    _entries++;
+}
+
+bool BloomFilter::mayContain(const char* item) const {
+    if (_bits == 0) return true;
+    _lookups++;
+
+    uint64_t h = hash(item);
+    for (int i = 0; i < PROBES; i++) {
+        uint32_t bit = probe(h, i);
+        if ((_words[bit >> 5] & (1u << (bit & 31))) == 0) {
+            _negatives++;
+            return false;
+        }
+    }
+    return true;
+}
+
+float BloomFilter::estimatedFpr() const {
+    if (_bits == 0) return 1.0f;
+    return powf((float)_setBits / _bits, PROBES);
+}
+
+void BloomFilter::toJson(JsonObject& target) const {
+    target["bytes"] = bytes();
+    target["capacity"] = _capacity;
+    target["entries"] = _entries;
+    target["estimatedFpr"] = estimatedFpr();
+    target["lookups"] = _lookups;
+    target["negatives"] = _negatives;
+    target["falsePositives"] = _falsePositives;
+}
+
+uint64_t BloomFilter::hash(const char* item) {
+    // 64-bit FNV-1a; the two halves drive double hashing in probe()
+    uint64_t h = 14695981039346656037ull;
+    for (const char* c = item; *c; c++) {
+        h = (h ^ (uint8_t)*c) * 1099511628211ull;
+    }
+    return h;
+}
+
+uint32_t BloomFilter::probe(uint64_t hash, int i) const {
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    // Map onto [0, _bits) with a multiply instead of a modulo
+    return (uint32_t)(((uint64_t)(h1 + i * h2) * _bits) >> 32);
+}
@@ -0,0 +1,53 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <vector>
+
+// Bloom filter over domain names, kept in front of a DomainStore so that a
+// lookup for a domain that is not in the store (the common case) costs a few
+// bit tests instead of a binary search over the string pool.
+//
+// Sized at BITS_PER_ENTRY bits per expected entry with PROBES probes, which
+// is ~1% false positives at capacity. Bits cannot be cleared, so removals
+// leave stale bits behind until the owner rebuilds the filter; the estimated
+// false-positive rate comes from the actual fill, so it shows that drift.
+class BloomFilter {
+public:
+    static const int BITS_PER_ENTRY = 10;
+    static const int PROBES = 7;
+    static const uint32_t MIN_BITS = 1024;
+
+    BloomFilter();
+
+    void reset(uint32_t capacity); // Clears and sizes for `capacity` entries
+    void clear();                  // Frees the bits; mayContain() then says "maybe" to everything
+    void add(const char* item);
+    bool mayContain(const char* item) const;
+
+    bool ready() const { return _bits > 0; }
+    bool full() const { return _entries > _capacity; } // Time to rebuild with more room
+    uint32_t capacity() const { return _capacity; }
+    size_t bytes() const { return _words.size() * 4; }
+    float estimatedFpr() const; // (set bits / bits) ^ PROBES
+
+    // Lookup accounting; the owner reports what the full structure said
+    void noteFalsePositive() const { _falsePositives++; }
+    void toJson(JsonObject& target) const;
+
+private:
+    std::vector<uint32_t> _words;
+    uint32_t _bits;
+    uint32_t _capacity;
+    uint32_t _entries;
+    uint32_t _setBits;
+    mutable uint32_t _lookups;
+    mutable uint32_t _negatives;      // Answered by the filter alone
+    mutable uint32_t _falsePositives; // Filter said maybe, store said no
+
+    static uint64_t hash(const char* item);
+    uint32_t probe(uint64_t hash, int i) const;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "CountMinSketch.h"
+
+CountMinSketch::CountMinSketch() {
+    clear();
+}
+
+void CountMinSketch::clear() {
+    memset(_counts, 0, sizeof(_counts));
+    _total = 0;
+}
+
+void CountMinSketch::add(uint32_t hash) {
+    for (int row = 0; row < DEPTH; row++) {
+        uint32_t& counter = _counts[row][column(hash, row)];
+        if (counter != UINT32_MAX) counter++;
+    }
+    _total++;
+}
+
+uint32_t CountMinSketch::estimate(uint32_t hash) const {
+    uint32_t best = UINT32_MAX;
+    for (int row = 0; row < DEPTH; row++) {
+        uint32_t counter = _counts[row][column(hash, row)];
+        if (counter < best) best = counter;
+    }
+    return best;
+}
+
+uint32_t CountMinSketch::column(uint32_t hash, int row) {
+    // One independent-enough hash per row: remix the name hash with the row
+    uint32_t h = hash ^ (0x9E3779B9u * (row + 1));
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h % WIDTH;
+}
@@ -0,0 +1,29 @@
+#ifndef COUNT_MIN_SKETCH_H
+#define COUNT_MIN_SKETCH_H
+
+#include <Arduino.h>
+
+// Approximate per-name counts in fixed memory. Each name bumps one counter
+// in each of DEPTH rows; the estimate is the smallest of those counters, so
+// it never undercounts and overcounts by at most ~2/WIDTH of the total with
+// high probability. Counters saturate instead of wrapping.
+class CountMinSketch {
+public:
+    static const int DEPTH = 4;
+    static const int WIDTH = 256;
+
+    CountMinSketch();
+
+    void clear();
+    void add(uint32_t hash);
+    uint32_t estimate(uint32_t hash) const;
+    uint32_t total() const { return _total; }
+
+private:
+    uint32_t _counts[DEPTH][WIDTH];
+    uint32_t _total;
+
+    static uint32_t column(uint32_t hash, int row);
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "DeviceTable.h"
+#include "MacAddress.h"
+#include "BinarySnapshot.h"
+#include <IPAddress.h>
+
+static const char SNAPSHOT_MAGIC[4] = {'N', 'G', 'D', 'T'};
+static const uint16_t SNAPSHOT_VERSION = 1;
+
+DeviceTable::DeviceTable() {
+    memset(_entries, 0, sizeof(_entries));
+    _count = 0;
+    _poolUsed = 0;
+    _callback = nullptr;
+    _version = 0;
+    memset(_tombstones, 0, sizeof(_tombstones));
+    _tombstoneHead = 0;
+    _deltaFloor = 0;
+}
+
+void DeviceTable::beginSnapshot() {
+    for (int i = 0; i < _count; i++) {
+        _entries[i].flags &= ~FLAG_SEEN;
+    }
+}
+
+void DeviceTable::observe(const uint8_t mac[6], uint32_t ip, const char* hostname, uint32_t now) {
+    int index = find(mac);
+    bool isNew = index < 0;
+    if (isNew) {
+        index = allocate();
+        if (index < 0) {
+            Serial.println("Device table full, ignoring " + formatMac(mac));
+            return;
+        }
+        Entry& entry = _entries[index];
+        memcpy(entry.mac, mac, 6);
+        entry.firstSeen = now;
+        entry.hostname = NO_HOSTNAME;
+        entry.flags = 0;
+    }
+
+    Entry& entry = _entries[index];
+    bool changed = isNew || entry.ip != ip;
+    entry.ip = ip;
+    entry.lastSeen = now;
+    if (!hostnameEquals(entry, hostname)) {
+        entry.hostname = intern(hostname);
+        changed = true;
+    }
+
+    bool wasOnline = entry.flags & FLAG_ONLINE;
+    entry.flags |= FLAG_ONLINE | FLAG_SEEN;
+    if (!wasOnline || changed) {
+        entry.version = ++_version;
+    }
+    if (!wasOnline) {
+        emit(DEVICE_JOINED, entry);
+    }
+}
+
+void DeviceTable::endSnapshot(uint32_t now) {
+    for (int i = 0; i < _count; i++) {
+        Entry& entry = _entries[i];
+        if ((entry.flags & FLAG_ONLINE) && !(entry.flags & FLAG_SEEN)) {
+            entry.flags &= ~FLAG_ONLINE;
+            entry.version = ++_version;
+            emit(DEVICE_LEFT, entry);
+        }
+    }
+}
+
+bool DeviceTable::save(const char* path) const {
+    // Entries are written as-is; the header records the layout they need
+    uint32_t header[4] = {(uint32_t)_count, _poolUsed, _version, sizeof(Entry)};
+    SnapshotPart parts[] = {
+        {header, sizeof(header)},
+        {_entries, sizeof(Entry) * _count},
+        {_pool, _poolUsed},
+    };
+    return writeSnapshot(path, SNAPSHOT_MAGIC, SNAPSHOT_VERSION, parts, 3);
+}
+
+bool DeviceTable::load(const char* path) {
+    size_t size;
+    uint8_t* payload = readSnapshot(path, SNAPSHOT_MAGIC, SNAPSHOT_VERSION, size);
+    if (payload == nullptr) return false;
+
+    uint32_t header[4];
+    bool ok = size >= sizeof(header);
+    if (ok) {
+        memcpy(header, payload, sizeof(header));
+        ok = header[0] <= CAPACITY && header[1] <= POOL_SIZE && header[3] == sizeof(Entry) &&
+             size == sizeof(header) + sizeof(Entry) * header[0] + header[1];
+    }
+
+    if (ok) {
+        _count = header[0];
+        _poolUsed = header[1];
+        _version = header[2];
+        memcpy(_entries, payload + sizeof(header), sizeof(Entry) * _count);
+        memcpy(_pool, payload + sizeof(header) + sizeof(Entry) * _count, _poolUsed);
+
+        for (int i = 0; i < _count; i++) {
+            _entries[i].flags &= ~FLAG_SEEN;
+            if (_entries[i].hostname != NO_HOSTNAME && _entries[i].hostname >= _poolUsed) {
+                _entries[i].hostname = NO_HOSTNAME;
+            }
+        }
+
+        // Removals from before the reboot are gone; older deltas get a full list
+        memset(_tombstones, 0, sizeof(_tombstones));
+        _deltaFloor = _version;
+    }
+
+    free(payload);
+    return ok;
+}
+
+void DeviceTable::toJson(JsonArray& target) const {
+    for (int i = 0; i < _count; i++) {
+        JsonObject device = target.add<JsonObject>();
+        writeEntry(device, _entries[i]);
+    }
+}
+
+void DeviceTable::toJsonDelta(JsonObject& target, uint32_t since) const {
+    target["version"] = _version;
+
+    // Too old to reconstruct removals (or from the future): send everything
+    bool full = since < _deltaFloor || since > _version;
+    target["full"] = full;
+
+    JsonArray devices = target["devices"].to<JsonArray>();
+    for (int i = 0; i < _count; i++) {
+        if (!full && _entries[i].version <= since) continue;
+        JsonObject device = devices.add<JsonObject>();
+        writeEntry(device, _entries[i]);
+    }
+
+    JsonArray removed = target["removed"].to<JsonArray>();
+    if (full) return;
+    for (int i = 0; i < TOMBSTONES; i++) {
+        const Tombstone& tombstone = _tombstones[i];
+        if (tombstone.version > since) {
+            removed.add(formatMac(tombstone.mac));
+        }
+    }
+}
+
+void DeviceTable::writeEntry(JsonObject& device, const Entry& entry) const {
+    // Field names follow the OpenWrt lease objects the UI already understands
+    device["macaddr"] = formatMac(entry.mac);
+    device["ipaddr"] = IPAddress(entry.ip).toString();
+    if (entry.hostname != NO_HOSTNAME) {
+        device["hostname"] = hostnameOf(entry);
+    }
+    device["online"] = (entry.flags & FLAG_ONLINE) != 0;
+    device["firstSeen"] = entry.firstSeen;
+    device["lastSeen"] = entry.lastSeen;
+}
+
+int DeviceTable::onlineCount() const {
+    int online = 0;
+    for (int i = 0; i < _count; i++) {
+        if (_entries[i].flags & FLAG_ONLINE) online++;
+    }
+    return online;
+}
+
+bool DeviceTable::isOnline(const uint8_t mac[6]) const {
+    int index = find(mac);
+    return index >= 0 && (_entries[index].flags & FLAG_ONLINE);
+}
+
+bool DeviceTable::findByIp(uint32_t ip, uint8_t mac[6], const char*& hostname) const {
+    // Prefer the online holder of the address; an old lease may still list it
+    int match = -1;
+    for (int i = 0; i < _count; i++) {
+        if (_entries[i].ip != ip) continue;
+        match = i;
+        if (_entries[i].flags & FLAG_ONLINE) break;
+    }
+    if (match < 0) return false;
+
+    const Entry& entry = _entries[match];
+    memcpy(mac, entry.mac, 6);
+    hostname = entry.hostname == NO_HOSTNAME ? "" : _pool + entry.hostname;
+    return true;
+}
+
+int DeviceTable::find(const uint8_t mac[6]) const {
+    for (int i = 0; i < _count; i++) {
+        if (sameMac(_entries[i].mac, mac)) return i;
+    }
+    return -1;
+}
+
+int DeviceTable::allocate() {
+    if (_count < CAPACITY) return _count++;
+
+    // Full: recycle the offline device that was seen longest ago
+    int victim = -1;
+    for (int i = 0; i < _count; i++) {
+        if (_entries[i].flags & (FLAG_ONLINE | FLAG_SEEN)) continue;
+        if (victim < 0 || _entries[i].lastSeen < _entries[victim].lastSeen) victim = i;
+    }
+    if (victim >= 0) {
+        // Remember it for deltas; once the oldest tombstone is overwritten,
+        // deltas from before it can no longer be answered
+        Tombstone& tombstone = _tombstones[_tombstoneHead];
+        if (tombstone.version > _deltaFloor) _deltaFloor = tombstone.version;
+        memcpy(tombstone.mac, _entries[victim].mac, 6);
+        tombstone.version = ++_version;
+        _tombstoneHead = (_tombstoneHead + 1) % TOMBSTONES;
+
+        // Its hostname becomes garbage in the pool until the next compaction
+        _entries[victim].hostname = NO_HOSTNAME;
+    }
+    return victim;
+}
+
+const char* DeviceTable::hostnameOf(const Entry& entry) const {
+    return entry.hostname == NO_HOSTNAME ? "" : _pool + entry.hostname;
+}
+
+bool DeviceTable::hostnameEquals(const Entry& entry, const char* hostname) const {
+    if (hostname == nullptr || hostname[0] == '\0') return entry.hostname == NO_HOSTNAME;
+    if (entry.hostname == NO_HOSTNAME) return false;
+    return strncmp(_pool + entry.hostname, hostname, MAX_HOSTNAME) == 0;
+}
+
+uint16_t DeviceTable::intern(const char* hostname) {
+    if (hostname == nullptr || hostname[0] == '\0') return NO_HOSTNAME;
+
+    size_t len = strnlen(hostname, MAX_HOSTNAME);
+    if (_poolUsed + len + 1 > POOL_SIZE) {
+        compactPool();
+        if (_poolUsed + len + 1 > POOL_SIZE) return NO_HOSTNAME;
+    }
+
+    uint16_t offset = _poolUsed;
+    memcpy(_pool + offset, hostname, len);
+    _pool[offset + len] = '\0';
+    _poolUsed += len + 1;
+    return offset;
+}
+
+void DeviceTable::compactPool() {
+    // Slide live hostnames down in offset order, dropping the garbage left by
+    // renamed or recycled devices. Entries never share an offset.
+    uint16_t cursor = 0;
+    while (true) {
+        int next = -1;
+        for (int i = 0; i < _count; i++) {
+            uint16_t offset = _entries[i].hostname;
+            if (offset == NO_HOSTNAME || offset < cursor) continue;
+            if (next < 0 || offset < _entries[next].hostname) next = i;
+        }
+        if (next < 0) break;
+
+        Entry& entry = _entries[next];
+        size_t len = strlen(_pool + entry.hostname) + 1;
+        if (entry.hostname != cursor) {
+            memmove(_pool + cursor, _pool + entry.hostname, len);
+            entry.hostname = cursor;
+        }
+        cursor += len;
+    }
+    _poolUsed = cursor;
+}
+
+void DeviceTable::emit(DeviceEvent event, const Entry& entry) {
+    if (_callback != nullptr) {
+        _callback(event, entry.mac, hostnameOf(entry));
+    }
+}
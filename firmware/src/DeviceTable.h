@@ -0,0 +1,95 @@
+#ifndef DEVICE_TABLE_H
+#define DEVICE_TABLE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+enum DeviceEvent {
+    DEVICE_JOINED,
+    DEVICE_LEFT
+};
+
+typedef void (*DeviceEventCallback)(DeviceEvent event, const uint8_t mac[6], const char* hostname);
+
+// Fixed-capacity table of every device we have seen, keyed by MAC.
+// Each DHCP lease snapshot is diffed against the table: devices that show up
+// are marked online (DEVICE_JOINED), devices missing from the snapshot go
+// offline (DEVICE_LEFT). Hostnames live in one shared string pool, so memory
+// use is fixed no matter how many snapshots come in.
+//
+//   table.beginSnapshot();
+//   table.observe(mac, ip, hostname, now);  // once per lease
+//   table.endSnapshot(now);
+//
+// Every change to a device's IP, hostname or online state bumps the table
+// version, so clients can revalidate with an ETag or ask for a delta since
+// the version they last saw. lastSeen alone does not count as a change.
+class DeviceTable {
+public:
+    static const int CAPACITY = 64;
+    static const int POOL_SIZE = 1536;
+    static const int MAX_HOSTNAME = 63;
+
+    DeviceTable();
+
+    void onEvent(DeviceEventCallback callback) { _callback = callback; }
+
+    void beginSnapshot();
+    void observe(const uint8_t mac[6], uint32_t ip, const char* hostname, uint32_t now);
+    void endSnapshot(uint32_t now);
+
+    bool save(const char* path) const; // Binary snapshot of entries + pool
+    bool load(const char* path);       // Restores the last saved state at boot
+
+    void toJson(JsonArray& target) const;
+    void toJsonDelta(JsonObject& target, uint32_t since) const; // Devices changed/removed after `since`
+    uint32_t version() const { return _version; }
+    int size() const { return _count; }
+    int onlineCount() const;
+    bool isOnline(const uint8_t mac[6]) const;
+    bool findByIp(uint32_t ip, uint8_t mac[6], const char*& hostname) const; // hostname "" if unknown
+
+private:
+    static const uint16_t NO_HOSTNAME = 0xFFFF;
+    static const uint8_t FLAG_ONLINE = 0x01;
+    static const uint8_t FLAG_SEEN = 0x02; // Present in the snapshot being built
+    static const int TOMBSTONES = 8;
+
+    struct Entry {
+        uint32_t ip;        // IPv4, network byte order
+        uint32_t firstSeen; // Epoch seconds
+        uint32_t lastSeen;
+        uint32_t version;   // Table version of the last change
+        uint16_t hostname;  // Offset into _pool, NO_HOSTNAME if unknown
+        uint8_t mac[6];
+        uint8_t flags;
+    };
+
+    Entry _entries[CAPACITY];
+    int _count;
+    char _pool[POOL_SIZE];
+    uint16_t _poolUsed;
+    DeviceEventCallback _callback;
+
+    // Recycled entries, so deltas can report them as removed
+    struct Tombstone {
+        uint8_t mac[6];
+        uint32_t version;
+    };
+
+    uint32_t _version;
+    Tombstone _tombstones[TOMBSTONES];
+    int _tombstoneHead;
+    uint32_t _deltaFloor; // Deltas from versions below this must be full lists
+
+    int find(const uint8_t mac[6]) const;
+    int allocate();
+    const char* hostnameOf(const Entry& entry) const;
+    bool hostnameEquals(const Entry& entry, const char* hostname) const;
+    uint16_t intern(const char* hostname);
+    void compactPool();
+    void emit(DeviceEvent event, const Entry& entry);
+    void writeEntry(JsonObject& device, const Entry& entry) const;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "DnsProxy.h"
+
+// Header flags (byte 2 / byte 3)
+static const uint8_t FLAG_QR = 0x80;
+static const uint8_t FLAG_OPCODE = 0x78;
+static const uint8_t FLAG_TC = 0x02;
+static const uint8_t FLAG_RD = 0x01;
+static const uint8_t FLAG_RA = 0x80;
+static const uint8_t RCODE_MASK = 0x0F;
+static const uint8_t RCODE_NXDOMAIN = 3;
+
+static const uint16_t TYPE_A = 1;
+static const uint16_t TYPE_AAAA = 28;
+static const uint16_t CLASS_IN = 1;
+
+static uint16_t readU16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+static uint32_t readU32(const uint8_t* p) { return ((uint32_t)readU16(p) << 16) | readU16(p + 2); }
+static void writeU16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+DnsProxy::DnsProxy() {
+    _policy = nullptr;
+    _lock = nullptr;
+    _running = false;
+    for (int i = 0; i < MAX_PENDING; i++) {
+        _pending[i].used = false;
+    }
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        _cache[i].key = 0;
+    }
+    memset(_clients, 0, sizeof(_clients));
+    _queries = _blocked = _cacheHits = _forwarded = _dropped = _timeouts = 0;
+}
+
+bool DnsProxy::begin(const IPAddress& upstream, DnsPolicy policy) {
+    if (_running) return true;
+    _policy = policy;
+    if (_lock == nullptr) _lock = xSemaphoreCreateMutex();
+
+    if (!_upstream.connect(upstream, PORT)) {
+        Serial.println("DnsProxy: cannot reach upstream " + upstream.toString());
+        return false;
+    }
+    _upstream.onPacket([this](AsyncUDPPacket& packet) { onAnswer(packet); });
+
+    if (!_server.listen(PORT)) {
+        Serial.println("DnsProxy: cannot listen on port 53");
+        _upstream.close();
+        return false;
+    }
+    _server.onPacket([this](AsyncUDPPacket& packet) { onQuery(packet); });
+
+    _running = true;
+    Serial.println("DnsProxy: forwarding to " + upstream.toString());
+    return true;
+}
+
+void DnsProxy::onQuery(AsyncUDPPacket& packet) {
+    const uint8_t* data = packet.data();
+    size_t length = packet.length();
+    unsigned long now = millis();
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _queries++;
+    ClientStats& stats = client(packet.remoteIP(), now);
+    stats.queries++;
+
+    Question question;
+    if (length > MAX_PACKET || !parseQuestion(data, length, question) || (data[2] & (FLAG_QR | FLAG_OPCODE)) != 0) {
+        _dropped++;
+    } else if (_policy(question.name)) {
+        _blocked++;
+        stats.blocked++;
+        answerBlocked(packet, question);
+    } else if (answerFromCache(packet, question, now)) {
+        _cacheHits++;
+        stats.cached++;
+    } else if (forward(packet, question, now)) {
+        _forwarded++;
+    } else {
+        _dropped++;
+    }
+    xSemaphoreGive(_lock);
+}
+
+void DnsProxy::onAnswer(AsyncUDPPacket& packet) {
+    uint8_t* data = packet.data();
+    size_t length = packet.length();
+    if (length < 12 || (data[2] & FLAG_QR) == 0) return;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    uint16_t id = readU16(data);
+    for (int i = 0; i < MAX_PENDING; i++) {
+        Pending& pending = _pending[i];
+        if (!pending.used || pending.proxyId != id) continue;
+
+        pending.used = false;
+        writeU16(data, pending.clientId);
+        _server.writeTo(data, length, pending.clientIp, pending.clientPort);
+
+        uint8_t rcode = data[3] & RCODE_MASK;
+        if (length <= MAX_PACKET && (data[2] & FLAG_TC) == 0 && (rcode == 0 || rcode == RCODE_NXDOMAIN)) {
+            store(pending.key, data, length, millis());
+        }
+        break;
+    }
+    xSemaphoreGive(_lock);
+}
+
+void DnsProxy::answerBlocked(AsyncUDPPacket& packet, const Question& question) {
+    const uint8_t* query = packet.data();
+    uint8_t response[MAX_PACKET];
+
+    // Header + question as asked, then one A/AAAA record of zeros (none for
+    // other types, which makes it an empty NOERROR answer)
+    memcpy(response, query, question.end);
+    response[2] = FLAG_QR | (query[2] & FLAG_RD);
+    response[3] = FLAG_RA;
+    bool address = question.type == TYPE_A || question.type == TYPE_AAAA;
+    writeU16(response + 6, address ? 1 : 0);
+    writeU16(response + 8, 0);
+    writeU16(response + 10, 0); // EDNS OPT from the query is not echoed
+
+    size_t pos = question.end;
+    if (address) {
+        uint16_t rdLength = question.type == TYPE_A ? 4 : 16;
+        if (pos + 12 + rdLength > sizeof(response)) return;
+        writeU16(response + pos, 0xC00C); // Pointer to the question name
+        writeU16(response + pos + 2, question.type);
+        writeU16(response + pos + 4, CLASS_IN);
+        writeU16(response + pos + 6, BLOCK_TTL >> 16);
+        writeU16(response + pos + 8, BLOCK_TTL & 0xFFFF);
+        writeU16(response + pos + 10, rdLength);
+        memset(response + pos + 12, 0, rdLength);
+        pos += 12 + rdLength;
+    }
+    packet.write(response, pos);
+}
+
+bool DnsProxy::answerFromCache(AsyncUDPPacket& packet, const Question& question, unsigned long now) {
+    const uint8_t* query = packet.data();
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot& slot = _cache[i];
+        if (slot.key != question.key) continue;
+        if (now - slot.storedAt >= slot.ttlMs) {
+            slot.key = 0;
+            return false;
+        }
+        // Same hash is not enough; the stored answer must echo this question
+        if (slot.length < question.end || memcmp(slot.data + 12, query + 12, question.end - 12) != 0) {
+            return false;
+        }
+
+        uint8_t response[MAX_PACKET];
+        memcpy(response, slot.data, slot.length);
+        memcpy(response, query, 2); // Client's transaction id
+        slot.lastUsed = now;
+        packet.write(response, slot.length);
+        return true;
+    }
+    return false;
+}
+
+bool DnsProxy::forward(AsyncUDPPacket& packet, const Question& question, unsigned long now) {
+    // A free slot, or one whose upstream answer never came
+    int slot = -1;
+    for (int i = 0; i < MAX_PENDING; i++) {
+        if (!_pending[i].used) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && now - _pending[i].sentAt >= PENDING_TIMEOUT_MS) {
+            slot = i;
+        }
+    }
+    if (slot < 0) return false;
+
+    Pending& pending = _pending[slot];
+    if (pending.used) _timeouts++;
+
+    const uint8_t* query = packet.data();
+    size_t length = packet.length();
+    uint8_t request[MAX_PACKET];
+    memcpy(request, query, length);
+
+    pending.proxyId = unusedId(); // While a reclaimed slot still holds its old id, so a late answer can't match
+    pending.used = true;
+    pending.clientId = readU16(query);
+    pending.clientIp = packet.remoteIP();
+    pending.clientPort = packet.remotePort();
+    pending.key = question.key;
+    pending.sentAt = now;
+
+    writeU16(request, pending.proxyId);
+    if (_upstream.write(request, length) != length) {
+        pending.used = false;
+        return false;
+    }
+    return true;
+}
+
+uint16_t DnsProxy::unusedId() const {
+    // Random, so an off-path host can't predict the id and spoof an answer
+    for (;;) {
+        uint16_t id = esp_random();
+        bool taken = false;
+        for (int i = 0; i < MAX_PENDING && !taken; i++) {
+            taken = _pending[i].used && _pending[i].proxyId == id;
+        }
+        if (!taken) return id;
+    }
+}
+
+void DnsProxy::store(uint32_t key, const uint8_t* data, size_t length, unsigned long now) {
+    // Replace an empty or expired slot, else the least recently used
+    int victim = 0;
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot& slot = _cache[i];
+        if (slot.key == 0 || slot.key == key || now - slot.storedAt >= slot.ttlMs) {
+            victim = i;
+            break;
+        }
+        if (slot.lastUsed < _cache[victim].lastUsed) victim = i;
+    }
+
+    CacheSlot& slot = _cache[victim];
+    slot.key = key;
+    slot.storedAt = now;
+    slot.lastUsed = now;
+    slot.ttlMs = answerTtl(data, length) * 1000;
+    slot.length = length;
+    memcpy(slot.data, data, length);
+}
+
+DnsProxy::ClientStats& DnsProxy::client(const IPAddress& ip, unsigned long now) {
+    uint32_t address = (uint32_t)ip;
+    int victim = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (_clients[i].ip == address) {
+            _clients[i].lastSeen = now;
+            return _clients[i];
+        }
+        if (_clients[i].ip == 0) {
+            victim = i;
+            break;
+        }
+        if (_clients[i].lastSeen < _clients[victim].lastSeen) victim = i;
+    }
+
+    ClientStats& stats = _clients[victim];
+    memset(&stats, 0, sizeof(stats));
+    stats.ip = address;
+    stats.lastSeen = now;
+    return stats;
+}
+
+bool DnsProxy::parseQuestion(const uint8_t* data, size_t length, Question& question) {
+    if (length < 12 || readU16(data + 4) != 1) return false; // Exactly one question
+
+    // Labels into a lowercase dotted name; no compression in a query's question
+    size_t pos = 12;
+    size_t nameLen = 0;
+    while (true) {
+        if (pos >= length) return false;
+        uint8_t label = data[pos++];
+        if (label == 0) break;
+        if (label > 63 || pos + label > length) return false;
+        if (nameLen + label + 1 >= sizeof(question.name)) return false;
+        if (nameLen > 0) question.name[nameLen++] = '.';
+        for (uint8_t i = 0; i < label; i++) {
+            char c = data[pos++];
+            question.name[nameLen++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+    }
+    question.name[nameLen] = '\0';
+    if (nameLen == 0 || pos + 4 > length) return false;
+
+    question.type = readU16(data + pos);
+    uint16_t qclass = readU16(data + pos + 2);
+    question.end = pos + 4;
+
+    // FNV-1a over name \0 type class
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i <= nameLen; i++) {
+        hash = (hash ^ (uint8_t)question.name[i]) * 16777619u;
+    }
+    hash = (hash ^ question.type) * 16777619u;
+    hash = (hash ^ qclass) * 16777619u;
+    question.key = hash != 0 ? hash : 1;
+    return true;
+}
+
+bool DnsProxy::skipName(const uint8_t* data, size_t length, size_t& pos) {
+    while (pos < length) {
+        uint8_t label = data[pos];
+        if ((label & 0xC0) == 0xC0) {
+            pos += 2; // Compression pointer ends the name
+            return pos <= length;
+        }
+        pos += 1 + label;
+        if (label == 0) return pos <= length;
+    }
+    return false;
+}
+
+uint32_t DnsProxy::answerTtl(const uint8_t* data, size_t length) {
+    uint16_t questions = readU16(data + 4);
+    uint16_t answers = readU16(data + 6);
+    uint32_t ttl = MAX_CACHE_TTL;
+    if ((data[3] & RCODE_MASK) == RCODE_NXDOMAIN || answers == 0) ttl = NEGATIVE_TTL;
+
+    size_t pos = 12;
+    for (uint16_t i = 0; i < questions; i++) {
+        if (!skipName(data, length, pos)) return MIN_CACHE_TTL;
+        pos += 4;
+    }
+    for (uint16_t i = 0; i < answers; i++) {
+        if (!skipName(data, length, pos) || pos + 10 > length) return MIN_CACHE_TTL;
+        uint32_t recordTtl = readU32(data + pos + 4);
+        if (recordTtl < ttl) ttl = recordTtl;
+        pos += 10 + readU16(data + pos + 8);
+    }
+
+    if (ttl < MIN_CACHE_TTL) ttl = MIN_CACHE_TTL;
+    if (ttl > MAX_CACHE_TTL) ttl = MAX_CACHE_TTL;
+    return ttl;
+}
+
+void DnsProxy::toJson(JsonObject& target) {
+    target["running"] = _running;
+    if (_lock == nullptr) return;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    target["queries"] = _queries;
+    target["blocked"] = _blocked;
+    target["cacheHits"] = _cacheHits;
+    target["forwarded"] = _forwarded;
+    target["dropped"] = _dropped;
+    target["timeouts"] = _timeouts;
+
+    int cached = 0;
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        if (_cache[i].key != 0) cached++;
+    }
+    target["cacheEntries"] = cached;
+
+    JsonArray clients = target["clients"].to<JsonArray>();
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const ClientStats& stats = _clients[i];
+        if (stats.ip == 0) continue;
+        JsonObject item = clients.add<JsonObject>();
+        item["ip"] = IPAddress(stats.ip).toString();
+        item["queries"] = stats.queries;
+        item["blocked"] = stats.blocked;
+        item["cached"] = stats.cached;
+    }
+    xSemaphoreGive(_lock);
+}
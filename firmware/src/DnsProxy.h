@@ -0,0 +1,124 @@
+#ifndef DNS_PROXY_H
+#define DNS_PROXY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <AsyncUDP.h>
+
+// Returns true if queries for `domain` (lowercase, no trailing dot) should be
+// answered with 0.0.0.0 / ::. Called once per query with the full name; the
+// policy decides how parent domains count (see anyDomainSuffix()).
+typedef bool (*DnsPolicy)(const char* domain);
+
+// True if fn(suffix) holds for `name` or any parent: example.com covers
+// ads.example.com
+template <typename Fn>
+bool anyDomainSuffix(const char* name, Fn fn) {
+    for (const char* suffix = name; suffix != nullptr; ) {
+        if (fn(suffix)) return true;
+        suffix = strchr(suffix, '.');
+        if (suffix != nullptr) suffix++;
+    }
+    return false;
+}
+
+// DNS forwarder on UDP port 53. Queries for blocked names (or their
+// subdomains) are answered on the spot; the rest go to the upstream resolver
+// with a rewritten transaction id and the answer is relayed back. Policy is
+// checked on every query, so a block or unblock takes effect immediately,
+// without a dnsmasq restart.
+//
+// Upstream answers (NOERROR / NXDOMAIN, untruncated) are cached for their
+// smallest TTL within [MIN_CACHE_TTL, MAX_CACHE_TTL]. Blocked answers are
+// never cached and the policy check comes before the cache, so a cached
+// answer cannot outlive a new block. Both sockets' callbacks
+// run on the AsyncUDP task, and the lock covers the tables for toJson().
+// Memory is fixed: MAX_PENDING in-flight queries, CACHE_SLOTS packets.
+class DnsProxy {
+public:
+    static const uint16_t PORT = 53;
+    static const int MAX_PACKET = 512;
+    static const int MAX_PENDING = 32;
+    static const unsigned long PENDING_TIMEOUT_MS = 3000;
+    static const int CACHE_SLOTS = 24;
+    static const uint32_t MIN_CACHE_TTL = 5;
+    static const uint32_t MAX_CACHE_TTL = 300;
+    static const uint32_t NEGATIVE_TTL = 30;   // NXDOMAIN / no answers
+    static const uint32_t BLOCK_TTL = 60;
+    static const int MAX_CLIENTS = 16;
+
+    DnsProxy();
+
+    bool begin(const IPAddress& upstream, DnsPolicy policy);
+    bool running() const { return _running; }
+    void toJson(JsonObject& target);
+
+private:
+    struct Pending {
+        bool used;
+        uint16_t proxyId;
+        uint16_t clientId;
+        IPAddress clientIp;
+        uint16_t clientPort;
+        uint32_t key;
+        unsigned long sentAt;
+    };
+
+    struct CacheSlot {
+        uint32_t key; // 0 = empty
+        unsigned long storedAt;
+        unsigned long lastUsed;
+        uint32_t ttlMs;
+        uint16_t length;
+        uint8_t data[MAX_PACKET];
+    };
+
+    struct ClientStats {
+        uint32_t ip; // 0 = empty
+        uint32_t queries;
+        uint32_t blocked;
+        uint32_t cached;
+        unsigned long lastSeen;
+    };
+
+    // What parseQuestion() found in a query
+    struct Question {
+        char name[254];
+        uint16_t type;
+        size_t end; // Offset just past the question
+        uint32_t key;
+    };
+
+    AsyncUDP _server;
+    AsyncUDP _upstream;
+    DnsPolicy _policy;
+    SemaphoreHandle_t _lock;
+    bool _running;
+
+    Pending _pending[MAX_PENDING];
+    CacheSlot _cache[CACHE_SLOTS];
+    ClientStats _clients[MAX_CLIENTS];
+
+    uint32_t _queries;
+    uint32_t _blocked;
+    uint32_t _cacheHits;
+    uint32_t _forwarded;
+    uint32_t _dropped;  // Malformed, or no free pending slot
+    uint32_t _timeouts;
+
+    void onQuery(AsyncUDPPacket& packet);
+    void onAnswer(AsyncUDPPacket& packet);
+
+    void answerBlocked(AsyncUDPPacket& packet, const Question& question);
+    bool answerFromCache(AsyncUDPPacket& packet, const Question& question, unsigned long now);
+    bool forward(AsyncUDPPacket& packet, const Question& question, unsigned long now);
+    uint16_t unusedId() const; // Upstream transaction id no pending query has
+    void store(uint32_t key, const uint8_t* data, size_t length, unsigned long now);
+    ClientStats& client(const IPAddress& ip, unsigned long now);
+
+    static bool parseQuestion(const uint8_t* data, size_t length, Question& question);
+    static bool skipName(const uint8_t* data, size_t length, size_t& pos);
+    static uint32_t answerTtl(const uint8_t* data, size_t length);
+};
+
+#endif
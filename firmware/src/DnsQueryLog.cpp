@@ -0,0 +1,206 @@
+#include "DnsQueryLog.h"
+#include "MacAddress.h"
+#include <IPAddress.h>
+
+DnsQueryLog::DnsQueryLog() {
+    _lock = nullptr;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        _devices[i].ip = 0;
+    }
+    memset(_recent, 0, sizeof(_recent));
+    _recentHead = 0;
+    _lines = _queries = _blocked = _gaps = 0;
+}
+
+void DnsQueryLog::begin() {
+    _lock = xSemaphoreCreateMutex();
+}
+
+int DnsQueryLog::ingest(const String& output) {
+    const char* text = output.c_str();
+    size_t length = output.length();
+    if (length == 0) return 0;
+
+    // 1. Find where the unseen part of the tail starts
+    const char* start = text;
+    if (_cursor.valid()) {
+        bool found;
+        start = _cursor.resume(text, length, found);
+        if (!found) _gaps++;
+    }
+
+    // 2. Aggregate the new lines
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    unsigned long now = millis();
+    int processed = 0;
+    LineReader lines(start, length - (start - text));
+    TextSpan line;
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (line.empty()) continue;
+        _cursor.seen(line);
+        parseLine(line, now);
+        processed++;
+    }
+    _lines += processed;
+    xSemaphoreGive(_lock);
+    return processed;
+}
+
+void DnsQueryLog::parseLine(const TextSpan& line, unsigned long now) {
+    // "<date> <facility> dnsmasq[pid]: message"
+    const char* tag = line.find("dnsmasq[");
+    if (tag == nullptr) return;
+    const char* colon = line.from(tag).find("]: ");
+    if (colon == nullptr) return;
+    TextSpan message = line.from(colon + 3);
+
+    // With log-queries=extra the message starts "<serial> <ip>/<port> "
+    const char* query = message.find("query[");
+    if (query != nullptr) {
+        // query[A] <name> from <ip>
+        const char* type = message.from(query).find(']');
+        if (type == nullptr) return;
+        FieldReader fields(message.from(type + 1));
+        TextSpan name, word, from;
+        if (!fields.next(name) || !fields.next(word) || !word.equals("from") || !fields.next(from)) {
+            return;
+        }
+
+        uint32_t ip;
+        if (!parseIp(from.data, from.len, ip)) return; // IPv6 clients are not tracked per device
+        uint32_t hash = hashName(name.data, name.len);
+
+        Device& dev = device(ip, now);
+        dev.queries++;
+        dev.top.add(name.data, name.len, hash);
+        _queryCounts.add(hash);
+        _queries++;
+
+        _recent[_recentHead].hash = hash;
+        _recent[_recentHead].ip = ip;
+        _recentHead = (_recentHead + 1) % RECENT;
+        return;
+    }
+
+    // config <name> is <answer>   or   /etc/hosts <name> is <answer>
+    FieldReader fields(message);
+    TextSpan source, name, word, answer;
+    if (!fields.next(source)) return;
+    if (source.data[0] >= '0' && source.data[0] <= '9') {
+        // Skip the "extra" serial and client address
+        if (!fields.next(source) || !fields.next(source)) return;
+    }
+    if (!source.equals("config") && source.data[0] != '/') return;
+    if (!fields.next(name) || !fields.next(word) || !word.equals("is") || !fields.next(answer)) {
+        return;
+    }
+    if (!answer.equals("0.0.0.0") && !answer.equals("::") && !answer.equals("NXDOMAIN")) {
+        return;
+    }
+
+    uint32_t hash = hashName(name.data, name.len);
+    _blockedCounts.add(hash);
+    _topBlocked.add(name.data, name.len, hash);
+    _blocked++;
+
+    // Newest first: the device that just asked
+    for (int i = 1; i <= RECENT; i++) {
+        const Recent& recent = _recent[(_recentHead - i + RECENT) % RECENT];
+        if (recent.ip != 0 && recent.hash == hash) {
+            device(recent.ip, now).blocked++;
+            break;
+        }
+    }
+}
+
+DnsQueryLog::Device& DnsQueryLog::device(uint32_t ip, unsigned long now) {
+    int victim = 0;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (_devices[i].ip == ip) {
+            _devices[i].lastSeen = now;
+            return _devices[i];
+        }
+        if (_devices[i].ip == 0) {
+            victim = i;
+            break;
+        }
+        if (_devices[i].lastSeen < _devices[victim].lastSeen) victim = i;
+    }
+
+    Device& dev = _devices[victim];
+    dev.ip = ip;
+    dev.queries = 0;
+    dev.blocked = 0;
+    dev.lastSeen = now;
+    dev.top.clear();
+    return dev;
+}
+
+void DnsQueryLog::toJson(JsonObject& target, const DeviceTable& devices) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    target["lines"] = _lines;
+    target["queries"] = _queries;
+    target["blocked"] = _blocked;
+    target["gaps"] = _gaps;
+
+    JsonArray deviceArray = target["devices"].to<JsonArray>();
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        const Device& dev = _devices[i];
+        if (dev.ip == 0) continue;
+
+        JsonObject item = deviceArray.add<JsonObject>();
+        item["ip"] = IPAddress(dev.ip).toString();
+        uint8_t mac[6];
+        const char* hostname;
+        if (devices.findByIp(dev.ip, mac, hostname)) {
+            item["mac"] = formatMac(mac);
+            item["hostname"] = hostname;
+        }
+        item["queries"] = dev.queries;
+        item["blocked"] = dev.blocked;
+        JsonArray top = item["top"].to<JsonArray>();
+        dev.top.toJson(top, TOP_N);
+    }
+
+    JsonArray topBlocked = target["topBlocked"].to<JsonArray>();
+    _topBlocked.toJson(topBlocked, TOP_N);
+    xSemaphoreGive(_lock);
+}
+
+void DnsQueryLog::estimate(const char* domain, uint32_t& queries, uint32_t& blocked) {
+    uint32_t hash = hashName(domain, strlen(domain));
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    queries = _queryCounts.estimate(hash);
+    blocked = _blockedCounts.estimate(hash);
+    xSemaphoreGive(_lock);
+}
+
+uint32_t DnsQueryLog::hashName(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)tolower((unsigned char)name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool DnsQueryLog::parseIp(const char* text, size_t len, uint32_t& ip) {
+    // Dotted quad into network byte order (first octet in the low byte, as IPAddress)
+    ip = 0;
+    int octet = 0;
+    int value = -1;
+    for (size_t i = 0; i <= len; i++) {
+        if (i == len || text[i] == '.') {
+            if (value < 0 || value > 255 || octet > 3) return false;
+            ip |= (uint32_t)value << (8 * octet++);
+            value = -1;
+        } else if (text[i] >= '0' && text[i] <= '9') {
+            value = (value < 0 ? 0 : value * 10) + (text[i] - '0');
+            if (value > 255) return false;
+        } else {
+            return false;
+        }
+    }
+    return octet == 4 && ip != 0;
+}
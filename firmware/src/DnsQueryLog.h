@@ -0,0 +1,77 @@
+#ifndef DNS_QUERY_LOG_H
+#define DNS_QUERY_LOG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "CountMinSketch.h"
+#include "DeviceTable.h"
+#include "SpaceSaving.h"
+#include "TextTokenizer.h"
+#include "LogCursor.h"
+
+// What each device looks up, aggregated from dnsmasq's log-queries output.
+// Each poll hands over the tail of `logread` (query and config lines only);
+// like AdblockLogTail, lines up to the last ones we processed are skipped
+// (see LogCursor). A poll whose tail no longer contains them counts as a
+// gap: the log ran faster than we read it.
+//
+//   dnsmasq[812]: query[A] www.youtube.com from 192.168.1.23
+//   dnsmasq[812]: config www.youtube.com is 0.0.0.0
+//
+// A config (or hosts file) answer of 0.0.0.0, :: or NXDOMAIN is a blocked
+// hit, credited to whichever device asked for that name most recently.
+// Lines are parsed in place; memory is fixed (~25 KB):
+//   - per device: query/blocked counts and Space-Saving top domains
+//   - overall: top blocked domains, and count-min sketches of query and
+//     blocked counts for any domain
+class DnsQueryLog {
+public:
+    static const int MAX_DEVICES = 16;
+    static const int TOP_SLOTS = 16;   // Counters per device; top TOP_N are reported
+    static const int TOP_N = 10;
+    static const int BLOCKED_SLOTS = 32;
+    static const int RECENT = 32;      // Recent queries, to attribute blocked answers
+
+    DnsQueryLog();
+
+    void begin();
+    int ingest(const String& output); // Returns number of new lines processed
+    void toJson(JsonObject& target, const DeviceTable& devices);
+    void estimate(const char* domain, uint32_t& queries, uint32_t& blocked); // Count-min estimates
+
+private:
+    struct Device {
+        uint32_t ip; // Network byte order, 0 = free
+        uint32_t queries;
+        uint32_t blocked;
+        unsigned long lastSeen;
+        SpaceSaving<TOP_SLOTS> top;
+    };
+
+    struct Recent {
+        uint32_t hash;
+        uint32_t ip;
+    };
+
+    SemaphoreHandle_t _lock; // ingest() runs in the aggregate task, toJson() in a request handler
+    Device _devices[MAX_DEVICES];
+    SpaceSaving<BLOCKED_SLOTS> _topBlocked;
+    CountMinSketch _queryCounts;
+    CountMinSketch _blockedCounts;
+    Recent _recent[RECENT];
+    int _recentHead;
+
+    LogCursor _cursor; // Into the router log
+    uint32_t _lines;
+    uint32_t _queries;
+    uint32_t _blocked;
+    uint32_t _gaps;
+
+    void parseLine(const TextSpan& line, unsigned long now);
+    Device& device(uint32_t ip, unsigned long now);
+
+    static uint32_t hashName(const char* name, size_t len); // Case-insensitive
+    static bool parseIp(const char* text, size_t len, uint32_t& ip);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef DOMAIN_LIST_H
+#define DOMAIN_LIST_H
+
+#include <Arduino.h>
+#include <vector>
+
+// Domains copied out of the stores into one block, NUL-separated, so a slow
+// router write can walk them without holding the lock the stores live under.
+// Walk it like a store: list([](const char* domain) { ... }). Read-only once
+// filled, so several tasks may walk it at once.
+class DomainList {
+public:
+    void reserve(size_t bytes) { _data.reserve(bytes); }
+    void add(const char* domain) { _data.insert(_data.end(), domain, domain + strlen(domain) + 1); }
+
+    size_t bytes() const { return _data.size(); }
+
+    template <typename Emit>
+    void operator()(Emit emit) const {
+        size_t pos = 0;
+        while (pos < _data.size()) {
+            const char* domain = &_data[pos];
+            emit(domain);
+            pos += strlen(domain) + 1;
+        }
+    }
+
+private:
+    std::vector<char> _data;
+};
+
+#endif
@@ -0,0 +1,395 @@
+#include "DomainStore.h"
+#include "BinarySnapshot.h"
+#include "Crc32.h"
+
+static const char IMAGE_MAGIC[4] = {'N', 'G', 'D', 'S'};
+static const uint16_t IMAGE_VERSION = 1;
+
+DomainStore::DomainStore(const char* basePath) {
+    _imagePath = String(basePath) + ".img";
+    _logPath = String(basePath) + ".log";
+    _logRecords = 0;
+    _generation = 0;
+    _compacting = false;
+    _image = nullptr;
+    _baseCount = 0;
+    _baseOffsets = nullptr;
+    _basePool = nullptr;
+    _baseRemovedCount = 0;
+}
+
+DomainStore::~DomainStore() {
+    free(_image);
+}
+
+bool DomainStore::begin() {
+    adoptImage(nullptr);
+    _logRecords = 0;
+
+    unsigned long start = millis();
+    bool imageOk = loadImage();
+    bool logOk = replayLog();
+
+    // A torn tail (power loss mid-append) or a bad image gets rewritten from
+    // what we could recover, so the next append starts on a clean log.
+    if (!imageOk || !logOk || _logRecords > COMPACT_RECORDS) {
+        compact();
+    }
+
+    if (!_filter.ready()) rebuildFilter();
+
+    Serial.print("DomainStore ");
+    Serial.print(_imagePath);
+    Serial.print(": ");
+    Serial.print(size());
+    Serial.print(" domains in ");
+    Serial.print(millis() - start);
+    Serial.println(" ms");
+    return imageOk && logOk;
+}
+
+bool DomainStore::add(const String& domain) {
+    if (domain.length() == 0 || domain.length() > MAX_DOMAIN_LEN) return false;
+    if (contains(domain)) return false;
+    if (!appendRecord(OP_ADD, domain)) return false;
+    applyAdd(domain);
+    if (_logRecords > COMPACT_RECORDS && !_compacting) compact();
+    return true;
+}
+
+bool DomainStore::remove(const String& domain) {
+    if (!contains(domain)) return false;
+    if (!appendRecord(OP_REMOVE, domain)) return false;
+    applyRemove(domain);
+    if (_logRecords > COMPACT_RECORDS && !_compacting) compact();
+    return true;
+}
+
+int DomainStore::addBatch(const char* const* domains, int count) {
+    // Encode every new domain into one buffer and append it in one write
+    std::vector<uint8_t> records;
+    std::vector<int> fresh;
+    for (int i = 0; i < count; i++) {
+        String domain = domains[i];
+        if (domain.length() == 0 || domain.length() > MAX_DOMAIN_LEN || contains(domain)) continue;
+
+        bool repeated = false; // Twice in this batch
+        for (int j : fresh) {
+            if (strcmp(domains[j], domains[i]) == 0) {
+                repeated = true;
+                break;
+            }
+        }
+        if (repeated) continue;
+
+        size_t pos = records.size();
+        uint8_t len = domain.length();
+        records.resize(pos + 2 + len + 4);
+        records[pos] = OP_ADD;
+        records[pos + 1] = len;
+        memcpy(&records[pos + 2], domain.c_str(), len);
+        uint32_t crc = crc32Update(0, &records[pos], 2 + len);
+        memcpy(&records[pos + 2 + len], &crc, 4);
+        fresh.push_back(i);
+    }
+    if (fresh.empty()) return 0;
+
+    File file = LittleFS.open(_logPath, "a");
+    if (!file) return -1;
+    size_t written = file.write(records.data(), records.size());
+    file.close();
+
+    // A short write leaves a torn tail, which the next begin() drops
+    if (written != records.size()) {
+        Serial.println("DomainStore: log append failed " + _logPath);
+        return -1;
+    }
+    for (int i : fresh) {
+        applyAdd(String(domains[i]));
+    }
+    _logRecords += fresh.size();
+    _generation++;
+    return fresh.size();
+}
+
+bool DomainStore::contains(const String& domain) const {
+    if (!_filter.mayContain(domain.c_str())) return false;
+
+    bool found;
+    int base = baseFind(domain.c_str());
+    if (base >= 0) {
+        found = !isBaseRemoved(base);
+    } else {
+        int index = addedLowerBound(domain);
+        found = index < (int)_added.size() && _added[index] == domain;
+    }
+
+    if (!found && _filter.ready()) _filter.noteFalsePositive();
+    return found;
+}
+
+int DomainStore::baseFind(const char* domain) const {
+    int low = 0;
+    int high = (int)_baseCount - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(baseAt(mid), domain);
+        if (cmp == 0) return mid;
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+int DomainStore::addedLowerBound(const String& domain) const {
+    int low = 0;
+    int high = _added.size();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(_added[mid].c_str(), domain.c_str()) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void DomainStore::applyAdd(const String& domain) {
+    int base = baseFind(domain.c_str());
+    if (base >= 0) {
+        if (isBaseRemoved(base)) {
+            _baseRemoved[base >> 3] &= ~(1 << (base & 7));
+            _baseRemovedCount--;
+            _filter.add(domain.c_str());
+        }
+    } else {
+        int index = addedLowerBound(domain);
+        if (index < (int)_added.size() && _added[index] == domain) return;
+        _added.insert(_added.begin() + index, domain);
+        _filter.add(domain.c_str());
+    }
+
+    if (_filter.full()) rebuildFilter();
+}
+
+void DomainStore::applyRemove(const String& domain) {
+    int base = baseFind(domain.c_str());
+    if (base >= 0) {
+        if (!isBaseRemoved(base)) {
+            _baseRemoved[base >> 3] |= (1 << (base & 7));
+            _baseRemovedCount++;
+        }
+        return;
+    }
+
+    int index = addedLowerBound(domain);
+    if (index < (int)_added.size() && _added[index] == domain) {
+        _added.erase(_added.begin() + index);
+    }
+}
+
+void DomainStore::adoptImage(uint8_t* image) {
+    // Caller has validated the image; nullptr resets to an empty store
+    free(_image);
+    _image = image;
+    _baseCount = 0;
+    _baseOffsets = nullptr;
+    _basePool = nullptr;
+    if (image != nullptr) {
+        memcpy(&_baseCount, image, 4);
+        _baseOffsets = (const uint32_t*)(image + 4);
+        _basePool = (const char*)(image + 4 + 4 * _baseCount);
+    }
+    _baseRemoved.assign((_baseCount + 7) / 8, 0);
+    _baseRemovedCount = 0;
+    _added.clear();
+    _filter.clear(); // Rebuilt once the store is complete again
+}
+
+void DomainStore::rebuildFilter() {
+    // Headroom so a run of additions does not force another rebuild right away
+    _filter.reset(size() + size() / 2 + 64);
+    forEach([&](const char* domain) { _filter.add(domain); });
+}
+
+bool DomainStore::loadImage() {
+    size_t size;
+    uint8_t* image = readSnapshot(_imagePath.c_str(), IMAGE_MAGIC, IMAGE_VERSION, size);
+    if (image == nullptr) {
+        return !LittleFS.exists(_imagePath); // Missing is fine, unreadable is not
+    }
+
+    // Bounds-check the offset table once so lookups can trust it
+    uint32_t count = 0;
+    bool ok = size >= 4;
+    if (ok) {
+        memcpy(&count, image, 4);
+        ok = (size_t)count <= (size - 4) / 4;
+    }
+    size_t poolSize = ok ? size - 4 - 4 * (size_t)count : 0;
+    ok = ok && (count == 0 || (poolSize > 0 && image[size - 1] == '\0'));
+    for (uint32_t i = 0; ok && i < count; i++) {
+        uint32_t offset;
+        memcpy(&offset, image + 4 + 4 * i, 4);
+        ok = offset < poolSize;
+    }
+
+    if (!ok) {
+        Serial.println("DomainStore: malformed image " + _imagePath);
+        free(image);
+        return false;
+    }
+
+    adoptImage(image);
+    return true;
+}
+
+bool DomainStore::replayLog() {
+    if (!LittleFS.exists(_logPath)) return true;
+
+    File file = LittleFS.open(_logPath, "r");
+    if (!file) return false;
+
+    bool clean = true;
+    uint8_t record[2 + MAX_DOMAIN_LEN + 4];
+    while (true) {
+        if (file.read(record, 2) != 2) break; // End of log
+
+        uint8_t op = record[0];
+        uint8_t len = record[1];
+        if (file.read(record + 2, len + 4) != (size_t)len + 4) {
+            clean = false; // Torn final record
+            break;
+        }
+
+        uint32_t storedCrc;
+        memcpy(&storedCrc, record + 2 + len, 4);
+        if (crc32Update(0, record, 2 + len) != storedCrc) {
+            clean = false;
+            break;
+        }
+
+        String domain;
+        domain.concat((const char*)record + 2, len);
+        if (op == OP_ADD) {
+            applyAdd(domain);
+        } else if (op == OP_REMOVE) {
+            applyRemove(domain);
+        }
+        _logRecords++;
+    }
+    file.close();
+
+    if (!clean) {
+        Serial.println("DomainStore: dropped corrupt log tail " + _logPath);
+    }
+    return clean;
+}
+
+bool DomainStore::appendRecord(Op op, const String& domain) {
+    uint8_t record[2 + MAX_DOMAIN_LEN + 4];
+    uint8_t len = domain.length();
+    record[0] = op;
+    record[1] = len;
+    memcpy(record + 2, domain.c_str(), len);
+    uint32_t crc = crc32Update(0, record, 2 + len);
+    memcpy(record + 2 + len, &crc, 4);
+
+    File file = LittleFS.open(_logPath, "a");
+    if (!file) return false;
+    size_t written = file.write(record, 2 + len + 4);
+    file.close();
+
+    if (written != (size_t)(2 + len + 4)) {
+        Serial.println("DomainStore: log append failed " + _logPath);
+        return false;
+    }
+    _logRecords++;
+    _generation++;
+    return true;
+}
+
+bool DomainStore::compact() {
+    size_t imageSize;
+    uint8_t* image = buildImage(imageSize);
+    if (image == nullptr) return false;
+    if (!writeImage(image, imageSize)) {
+        free(image);
+        return false;
+    }
+    installImage(image);
+    return true;
+}
+
+bool DomainStore::compact(SemaphoreHandle_t lock) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (_compacting) {
+        xSemaphoreGive(lock);
+        return false;
+    }
+    size_t imageSize;
+    uint8_t* image = buildImage(imageSize);
+    uint32_t generation = _generation;
+    _compacting = image != nullptr;
+    xSemaphoreGive(lock);
+    if (image == nullptr) return false;
+
+    bool written = writeImage(image, imageSize);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool installed = written && _generation == generation;
+    if (installed) {
+        installImage(image);
+    } else {
+        free(image);
+    }
+    _compacting = false;
+    xSemaphoreGive(lock);
+    return installed;
+}
+
+uint8_t* DomainStore::buildImage(size_t& imageSize) const {
+    // count | offsets | pool
+    uint32_t count = size();
+    size_t poolSize = 0;
+    forEach([&](const char* domain) { poolSize += strlen(domain) + 1; });
+
+    imageSize = 4 + 4 * (size_t)count + poolSize;
+    uint8_t* image = (uint8_t*)malloc(imageSize);
+    if (image == nullptr) {
+        Serial.println("DomainStore: no memory to compact " + _imagePath);
+        return nullptr;
+    }
+
+    memcpy(image, &count, 4);
+    uint32_t* offsets = (uint32_t*)(image + 4);
+    char* pool = (char*)(image + 4 + 4 * count);
+    uint32_t index = 0;
+    uint32_t poolUsed = 0;
+    forEach([&](const char* domain) {
+        size_t len = strlen(domain) + 1;
+        offsets[index++] = poolUsed;
+        memcpy(pool + poolUsed, domain, len);
+        poolUsed += len;
+    });
+    return image;
+}
+
+bool DomainStore::writeImage(const uint8_t* image, size_t imageSize) const {
+    SnapshotPart part = {image, imageSize};
+    return writeSnapshot(_imagePath.c_str(), IMAGE_MAGIC, IMAGE_VERSION, &part, 1);
+}
+
+void DomainStore::installImage(uint8_t* image) {
+    // The image is in place; replaying the old log over it is harmless if we
+    // lose power before the log is removed.
+    LittleFS.remove(_logPath);
+    _logRecords = 0;
+    _generation++;
+    adoptImage(image);
+    rebuildFilter();
+}
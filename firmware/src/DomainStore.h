@@ -0,0 +1,111 @@
+#ifndef DOMAIN_STORE_H
+#define DOMAIN_STORE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <vector>
+#include "BloomFilter.h"
+
+// Persistent, sorted set of domains on LittleFS.
+// Edits are appended to a log as CRC-checked records, so adding or removing a
+// domain costs one small flash append instead of rewriting the whole list.
+// Once the log grows past COMPACT_RECORDS it is folded into a snapshot image.
+//
+//   <base>.img  BinarySnapshot "NGDS": count | offsets u32[count] | string pool
+//   <base>.log  [op | len | domain | crc]...
+//
+// At boot the image is read into one buffer and used in place (no allocation
+// per domain); the log is replayed into a small overlay of additions and
+// removals on top of it, which the next compaction folds back in.
+//
+// A Bloom filter over the current domains answers most misses in contains()
+// without a binary search. Additions go straight into it; removals leave
+// stale bits until the next compaction rebuilds it from scratch.
+class DomainStore {
+public:
+    static const int MAX_DOMAIN_LEN = 253;
+    static const int COMPACT_RECORDS = 64;
+
+    explicit DomainStore(const char* basePath);
+    ~DomainStore();
+
+    bool begin(); // Load image + replay log
+    bool add(const String& domain);    // false if already present or not persisted
+    bool remove(const String& domain); // false if not present or not persisted
+    bool contains(const String& domain) const;
+    bool compact(); // Rewrite image, truncate log
+
+    // Same for a store shared under `lock`, held only while the domains are
+    // copied out and while the new image is swapped in, not for the flash
+    // write in between. If the store changed meanwhile the image on flash is
+    // still valid (the log replays over it) but the log stays; false then.
+    bool compact(SemaphoreHandle_t lock);
+
+    // Bulk add with one log append and no compaction, for imports; the caller
+    // compacts when logRecords() gets large. Returns how many were new, -1 if
+    // the append failed (nothing is applied then).
+    int addBatch(const char* const* domains, int count);
+
+    int size() const { return _baseCount - _baseRemovedCount + _added.size(); }
+    int logRecords() const { return _logRecords; }
+    const BloomFilter& filter() const { return _filter; }
+
+    // Visits every domain in sorted order: fn(const char* domain)
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        uint32_t base = 0;
+        size_t added = 0;
+        while (base < _baseCount || added < _added.size()) {
+            if (base < _baseCount && isBaseRemoved(base)) {
+                base++;
+                continue;
+            }
+            if (added >= _added.size() ||
+                (base < _baseCount && strcmp(baseAt(base), _added[added].c_str()) < 0)) {
+                fn(baseAt(base++));
+            } else {
+                fn(_added[added++].c_str());
+            }
+        }
+    }
+
+private:
+    enum Op : uint8_t { OP_ADD = 1, OP_REMOVE = 2 };
+
+    String _imagePath;
+    String _logPath;
+    int _logRecords;
+    uint32_t _generation; // Bumped by every change, so compact(lock) can tell it raced one
+    bool _compacting;     // compact(lock) is writing the image; edits don't compact meanwhile
+
+    // Snapshot image, used in place
+    uint8_t* _image;
+    uint32_t _baseCount;
+    const uint32_t* _baseOffsets;
+    const char* _basePool;
+    std::vector<uint8_t> _baseRemoved; // Bitmap over base entries
+    uint32_t _baseRemovedCount;
+
+    // Domains added since the image was written, sorted
+    std::vector<String> _added;
+
+    BloomFilter _filter;
+
+    const char* baseAt(uint32_t index) const { return _basePool + _baseOffsets[index]; }
+    bool isBaseRemoved(uint32_t index) const { return _baseRemoved[index >> 3] & (1 << (index & 7)); }
+    int baseFind(const char* domain) const; // -1 if absent
+    int addedLowerBound(const String& domain) const;
+
+    void applyAdd(const String& domain);
+    void applyRemove(const String& domain);
+    void adoptImage(uint8_t* image);
+    uint8_t* buildImage(size_t& imageSize) const; // malloc'd, nullptr if out of memory
+    bool writeImage(const uint8_t* image, size_t imageSize) const;
+    void installImage(uint8_t* image); // Once written; takes ownership
+    void rebuildFilter();
+    bool loadImage();
+    bool replayLog(); // false if a torn or corrupt record was found
+    bool appendRecord(Op op, const String& domain);
+};
+
+#endif
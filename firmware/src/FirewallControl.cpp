@@ -0,0 +1,234 @@
+#include "FirewallControl.h"
+#include "BinarySnapshot.h"
+#include "MacAddress.h"
+
+static const char STATE_MAGIC[4] = {'N', 'G', 'F', 'W'};
+static const uint16_t STATE_VERSION = 1;
+
+FirewallControl::FirewallControl(const char* statePath) {
+    _statePath = statePath;
+    _runner = nullptr;
+    _blockedCount = 0;
+    _lanBlocked = false;
+    _scheduledCount = 0;
+    _installed = false;
+    _version = 0;
+}
+
+void FirewallControl::begin(NftRunner runner) {
+    _runner = runner;
+    load();
+}
+
+bool FirewallControl::install() {
+    // "add" then "delete" makes the delete safe when the table doesn't exist
+    // yet; nft applies the whole command as one transaction.
+    String command = "add table inet netguard\n"
+                     "delete table inet netguard\n"
+                     "table inet netguard {\n"
+                     "  set blocked_mac { type ether_addr;";
+    if (_blockedCount > 0) {
+        command += " elements = { ";
+        appendMacs(command, _blocked, _blockedCount);
+        command += " }";
+    }
+    command += " }\n"
+               "  set scheduled_mac { type ether_addr;";
+    if (_scheduledCount > 0) {
+        command += " elements = { ";
+        appendMacs(command, _scheduled, _scheduledCount);
+        command += " }";
+    }
+    command += " }\n"
+               "  set blocked_iif { type ifname;";
+    if (_lanBlocked) {
+        command += String(" elements = { \"") + LAN_IFNAME + "\" }";
+    }
+    command += " }\n"
+               "  chain forward {\n"
+               "    type filter hook forward priority filter - 5; policy accept;\n"
+               "    ether saddr @blocked_mac drop\n"
+               "    ether saddr @scheduled_mac drop\n"
+               "    iifname @blocked_iif drop\n"
+               "  }\n"
+               "}\n";
+
+    _installed = run(command);
+    if (_installed) {
+        Serial.print("Firewall: installed with ");
+        Serial.print(_blockedCount);
+        Serial.println(_lanBlocked ? " blocked devices, LAN blocked" : " blocked devices");
+    }
+    return _installed;
+}
+
+bool FirewallControl::sync() {
+    return _installed || install();
+}
+
+bool FirewallControl::setDevicesBlocked(const uint8_t (*macs)[6], int count, bool blocked) {
+    // Update the desired state, collecting the elements that actually change
+    String elements;
+    bool complete = true;
+    for (int i = 0; i < count; i++) {
+        int index = find(macs[i]);
+        if (blocked) {
+            if (index >= 0) continue;
+            if (_blockedCount >= MAX_BLOCKED) {
+                complete = false;
+                continue;
+            }
+            memcpy(_blocked[_blockedCount++], macs[i], 6);
+        } else {
+            if (index < 0) continue;
+            memcpy(_blocked[index], _blocked[--_blockedCount], 6);
+        }
+        elements += (elements.length() == 0 ? "" : ", ") + formatMac(macs[i]);
+    }
+    if (elements.length() == 0) return complete;
+
+    _version++;
+    save();
+
+    // Nothing to patch if the table isn't there; sync() will build it whole
+    if (!_installed) return sync() && complete;
+
+    String command = String(blocked ? "add" : "delete") + " element inet netguard blocked_mac { " + elements + " }";
+    if (!run(command)) {
+        _installed = false; // Rebuilt on the next sync()
+        return false;
+    }
+    return complete;
+}
+
+bool FirewallControl::setLanBlocked(bool blocked) {
+    if (_lanBlocked == blocked) return sync();
+
+    _lanBlocked = blocked;
+    _version++;
+    save();
+
+    if (!_installed) return sync();
+
+    String command = String(blocked ? "add" : "delete") + " element inet netguard blocked_iif { \"" + LAN_IFNAME + "\" }";
+    if (!run(command)) {
+        _installed = false;
+        return false;
+    }
+    return true;
+}
+
+bool FirewallControl::setScheduled(const uint8_t (*macs)[6], int count) {
+    if (count > MAX_SCHEDULED) {
+        Serial.println("FirewallControl: " + String(count) + " scheduled devices, only " +
+                       String(MAX_SCHEDULED) + " blocked");
+        count = MAX_SCHEDULED;
+    }
+
+    // Diff against the current set so one command carries every change.
+    // Built as text straight away: the set is too big to copy on the stack.
+    String added;
+    String removed;
+    for (int i = 0; i < count; i++) {
+        if (findScheduled(macs[i]) >= 0) continue;
+        if (added.length() > 0) added += ", ";
+        added += formatMac(macs[i]);
+    }
+    for (int i = 0; i < _scheduledCount; i++) {
+        bool kept = false;
+        for (int j = 0; j < count && !kept; j++) {
+            kept = sameMac(_scheduled[i], macs[j]);
+        }
+        if (kept) continue;
+        if (removed.length() > 0) removed += ", ";
+        removed += formatMac(_scheduled[i]);
+    }
+
+    memcpy(_scheduled, macs, (size_t)count * 6);
+    _scheduledCount = count;
+    if (added.length() == 0 && removed.length() == 0) return sync();
+    _version++;
+
+    if (!_installed) return sync();
+
+    String command;
+    if (added.length() > 0) {
+        command += "add element inet netguard scheduled_mac { " + added + " }\n";
+    }
+    if (removed.length() > 0) {
+        command += "delete element inet netguard scheduled_mac { " + removed + " }\n";
+    }
+    if (!run(command)) {
+        _installed = false;
+        return false;
+    }
+    return true;
+}
+
+void FirewallControl::toJson(JsonObject& target) const {
+    target["lanBlocked"] = _lanBlocked;
+    target["installed"] = _installed;
+    JsonArray devices = target["blockedDevices"].to<JsonArray>();
+    for (int i = 0; i < _blockedCount; i++) {
+        devices.add(formatMac(_blocked[i]));
+    }
+    JsonArray scheduled = target["scheduledDevices"].to<JsonArray>();
+    for (int i = 0; i < _scheduledCount; i++) {
+        scheduled.add(formatMac(_scheduled[i]));
+    }
+}
+
+int FirewallControl::find(const uint8_t mac[6]) const {
+    for (int i = 0; i < _blockedCount; i++) {
+        if (sameMac(_blocked[i], mac)) return i;
+    }
+    return -1;
+}
+
+int FirewallControl::findScheduled(const uint8_t mac[6]) const {
+    for (int i = 0; i < _scheduledCount; i++) {
+        if (sameMac(_scheduled[i], mac)) return i;
+    }
+    return -1;
+}
+
+void FirewallControl::appendMacs(String& command, const uint8_t (*macs)[6], int count) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0) command += ", ";
+        command += formatMac(macs[i]);
+    }
+}
+
+bool FirewallControl::run(const String& command) {
+    if (_runner == nullptr) return false;
+    if (!_runner(command)) {
+        Serial.println("Firewall: nft failed: " + command);
+        return false;
+    }
+    return true;
+}
+
+void FirewallControl::save() const {
+    // lanBlocked u8 | count u8 | macs[count][6]
+    uint8_t header[2] = {(uint8_t)_lanBlocked, (uint8_t)_blockedCount};
+    SnapshotPart parts[] = {
+        {header, sizeof(header)},
+        {_blocked, (size_t)_blockedCount * 6},
+    };
+    writeSnapshot(_statePath.c_str(), STATE_MAGIC, STATE_VERSION, parts, 2);
+}
+
+void FirewallControl::load() {
+    size_t size;
+    uint8_t* payload = readSnapshot(_statePath.c_str(), STATE_MAGIC, STATE_VERSION, size);
+    if (payload == nullptr) return;
+
+    if (size >= 2 && payload[1] <= MAX_BLOCKED && size == 2 + (size_t)payload[1] * 6) {
+        _lanBlocked = payload[0] != 0;
+        _blockedCount = payload[1];
+        memcpy(_blocked, payload + 2, (size_t)_blockedCount * 6);
+    } else {
+        Serial.println("Firewall: malformed state " + _statePath);
+    }
+    free(payload);
+}
@@ -0,0 +1,73 @@
+#ifndef FIREWALL_CONTROL_H
+#define FIREWALL_CONTROL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Runs one nft command on the router; true if it exited 0
+typedef bool (*NftRunner)(const String& command);
+
+// Internet blocking on the router through nftables sets.
+// Our rules live in their own table, so fw4 reloads leave them alone:
+//
+//   table inet netguard {
+//       set blocked_mac { type ether_addr; }   // Per-device blocks
+//       set scheduled_mac { type ether_addr; } // Blocks owned by the Scheduler
+//       set blocked_iif { type ifname; }       // LAN-wide block (LAN_IFNAME)
+//       chain forward { type filter hook forward priority filter - 5; ... drop }
+//   }
+//
+// Blocking or unblocking is a single "add/delete element" on a set; many
+// devices go out in one command. The desired state is kept here (and saved
+// to LittleFS) and install() rebuilds the whole table from it in one atomic
+// nft transaction, for first use, after a router reboot, or after a failed
+// incremental update.
+class FirewallControl {
+public:
+    static const int MAX_BLOCKED = 32;
+    static const int MAX_SCHEDULED = 128; // Every target of every Scheduler rule
+    static constexpr const char* LAN_IFNAME = "br-lan";
+
+    explicit FirewallControl(const char* statePath);
+
+    void begin(NftRunner runner); // Restores the desired state
+
+    bool install(); // Rebuilds the table on the router from the desired state
+    bool sync();    // install() if the router may have drifted; cheap otherwise
+
+    bool setDevicesBlocked(const uint8_t (*macs)[6], int count, bool blocked); // One set update
+    bool setDeviceBlocked(const uint8_t mac[6], bool blocked) { return setDevicesBlocked((const uint8_t (*)[6])mac, 1, blocked); }
+    bool setLanBlocked(bool blocked);
+    bool setScheduled(const uint8_t (*macs)[6], int count); // Replaces the scheduled set, one nft call
+
+    bool isBlocked(const uint8_t mac[6]) const { return find(mac) >= 0; }
+    bool isScheduled(const uint8_t mac[6]) const { return findScheduled(mac) >= 0; }
+    bool lanBlocked() const { return _lanBlocked; }
+    bool installed() const { return _installed; }
+    uint32_t version() const { return _version; } // Changes whenever the desired state does
+    void toJson(JsonObject& target) const;
+
+private:
+    String _statePath;
+    NftRunner _runner;
+
+    uint8_t _blocked[MAX_BLOCKED][6];
+    int _blockedCount;
+    bool _lanBlocked;
+
+    // Not saved: the Scheduler recomputes it from its rules at boot
+    uint8_t _scheduled[MAX_SCHEDULED][6];
+    int _scheduledCount;
+
+    bool _installed; // Router matches the desired state as far as we know
+    uint32_t _version;
+
+    int find(const uint8_t mac[6]) const;
+    int findScheduled(const uint8_t mac[6]) const;
+    static void appendMacs(String& command, const uint8_t (*macs)[6], int count);
+    bool run(const String& command);
+    void save() const;
+    void load();
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "HostsImporter.h"
+
+HostsImporter::HostsImporter() {
+    _store = nullptr;
+    _maxDomains = 0;
+    _active = false;
+    _failed = false;
+    _startMs = 0;
+    _lastFeedMs = 0;
+    _elapsedMs = 0;
+    _lineLen = 0;
+    _lineOverflow = false;
+    _poolUsed = 0;
+    _batchCount = 0;
+    _bytes = _lines = _added = _duplicates = _invalid = _overBudget = 0;
+}
+
+bool HostsImporter::begin(DomainStore* store, int maxDomains) {
+    if (busy()) return false;
+
+    _store = store;
+    _maxDomains = maxDomains;
+    _active = true;
+    _failed = false;
+    _startMs = millis();
+    _lastFeedMs = _startMs;
+    _elapsedMs = 0;
+    _lineLen = 0;
+    _lineOverflow = false;
+    _poolUsed = 0;
+    _batchCount = 0;
+    _bytes = _lines = _added = _duplicates = _invalid = _overBudget = 0;
+    return true;
+}
+
+bool HostsImporter::busy() const {
+    return _active && millis() - _lastFeedMs < STALE_MS;
+}
+
+void HostsImporter::feed(const uint8_t* data, size_t len) {
+    if (!_active || _failed) return;
+    _lastFeedMs = millis();
+    _bytes += len;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\n') {
+            if (!_lineOverflow) parseLine(_line, _lineLen);
+            _lines++;
+            _lineLen = 0;
+            _lineOverflow = false;
+        } else if (_lineOverflow) {
+            continue;
+        } else if (_lineLen == MAX_LINE) {
+            _lineOverflow = true;
+            _invalid++;
+        } else {
+            _line[_lineLen++] = c;
+        }
+    }
+}
+
+bool HostsImporter::finish() {
+    if (!_active) return !_failed;
+
+    if (_lineLen > 0 && !_lineOverflow && !_failed) {
+        parseLine(_line, _lineLen); // Last line without a newline
+        _lines++;
+    }
+    if (!_failed) flush();
+
+    _elapsedMs = millis() - _startMs;
+    _active = false;
+
+    Serial.printf("HostsImporter: %lu lines, %lu added, %lu duplicate, %lu invalid in %lu ms\n",
+                  (unsigned long)_lines, (unsigned long)_added, (unsigned long)_duplicates,
+                  (unsigned long)_invalid, _elapsedMs);
+    return !_failed;
+}
+
+void HostsImporter::parseLine(char* line, int len) {
+    line[len] = '\0';
+
+    // Cut comments: a '#' at the start or after whitespace (adblock cosmetic
+    // rules like "example.com##.ad" keep theirs and fail validation below)
+    for (int i = 0; i < len; i++) {
+        if (line[i] == '#' && (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')) {
+            line[i] = '\0';
+            break;
+        }
+    }
+
+    // Split into whitespace-separated tokens
+    char* tokens[8];
+    int count = 0;
+    char* p = line;
+    while (*p != '\0' && count < 8) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        if (*p == '\0') break;
+        tokens[count++] = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        if (*p != '\0') *p++ = '\0';
+    }
+    if (count == 0) return;
+
+    char* first = tokens[0];
+    if (first[0] == '!' || first[0] == '[') return; // Adblock comment / header
+
+    if (isAddress(first)) {
+        if (count == 1) _invalid++;
+        for (int i = 1; i < count; i++) {
+            queue(tokens[i]);
+        }
+        return;
+    }
+
+    if (first[0] == '|' && first[1] == '|') {
+        // Only whole-domain rules ("||domain^"), not paths or $options
+        char* caret = strchr(first, '^');
+        if (caret == nullptr || caret[1] != '\0' || count > 1) {
+            _invalid++;
+            return;
+        }
+        *caret = '\0';
+        queue(first + 2);
+        return;
+    }
+
+    if (count > 1) {
+        _invalid++;
+        return;
+    }
+    queue(first);
+}
+
+void HostsImporter::queue(char* domain) {
+    if (!normalize(domain)) {
+        _invalid++;
+        return;
+    }
+    if (_store->contains(domain)) {
+        _duplicates++;
+        return;
+    }
+    if (_store->size() + _batchCount >= _maxDomains) {
+        _overBudget++;
+        return;
+    }
+
+    int len = strlen(domain) + 1;
+    if (_batchCount == BATCH_DOMAINS || _poolUsed + len > BATCH_BYTES) {
+        flush();
+        if (_failed) return;
+    }
+
+    char* slot = _pool + _poolUsed;
+    memcpy(slot, domain, len);
+    _poolUsed += len;
+    _batch[_batchCount++] = slot;
+}
+
+void HostsImporter::flush() {
+    if (_batchCount == 0) return;
+
+    int added = _store->addBatch(_batch, _batchCount);
+    if (added < 0) {
+        _failed = true;
+    } else {
+        _added += added;
+        _duplicates += _batchCount - added; // Repeated within the batch
+    }
+    _batchCount = 0;
+    _poolUsed = 0;
+}
+
+bool HostsImporter::compactDue() const {
+    if (_store == nullptr || _failed) return false;
+    // Mid-import, only now and then; once finished, as for any other edit
+    int threshold = _active ? COMPACT_RECORDS : DomainStore::COMPACT_RECORDS + 1;
+    return _store->logRecords() >= threshold;
+}
+
+bool HostsImporter::normalize(char* domain) {
+    int len = strlen(domain);
+    while (len > 0 && domain[len - 1] == '.') {
+        domain[--len] = '\0';
+    }
+    if (len == 0 || len > DomainStore::MAX_DOMAIN_LEN) return false;
+
+    bool dotted = false;
+    bool numeric = true;
+    int labelLen = 0;
+    for (int i = 0; i < len; i++) {
+        char c = domain[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+            domain[i] = c;
+        }
+
+        if (c == '.') {
+            if (labelLen == 0) return false; // Leading or doubled dot
+            dotted = true;
+            labelLen = 0;
+            continue;
+        }
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_')) return false;
+        if (c < '0' || c > '9') numeric = false;
+        if (c == '-' && labelLen == 0) return false;
+        if (++labelLen > 63) return false;
+    }
+
+    // Bare names and IPs are not blockable domains
+    if (!dotted || numeric) return false;
+    return strcmp(domain, "localhost.localdomain") != 0;
+}
+
+bool HostsImporter::isAddress(const char* token) {
+    if (strchr(token, ':') != nullptr) return true; // IPv6 (::, ::1, fe80::...)
+
+    int dots = 0;
+    for (const char* p = token; *p != '\0'; p++) {
+        if (*p == '.') {
+            dots++;
+        } else if (*p < '0' || *p > '9') {
+            return false;
+        }
+    }
+    return dots == 3;
+}
+
+void HostsImporter::toJson(JsonObject& target) const {
+    unsigned long elapsed = _active ? millis() - _startMs : _elapsedMs;
+
+    target["active"] = busy();
+    target["failed"] = _failed;
+    target["lines"] = _lines;
+    target["bytes"] = _bytes;
+    target["added"] = _added;
+    target["duplicates"] = _duplicates;
+    target["invalid"] = _invalid;
+    target["overBudget"] = _overBudget;
+    target["ms"] = elapsed;
+    target["linesPerSec"] = elapsed > 0 ? (uint32_t)((uint64_t)_lines * 1000 / elapsed) : _lines;
+    target["bytesPerSec"] = elapsed > 0 ? (uint32_t)((uint64_t)_bytes * 1000 / elapsed) : _bytes;
+}
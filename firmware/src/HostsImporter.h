@@ -0,0 +1,75 @@
+#ifndef HOSTS_IMPORTER_H
+#define HOSTS_IMPORTER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "DomainStore.h"
+
+// Streams a public block list into a DomainStore as it arrives, one HTTP body
+// chunk at a time. Accepted line formats, detected per line:
+//
+//   0.0.0.0 ads.example.com tracker.example.com   hosts file (any IP first)
+//   ||ads.example.com^                            adblock filter
+//   ads.example.com                               plain list
+//
+// Comments (#, !) and adblock headers are skipped; domains are lowercased,
+// a trailing dot is dropped and anything that is not a hostname is counted
+// as invalid. New domains are collected into a fixed batch and written with
+// one log append, so memory use does not depend on the size of the list:
+// a line buffer, one batch, and the store itself (capped at maxDomains).
+//
+// The importer never compacts the store itself: the caller feeds it under
+// the store's lock and, once compactDue(), compacts with
+// DomainStore::compact(lock) so the image write doesn't hold that lock.
+class HostsImporter {
+public:
+    static const int MAX_LINE = 512;          // Longer lines are skipped
+    static const int BATCH_DOMAINS = 64;
+    static const int BATCH_BYTES = 4096;      // Pool for the pending batch
+    static const int COMPACT_RECORDS = 1024;  // Fold the store's log in this often
+    static const unsigned long STALE_MS = 10000; // An abandoned upload frees the importer
+
+    HostsImporter();
+
+    bool begin(DomainStore* store, int maxDomains); // false if another import is running
+    void feed(const uint8_t* data, size_t len);
+    bool finish(); // Flushes the tail; false if a store write failed
+    bool compactDue() const; // The store's log is long enough to fold in
+
+    bool busy() const;
+    int added() const { return _added; }
+    void toJson(JsonObject& target) const; // Counts and throughput of the last import
+
+private:
+    DomainStore* _store;
+    int _maxDomains;
+    bool _active;
+    bool _failed;
+    unsigned long _startMs;
+    unsigned long _lastFeedMs;
+    unsigned long _elapsedMs;
+
+    char _line[MAX_LINE + 1];
+    int _lineLen;
+    bool _lineOverflow; // Dropping the rest of an overlong line
+
+    char _pool[BATCH_BYTES];
+    int _poolUsed;
+    const char* _batch[BATCH_DOMAINS];
+    int _batchCount;
+
+    uint32_t _bytes;
+    uint32_t _lines;
+    uint32_t _added;
+    uint32_t _duplicates;
+    uint32_t _invalid;
+    uint32_t _overBudget;
+
+    void parseLine(char* line, int len);
+    void queue(char* domain);
+    void flush();
+    static bool normalize(char* domain); // In place; false if not a hostname
+    static bool isAddress(const char* token);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "LogCursor.h"
+
+LogCursor::LogCursor() {
+    memset(_hashes, 0, sizeof(_hashes));
+    _count = 0;
+}
+
+void LogCursor::seen(const TextSpan& line) {
+    TextSpan trimmed = line.trimmed();
+    if (trimmed.empty()) return;
+    push(_hashes, _count, hashLine(trimmed));
+}
+
+const char* LogCursor::resume(const char* text, size_t length, bool& found) const {
+    found = false;
+    const char* start = text;
+
+    // Slide a window of the tail's last DEPTH hashes down the text and
+    // compare as much of it as both sides have. The last match wins.
+    uint32_t window[DEPTH];
+    int filled = 0;
+    LineReader lines(text, length);
+    TextSpan line;
+    while (lines.next(line)) {
+        TextSpan trimmed = line.trimmed();
+        if (trimmed.empty()) continue;
+        push(window, filled, hashLine(trimmed));
+
+        int n = filled < _count ? filled : _count;
+        if (n > 0 && memcmp(window + filled - n, _hashes + _count - n, n * sizeof(uint32_t)) == 0) {
+            start = lines.position();
+            found = true;
+        }
+    }
+    return start;
+}
+
+uint32_t LogCursor::hashLine(const TextSpan& trimmed) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < trimmed.len; i++) {
+        hash ^= (uint8_t)trimmed.data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void LogCursor::push(uint32_t* hashes, int& count, uint32_t hash) {
+    if (count == DEPTH) {
+        memmove(hashes, hashes + 1, (DEPTH - 1) * sizeof(uint32_t));
+        count--;
+    }
+    hashes[count++] = hash;
+}
@@ -0,0 +1,34 @@
+#ifndef LOG_CURSOR_H
+#define LOG_CURSOR_H
+
+#include <Arduino.h>
+#include "TextTokenizer.h"
+
+// Where we left off in a router log that we only ever see as the tail of
+// `logread`. Remembers hashes of the last DEPTH lines handed to seen(), and
+// resume() finds that run of lines in the next tail, so a line that merely
+// repeats (the same message every poll) can't pass for the cursor. Both
+// sides trim lines the same way, and blank lines don't count.
+class LogCursor {
+public:
+    static const int DEPTH = 4;
+
+    LogCursor();
+
+    bool valid() const { return _count > 0; }
+    void seen(const TextSpan& line); // Call for every line consumed, in order
+
+    // Start of the unseen part of `text`: just past the last place the
+    // remembered run ends (or, at the very top, the part of it still
+    // there). `text` itself, and `found` false, if it isn't there at all.
+    const char* resume(const char* text, size_t length, bool& found) const;
+
+private:
+    uint32_t _hashes[DEPTH]; // Oldest first
+    int _count;
+
+    static uint32_t hashLine(const TextSpan& trimmed);
+    static void push(uint32_t* hashes, int& count, uint32_t hash);
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef MAC_ADDRESS_H
+#define MAC_ADDRESS_H
+
+#include <Arduino.h>
+
+// Helpers for the 6-byte MAC addresses used as device keys
+
+inline bool parseMac(const char* text, uint8_t mac[6]) {
+    if (text == nullptr) return false;
+    for (int i = 0; i < 6; i++) {
+        char* end;
+        long value = strtol(text, &end, 16);
+        if (end == text || value < 0 || value > 0xFF) return false;
+        mac[i] = (uint8_t)value;
+        if (i < 5) {
+            if (*end != ':' && *end != '-') return false;
+            text = end + 1;
+        }
+    }
+    return true;
+}
+
+inline String formatMac(const uint8_t mac[6]) {
+    char buf[18];
+    snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return String(buf);
+}
+
+inline bool sameMac(const uint8_t a[6], const uint8_t b[6]) {
+    return memcmp(a, b, 6) == 0;
+}
+
+#endif
@@ -0,0 +1,235 @@
+#include "OpJournal.h"
+#include "BinarySnapshot.h"
+
+static const char JOURNAL_MAGIC[4] = {'N', 'G', 'O', 'J'};
+static const uint16_t JOURNAL_VERSION = 1;
+
+OpJournal::OpJournal(const char* path) {
+    _path = path;
+    _nextSeq = 1;
+    _lock = nullptr;
+}
+
+bool OpJournal::begin() {
+    if (_lock == nullptr) _lock = xSemaphoreCreateMutex();
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _entries.clear();
+
+    size_t size;
+    uint8_t* payload = readSnapshot(_path.c_str(), JOURNAL_MAGIC, JOURNAL_VERSION, size);
+    if (payload == nullptr) { // Nothing pending
+        xSemaphoreGive(_lock);
+        return true;
+    }
+
+    // nextSeq u32 | count u32 | [seq u32 | op u8 | len u8 | domain]...
+    uint32_t count = 0;
+    bool ok = size >= 8;
+    if (ok) {
+        memcpy(&_nextSeq, payload, 4);
+        memcpy(&count, payload + 4, 4);
+    }
+
+    size_t pos = 8;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        ok = pos + 6 <= size;
+        if (!ok) break;
+        Entry entry;
+        memcpy(&entry.seq, payload + pos, 4);
+        entry.op = (Op)payload[pos + 4];
+        uint8_t len = payload[pos + 5];
+        pos += 6;
+        ok = pos + len <= size;
+        if (!ok) break;
+        entry.domain.concat((const char*)payload + pos, len);
+        pos += len;
+        _entries.push_back(entry);
+    }
+    free(payload);
+
+    if (!ok) {
+        Serial.println("OpJournal: malformed journal " + _path);
+        _entries.clear();
+        xSemaphoreGive(_lock);
+        return false;
+    }
+
+    Serial.print("OpJournal: ");
+    Serial.print(_entries.size());
+    Serial.println(" pending router operations");
+    xSemaphoreGive(_lock);
+    return true;
+}
+
+uint32_t OpJournal::append(Op op, const String& domain) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    std::vector<Entry> previous = _entries;
+    uint32_t nextSeq = _nextSeq;
+    uint32_t seq = op == REPLACE ? addReplace() : addEdit(op, domain);
+    if (seq != 0 && _nextSeq != nextSeq && !save()) { // Folded into a pending op: nothing to save
+        seq = 0;
+    }
+    if (seq == 0) {
+        _entries = previous;
+    }
+    xSemaphoreGive(_lock);
+    return seq;
+}
+
+uint32_t OpJournal::appendAll(Op op, const std::vector<String>& domains) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    std::vector<Entry> previous = _entries;
+    uint32_t nextSeq = _nextSeq;
+    uint32_t seq = 0;
+    for (const String& domain : domains) {
+        seq = addEdit(op, domain);
+        if (seq == 0) break;
+    }
+    if (seq != 0 && _nextSeq != nextSeq && !save()) {
+        seq = 0;
+    }
+    if (seq == 0) {
+        _entries = previous;
+    }
+    xSemaphoreGive(_lock);
+    return seq;
+}
+
+uint32_t OpJournal::addEdit(Op op, const String& domain) {
+    if (domain.length() == 0 || domain.length() > MAX_DOMAIN_LEN) return 0;
+
+    int superseded = -1;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        const Entry& pending = _entries[i];
+        if (pending.domain != domain) continue;
+
+        if (isAllowlistOp(op) && pending.op == op) {
+            return pending.seq;
+        }
+        if (sameList(op, pending.op)) {
+            superseded = i;
+            break; // At most one pending op per domain and list
+        }
+    }
+
+    if (superseded < 0 && (int)_entries.size() >= CAPACITY) return 0;
+
+    if (superseded >= 0) {
+        _entries.erase(_entries.begin() + superseded);
+    }
+
+    Entry entry;
+    entry.seq = _nextSeq++;
+    entry.op = op;
+    entry.domain = domain;
+    _entries.push_back(entry);
+    return entry.seq;
+}
+
+uint32_t OpJournal::addReplace() {
+    for (size_t i = 0; i < _entries.size();) {
+        if (isBlocklistOp(_entries[i].op) || _entries[i].op == REPLACE) {
+            _entries.erase(_entries.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    if ((int)_entries.size() >= CAPACITY) return 0;
+
+    Entry entry;
+    entry.seq = _nextSeq++;
+    entry.op = REPLACE;
+    _entries.push_back(entry);
+    return entry.seq;
+}
+
+bool OpJournal::complete(uint32_t throughSeq) {
+    // Sequence numbers increase along the queue, so applied entries are a prefix.
+    // Entries appended (or superseded) during the replay are left alone.
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    size_t done = 0;
+    while (done < _entries.size() && _entries[done].seq <= throughSeq) {
+        done++;
+    }
+    bool ok = true;
+    if (done > 0) {
+        _entries.erase(_entries.begin(), _entries.begin() + done);
+        ok = save();
+    }
+    xSemaphoreGive(_lock);
+    return ok;
+}
+
+int OpJournal::nextBatch(std::vector<Entry>& batch, int max) const {
+    batch.clear();
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (!_entries.empty()) {
+        Op first = _entries[0].op;
+        if (first == REPLACE) {
+            batch.push_back(_entries[0]);
+        } else {
+            for (size_t i = 0; i < _entries.size() && (int)batch.size() < max; i++) {
+                if (!sameList(first, _entries[i].op)) break;
+                batch.push_back(_entries[i]);
+            }
+        }
+    }
+    xSemaphoreGive(_lock);
+    return batch.size();
+}
+
+int OpJournal::size() const {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int count = _entries.size();
+    xSemaphoreGive(_lock);
+    return count;
+}
+
+bool OpJournal::empty() const {
+    return size() == 0;
+}
+
+void OpJournal::toJson(JsonArray& target) const {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (const Entry& entry : _entries) {
+        JsonObject item = target.add<JsonObject>();
+        item["seq"] = entry.seq;
+        item["op"] = opName(entry.op);
+        item["domain"] = entry.domain;
+    }
+    xSemaphoreGive(_lock);
+}
+
+const char* OpJournal::opName(Op op) {
+    switch (op) {
+        case BLOCK: return "block";
+        case UNBLOCK: return "unblock";
+        case ALLOW: return "allow";
+        case UNALLOW: return "unallow";
+        case REPLACE: return "replace";
+        default: return "unknown";
+    }
+}
+
+bool OpJournal::save() {
+    std::vector<uint8_t> payload;
+    payload.reserve(8 + _entries.size() * 32);
+
+    uint32_t count = _entries.size();
+    payload.insert(payload.end(), (const uint8_t*)&_nextSeq, (const uint8_t*)&_nextSeq + 4);
+    payload.insert(payload.end(), (const uint8_t*)&count, (const uint8_t*)&count + 4);
+    for (const Entry& entry : _entries) {
+        uint8_t len = entry.domain.length();
+        payload.insert(payload.end(), (const uint8_t*)&entry.seq, (const uint8_t*)&entry.seq + 4);
+        payload.push_back(entry.op);
+        payload.push_back(len);
+        payload.insert(payload.end(), (const uint8_t*)entry.domain.c_str(), (const uint8_t*)entry.domain.c_str() + len);
+    }
+
+    SnapshotPart part = {payload.data(), payload.size()};
+    if (!writeSnapshot(_path.c_str(), JOURNAL_MAGIC, JOURNAL_VERSION, &part, 1)) {
+        Serial.println("OpJournal: failed to save " + _path);
+        return false;
+    }
+    return true;
+}
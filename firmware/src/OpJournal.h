@@ -0,0 +1,82 @@
+#ifndef OP_JOURNAL_H
+#define OP_JOURNAL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <vector>
+
+// Write-ahead journal of router edits that have not reached the router yet.
+// API handlers update local state, append here and answer right away; loop()
+// replays the journal in order whenever the router is reachable and drops
+// entries once the router has applied them. The queue is saved to LittleFS
+// on every change, so edits made during an outage survive a reboot; a run of
+// edits made together (an app toggle) goes in with appendAll() and one save.
+//
+// Each entry carries a sequence number, returned to the client as its
+// idempotency key. Router operations are "make it so" (present / absent),
+// so replaying an entry that landed just before a reboot is harmless.
+//
+// A new BLOCK/UNBLOCK for a domain supersedes any pending one for the same
+// domain, and likewise ALLOW/UNALLOW. Repeating a pending ALLOW/UNALLOW is
+// folded into it, so edits held for the settle window keep their seq; a
+// repeated BLOCK/UNBLOCK replaces the entry with a new seq. REPLACE (after a
+// bulk import) rewrites the router's whole list from local state, so it
+// supersedes every pending blocklist entry.
+//
+// Handlers append from async_tcp while the router task replays, so every
+// public method takes _lock.
+class OpJournal {
+public:
+    static const int CAPACITY = 128;
+    static const int MAX_DOMAIN_LEN = 253;
+
+    enum Op : uint8_t {
+        BLOCK = 1,
+        UNBLOCK = 2,
+        ALLOW = 3,
+        REPLACE = 4, // No domain
+        UNALLOW = 5
+    };
+
+    struct Entry {
+        uint32_t seq;
+        Op op;
+        String domain;
+    };
+
+    explicit OpJournal(const char* path);
+
+    bool begin(); // Restores pending entries
+    uint32_t append(Op op, const String& domain); // Sequence number, 0 if full or not persisted
+    uint32_t appendAll(Op op, const std::vector<String>& domains); // Last one's; all or none
+    bool complete(uint32_t throughSeq); // Drops entries the router has applied
+
+    // Copies the next batch to replay: one REPLACE, or a run of up to `max`
+    // BLOCK/UNBLOCK (or ALLOW/UNALLOW) entries that can go out as a single
+    // blocklist write (or allowlist commit)
+    int nextBatch(std::vector<Entry>& batch, int max) const;
+
+    int size() const;
+    bool empty() const;
+    void toJson(JsonArray& target) const;
+
+    static const char* opName(Op op);
+
+private:
+    String _path;
+    std::vector<Entry> _entries;
+    uint32_t _nextSeq;
+    SemaphoreHandle_t _lock;
+
+    static bool isBlocklistOp(Op op) { return op == BLOCK || op == UNBLOCK; }
+    static bool isAllowlistOp(Op op) { return op == ALLOW || op == UNALLOW; }
+    static bool sameList(Op a, Op b) {
+        return (isBlocklistOp(a) && isBlocklistOp(b)) || (isAllowlistOp(a) && isAllowlistOp(b));
+    }
+    // Callers hold _lock, and save() (or roll back) afterwards
+    uint32_t addEdit(Op op, const String& domain);
+    uint32_t addReplace();
+    bool save();
+};
+
+#endif
@@ -1,11 +1,175 @@
 #include "OpenWrtClient.h"
+#include "MacAddress.h"
+#include "TextTokenizer.h"
+#include <IPAddress.h>
+#include <algorithm>
+
+// How long each read-only ubus call may be answered from the cache, and which
+// cached objects each mutating call makes stale. Calls not listed here always
+// go to the router and leave the cache alone. Hit/miss counts are kept per
+// client, by index into this table.
+struct CachePolicy {
+    const char* object;
+    const char* method;
+    unsigned long ttlMs;       // 0 = never cached
+    const char* invalidates;   // Cached object to drop before the call, "*" = all
+};
+
+static const CachePolicy cachePolicies[] = {
+    {"luci-rpc", "getDHCPLeases",     5000,  nullptr},
+    {"luci-rpc", "getNetworkDevices", 5000,  nullptr},
+    {"file",     "read",              30000, nullptr},
+    {"uci",      "get",               30000, nullptr},
+    {"file",     "write",             0,     "file"},
+    {"rc",       "init",              0,     "rc"},
+    {"uci",      "set",               0,     "uci"},
+    {"uci",      "delete",            0,     "uci"},
+    {"uci",      "commit",            0,     "*"},
+    {"uci",      "apply",             0,     "*"},
+};
+
+// adblock's allowlist option in the "global" section
+#define ALLOWLIST_OPTION "whitelist_domains"
+
+// Every ubus call made here. Fixed calls are sent as one literal string
+// around the session id; the rest serialize only their params object.
+static const UbusMethod SESSION_LOGIN = UBUS_METHOD("session", "login");
+static const UbusMethod FILE_WRITE = UBUS_METHOD("file", "write");
+static const UbusMethod FILE_EXEC = UBUS_METHOD("file", "exec");
+static const UbusMethod UCI_SET = UBUS_METHOD("uci", "set");
+static const UbusMethod GET_LEASES = UBUS_FIXED_CALL("luci-rpc", "getDHCPLeases", "{}");
+static const UbusMethod GET_NETWORK_DEVICES = UBUS_FIXED_CALL("luci-rpc", "getNetworkDevices", "{}");
+static const UbusMethod NLBW_BY_MAC = UBUS_FIXED_CALL("file", "exec",
+    "{\"command\":\"/usr/sbin/nlbw\",\"params\":[\"-c\",\"json\",\"-g\",\"mac\"]}");
+static const UbusMethod READ_BLOCKLIST = UBUS_FIXED_CALL("file", "read",
+    "{\"path\":\"/etc/adblock/adblock.blocklist\"}");
+static const UbusMethod RELOAD_ADBLOCK = UBUS_FIXED_CALL("file", "exec",
+    "{\"command\":\"/etc/init.d/adblock\",\"params\":[\"reload\"]}");
+static const UbusMethod RESTART_DNSMASQ = UBUS_FIXED_CALL("rc", "init",
+    "{\"name\":\"dnsmasq\",\"action\":\"restart\"}");
+static const UbusMethod GET_DHCP_OPTIONS = UBUS_FIXED_CALL("uci", "get",
+    "{\"config\":\"dhcp\",\"section\":\"lan\",\"option\":\"dhcp_option\"}");
+static const UbusMethod COMMIT_DHCP = UBUS_FIXED_CALL("uci", "commit", "{\"config\":\"dhcp\"}");
+static const UbusMethod GET_ALLOWLIST = UBUS_FIXED_CALL("uci", "get",
+    "{\"config\":\"adblock\",\"section\":\"global\",\"option\":\"" ALLOWLIST_OPTION "\"}");
+static const UbusMethod DELETE_ALLOWLIST = UBUS_FIXED_CALL("uci", "delete",
+    "{\"config\":\"adblock\",\"section\":\"global\",\"option\":\"" ALLOWLIST_OPTION "\"}");
+static const UbusMethod COMMIT_ADBLOCK = UBUS_FIXED_CALL("uci", "commit", "{\"config\":\"adblock\"}");
+// No rollback: that needs a uci confirm within its timeout or the router reverts
+static const UbusMethod APPLY_UCI = UBUS_FIXED_CALL("uci", "apply", "{\"rollback\":false}");
+
+static const char* NO_SESSION = "00000000000000000000000000000000";
+
+static bool parseLeases(JsonVariantConst result, std::vector<DhcpLease>& leases) {
+    JsonArrayConst entries = result["dhcp_leases"];
+    if (entries.isNull()) return false;
+    for (JsonObjectConst entry : entries) {
+        DhcpLease lease;
+        if (!parseMac(entry["macaddr"].as<const char*>(), lease.mac)) continue;
+        
+        IPAddress ip;
+        ip.fromString(entry["ipaddr"] | "0.0.0.0");
+        lease.ip = (uint32_t)ip;
+        lease.hostname = entry["hostname"] | "";
+        leases.push_back(lease);
+    }
+    return true;
+}
+
+static bool parseLanCounters(JsonVariantConst result, InterfaceCounters& counters) {
+    // Newer luci-rpc nests the counters under "stats"
+    JsonVariantConst brLan = result["br-lan"];
+    JsonVariantConst stats = brLan["stats"].isNull() ? brLan : brLan["stats"];
+    if (stats["rx_bytes"].isNull()) return false;
+    counters.rx = stats["rx_bytes"];
+    counters.tx = stats["tx_bytes"];
+    return true;
+}
+
+static bool parseDeviceTraffic(JsonVariantConst result, std::vector<DeviceCounters>& devices) {
+    const char* output = result["stdout"];
+    if (output == nullptr) return false;
+    
+    // stdout: {"columns":["mac","conns","rx_bytes",...],"data":[["aa:bb:..",3,1024,...],...]}
+    JsonDocument table;
+    DeserializationError error = deserializeJson(table, output);
+    if (error) {
+        Serial.print("nlbw output parse failed: ");
+        Serial.println(error.c_str());
+        return false;
+    }
+    
+    int macCol = -1, rxCol = -1, txCol = -1;
+    int col = 0;
+    for (JsonVariant name : table["columns"].as<JsonArray>()) {
+        const char* column = name | "";
+        if (strcmp(column, "mac") == 0) macCol = col;
+        else if (strcmp(column, "rx_bytes") == 0) rxCol = col;
+        else if (strcmp(column, "tx_bytes") == 0) txCol = col;
+        col++;
+    }
+    if (macCol < 0 || rxCol < 0 || txCol < 0) return false;
+    
+    for (JsonVariant row : table["data"].as<JsonArray>()) {
+        DeviceCounters device;
+        if (!parseMac(row[macCol].as<const char*>(), device.mac)) continue;
+        device.rx = row[rxCol].as<unsigned long long>();
+        device.tx = row[txCol].as<unsigned long long>();
+        devices.push_back(device);
+    }
+    return true;
+}
+
+static bool parseBlocklistFile(JsonVariantConst result, BlocklistFile& file) {
+    file.data = result["data"] | ""; // Absent for an empty file
+    return true;
+}
+
+// The read calls, each cut down to the fields its parser reads
+static const UbusQuery<std::vector<DhcpLease>> LEASES_QUERY = {
+    GET_LEASES,
+    UBUS_RESULT_FILTER("{\"dhcp_leases\":[{\"macaddr\":true,\"ipaddr\":true,\"hostname\":true}]}"),
+    parseLeases
+};
+static const UbusQuery<InterfaceCounters> LAN_COUNTERS_QUERY = {
+    GET_NETWORK_DEVICES,
+    UBUS_RESULT_FILTER("{\"br-lan\":{\"stats\":{\"rx_bytes\":true,\"tx_bytes\":true},"
+                       "\"rx_bytes\":true,\"tx_bytes\":true}}"),
+    parseLanCounters
+};
+static const UbusQuery<std::vector<DeviceCounters>> DEVICE_TRAFFIC_QUERY = {
+    NLBW_BY_MAC,
+    UBUS_RESULT_FILTER("{\"stdout\":true}"),
+    parseDeviceTraffic
+};
+static const UbusQuery<BlocklistFile> BLOCKLIST_QUERY = {
+    READ_BLOCKLIST,
+    UBUS_RESULT_FILTER("{\"data\":true}"),
+    parseBlocklistFile
+};
+
+static_assert(sizeof(cachePolicies) / sizeof(cachePolicies[0]) <= OpenWrtClient::CACHE_POLICY_SLOTS,
+              "raise CACHE_POLICY_SLOTS");
+
+static const CachePolicy* findCachePolicy(const char* object, const char* method) {
+    for (const CachePolicy& policy : cachePolicies) {
+        if (strcmp(policy.object, object) == 0 && strcmp(policy.method, method) == 0) {
+            return &policy;
+        }
+    }
+    return nullptr;
+}
 
 OpenWrtClient::OpenWrtClient(const char* host, const char* username, const char* password) {
     _host = host;
     _username = username;
     _password = password;
-    _sid = "00000000000000000000000000000000";
+    _sid = NO_SESSION;
     _lastLoginTime = 0;
+    _lastLoginAttempt = 0;
+    _loginBackoffMs = 0;
+    memset(_cacheHits, 0, sizeof(_cacheHits));
+    memset(_cacheMisses, 0, sizeof(_cacheMisses));
 }
 
 bool OpenWrtClient::login() {
@@ -15,18 +179,14 @@ bool OpenWrtClient::login() {
     http.begin(url);
     http.addHeader("Content-Type", "application/json");
     
-    JsonDocument doc;
-    doc["jsonrpc"] = "2.0";
-    doc["id"] = 1;
-    doc["method"] = "call";
-    doc["params"][0] = "00000000000000000000000000000000";
-    doc["params"][1] = "session";
-    doc["params"][2] = "login";
-    doc["params"][3]["username"] = _username;
-    doc["params"][3]["password"] = _password;
+    JsonDocument params;
+    params["username"] = _username;
+    params["password"] = _password;
+    String paramsBody;
+    serializeJson(params, paramsBody);
     
     String requestBody;
-    serializeJson(doc, requestBody);
+    appendUbusCall(requestBody, 1, NO_SESSION, SESSION_LOGIN, paramsBody);
     
     int httpResponseCode = http.POST(requestBody);
     
@@ -53,13 +213,50 @@ bool OpenWrtClient::login() {
 }
 
 bool OpenWrtClient::checkSession() {
-    if (_sid == "00000000000000000000000000000000" || millis() - _lastLoginTime > 250000) { // Refresh if dummy SID or timeout
-        return login();
+    if (_sid == NO_SESSION || millis() - _lastLoginTime > 250000) { // Refresh if dummy SID or timeout
+        // Don't stall every caller on an unreachable router
+        if (_loginBackoffMs > 0 && millis() - _lastLoginAttempt < _loginBackoffMs) return false;
+        _lastLoginAttempt = millis();
+        if (login()) {
+            _loginBackoffMs = 0;
+            return true;
+        }
+        _loginBackoffMs = _loginBackoffMs == 0 ? LOGIN_BACKOFF_MIN_MS : _loginBackoffMs * 2;
+        if (_loginBackoffMs > LOGIN_BACKOFF_MAX_MS) _loginBackoffMs = LOGIN_BACKOFF_MAX_MS;
+        return false;
     }
     return true;
 }
 
-String OpenWrtClient::sendRequest(const char* object, const char* method, JsonDocument& params) {
+String OpenWrtClient::sendRequest(const UbusMethod& call, JsonDocument& params) {
+    String paramsBody;
+    serializeJson(params, paramsBody);
+    return sendCall(call, paramsBody);
+}
+
+String OpenWrtClient::sendRequest(const UbusMethod& call) {
+    return sendCall(call, String());
+}
+
+String OpenWrtClient::sendCall(const UbusMethod& call, const String& params) {
+    const CachePolicy* policy = findCachePolicy(call.object, call.method);
+    bool cacheable = policy != nullptr && policy->ttlMs > 0;
+    uint32_t cacheKey = 0;
+    if (cacheable) {
+        // A fixed call's tail already holds its params
+        cacheKey = ResponseCache::makeKey(call.object, call.method, call.fixedParams ? call.tail : params.c_str());
+        
+        String cached;
+        if (_cache.get(cacheKey, millis(), cached)) {
+            _cacheHits[policy - cachePolicies]++;
+            return cached;
+        }
+        _cacheMisses[policy - cachePolicies]++;
+    } else if (policy != nullptr && policy->invalidates != nullptr) {
+        // Drop first, so a failed write can't leave a stale read behind
+        _cache.invalidate(strcmp(policy->invalidates, "*") == 0 ? nullptr : policy->invalidates);
+    }
+    
     if (!checkSession()) return "";
 
     HTTPClient http;
@@ -68,24 +265,19 @@ String OpenWrtClient::sendRequest(const char* object, const char* method, JsonDo
     http.begin(url);
     http.addHeader("Content-Type", "application/json");
     
-    JsonDocument doc;
-    doc["jsonrpc"] = "2.0";
-    doc["id"] = 1;
-    doc["method"] = "call";
-    doc["params"][0] = _sid;
-    doc["params"][1] = object;
-    doc["params"][2] = method;
-    doc["params"][3] = params;
-    
     String requestBody;
-    serializeJson(doc, requestBody);
-    Serial.println("Request Body: " + requestBody); // DEBUG
+    requestBody.reserve(UBUS_ENVELOPE_BYTES + _sid.length() + call.tailLength + params.length());
+    appendUbusCall(requestBody, 1, _sid, call, params);
     
     int httpResponseCode = http.POST(requestBody);
     String result = "";
     
     if (httpResponseCode == 200) {
         result = http.getString();
+        // Only successful calls are cached; ubus errors still come back as 200
+        if (cacheable && ubusStatus(result) == 0) {
+            _cache.put(cacheKey, policy->object, result, policy->ttlMs, millis());
+        }
     } else {
         Serial.print("HTTP Error: ");
         Serial.println(httpResponseCode);
@@ -96,81 +288,140 @@ String OpenWrtClient::sendRequest(const char* object, const char* method, JsonDo
     return result;
 }
 
-int OpenWrtClient::getConnectedDeviceCount() {
-    JsonDocument params; 
-    params.to<JsonObject>(); 
-    String response = sendRequest("luci-rpc", "getDHCPLeases", params);
+int OpenWrtClient::fetchResult(const UbusMethod& call, const char* filter, JsonDocument& doc) {
+    String response = sendRequest(call);
+    if (response == "") return -1;
+    int status = ubusStatus(response);
+    if (status != 0) return status;
+    
+    JsonDocument filterDoc;
+    deserializeJson(filterDoc, filter);
+    DeserializationError error = deserializeJson(doc, response, DeserializationOption::Filter(filterDoc));
+    if (error) {
+        Serial.print(String(call.object) + " " + call.method + " response parse failed: ");
+        Serial.println(error.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+bool OpenWrtClient::sendBatch(const UbusBatch& calls) {
+    // Every call in a batch is a write; drop whatever each one makes stale
+    for (int i = 0; i < calls.size(); i++) {
+        const CachePolicy* policy = findCachePolicy(calls.call(i).object, calls.call(i).method);
+        if (policy != nullptr && policy->invalidates != nullptr) {
+            _cache.invalidate(strcmp(policy->invalidates, "*") == 0 ? nullptr : policy->invalidates);
+        }
+    }
     
-    if (response == "") return 0;
+    if (!checkSession()) return false;
+
+    HTTPClient http;
+    String url = String("http://") + _host + "/ubus";
     
-    JsonDocument doc;
-    deserializeJson(doc, response);
+    http.begin(url);
+    http.addHeader("Content-Type", "application/json");
+    
+    String requestBody = calls.body(_sid);
     
-    if (!doc["result"].isNull() && !doc["result"][1]["dhcp_leases"].isNull()) {
-        return doc["result"][1]["dhcp_leases"].size();
+    int httpResponseCode = http.POST(requestBody);
+    bool ok = false;
+    
+    if (httpResponseCode == 200) {
+        // One response per call, each with its own ubus status
+        JsonDocument responses;
+        DeserializationError error = deserializeJson(responses, http.getString());
+        ok = !error && responses.is<JsonArray>() && (int)responses.size() == calls.size();
+        for (JsonVariant response : responses.as<JsonArray>()) {
+            if ((response["result"][0] | -1) != 0) {
+                Serial.println("Batch call " + response["id"].as<String>() + " failed");
+                ok = false;
+            }
+        }
+    } else {
+        Serial.print("HTTP Error: ");
+        Serial.println(httpResponseCode);
+        Serial.println(http.getString());
     }
     
-    return 0;
+    http.end();
+    return ok;
 }
 
-bool OpenWrtClient::getConnectedDevices(JsonArray& targetArray) {
-    JsonDocument params; 
-    params.to<JsonObject>(); 
-    String response = sendRequest("luci-rpc", "getDHCPLeases", params);
+bool OpenWrtClient::syncDevices(DeviceTable& table, uint32_t now) {
+    std::vector<DhcpLease> leases;
+    if (!getLeases(leases)) return false;
+    
+    table.beginSnapshot();
+    for (const DhcpLease& lease : leases) {
+        table.observe(lease.mac, lease.ip, lease.hostname.c_str(), now);
+    }
+    table.endSnapshot(now);
     
-    Serial.println("DHCP Response: " + response); // DEBUG
+    return true;
+}
+
+bool OpenWrtClient::getLeases(std::vector<DhcpLease>& leases) {
+    leases.clear();
+    return query(LEASES_QUERY, leases) == 0;
+}
+
+bool OpenWrtClient::getTrafficStats(unsigned long long& rx, unsigned long long& tx) {
+    InterfaceCounters counters;
+    if (query(LAN_COUNTERS_QUERY, counters) != 0) return false;
+    rx = counters.rx;
+    tx = counters.tx;
+    return true;
+}
+
+bool OpenWrtClient::runCommand(const char* command, const String& argument) {
+    JsonDocument params;
+    params["command"] = command;
+    params["params"][0] = argument;
+    String response = sendRequest(FILE_EXEC, params);
     
     if (response == "") return false;
     
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, response);
-    
-    if (error) {
-        Serial.print("deserializeJson() failed: ");
-        Serial.println(error.c_str());
+    deserializeJson(doc, response);
+    if (doc["result"][0].as<int>() != 0 || doc["result"][1]["code"].as<int>() != 0) {
+        Serial.println("Command failed: " + String(command) + " " + doc["result"][1]["stderr"].as<String>());
         return false;
     }
-    
-    if (!doc["result"].isNull() && !doc["result"][1]["dhcp_leases"].isNull()) {
-         JsonArray leases = doc["result"][1]["dhcp_leases"];
-         for(JsonVariant v : leases) {
-             targetArray.add(v);
-         }
-         return true;
-    }
-    
-    return false;
+    return true;
 }
 
-bool OpenWrtClient::getTrafficStats(unsigned long long& rx, unsigned long long& tx) {
+bool OpenWrtClient::readLog(const char* pattern, int lines, String& output) {
     JsonDocument params;
-    params.to<JsonObject>(); 
-    String response = sendRequest("luci-rpc", "getNetworkDevices", params);
+    params["command"] = "/sbin/logread";
+    params["params"][0] = "-l";
+    params["params"][1] = String(lines);
+    params["params"][2] = "-e";
+    params["params"][3] = pattern;
+    String response = sendRequest(FILE_EXEC, params);
+    output = "";
     
-    Serial.println("Network Response: " + response); // DEBUG
+    if (response == "") return false;
     
-    if (response != "") {
-        JsonDocument doc;
-        deserializeJson(doc, response);
-        
-        if (!doc["result"].isNull() && !doc["result"][1].isNull()) {
-            JsonVariant devices = doc["result"][1];
-            if (devices["br-lan"].is<JsonObject>()) {
-                 JsonVariant brLan = devices["br-lan"];
-                 
-                 if (!brLan["stats"].isNull()) {
-                     rx = brLan["stats"]["rx_bytes"];
-                     tx = brLan["stats"]["tx_bytes"];
-                     return true;
-                 } else if (!brLan["rx_bytes"].isNull()) {
-                     rx = brLan["rx_bytes"];
-                     tx = brLan["tx_bytes"];
-                     return true;
-                 }
-            }
-        }
+    JsonDocument doc;
+    deserializeJson(doc, response);
+    if (doc["result"][0].as<int>() != 0) return false;
+    if (doc["result"][1]["stdout"].is<const char*>()) {
+        output = doc["result"][1]["stdout"].as<const char*>();
     }
-    return false;
+    return true;
+}
+
+int OpenWrtClient::getDeviceTraffic(DeviceCounters* target, int maxDevices) {
+    // nlbwmon keeps per-host byte counters; group them by MAC
+    std::vector<DeviceCounters> devices;
+    if (query(DEVICE_TRAFFIC_QUERY, devices) != 0) return -1;
+    
+    int count = devices.size() < (size_t)maxDevices ? devices.size() : maxDevices;
+    for (int i = 0; i < count; i++) {
+        target[i] = devices[i];
+    }
+    return count;
 }
 
 void OpenWrtClient::getDataUsage(String& total, String& download, String& upload) {
@@ -207,127 +458,100 @@ bool OpenWrtClient::blockDomain(const char* domain) {
     // According to the doc, we need to write to /etc/adblock/adblock.blocklist
     // and then trigger adblock reload
     
-    // 1. Read current blocklist
-    JsonDocument params;
-    params["path"] = "/etc/adblock/adblock.blocklist";
-    String response = sendRequest("file", "read", params);
+    // 1. Read current blocklist (a missing file is an empty list); writing
+    //    back without the current contents would wipe the router's list
+    BlocklistFile file;
+    int status = query(BLOCKLIST_QUERY, file);
+    if (status != 0 && status != UBUS_STATUS_NOT_FOUND) return false;
     
     // 2. Append the domain
-    params.clear();
+    JsonDocument params;
     params["path"] = "/etc/adblock/adblock.blocklist";
+    file.data += domain;
+    file.data += '\n';
+    params["data"] = file.data;
     
-    // Create the data to append (domain + newline)
-    String blocklistContent = "";
-    if (response != "") {
-        // Parse existing content if any
-        JsonDocument doc;
-        deserializeJson(doc, response);
-        if (!doc["result"].isNull() && !doc["result"][1]["data"].isNull()) {
-            blocklistContent = doc["result"][1]["data"].as<String>();
-        }
-    }
-    
-    // Append new domain
-    blocklistContent += String(domain) + "\n";
-    params["data"] = blocklistContent;
-    
-    response = sendRequest("file", "write", params);
+    String response = sendRequest(FILE_WRITE, params);
     if (response == "") return false;
 
     // 3. Trigger adblock reload using file exec
-    params.clear();
-    params["command"] = "/etc/init.d/adblock";
-    params["params"][0] = "reload";
-    
-    response = sendRequest("file", "exec", params);
+    response = sendRequest(RELOAD_ADBLOCK);
     
     return true;
 }
 
 bool OpenWrtClient::unblockDomain(const char* domain) {
     // 1. Read current blocklist
-    JsonDocument params;
-    params["path"] = "/etc/adblock/adblock.blocklist";
-    String response = sendRequest("file", "read", params);
-    
-    if (response == "") return false;
-    
-    // 2. Parse and remove the domain
-    JsonDocument doc;
-    deserializeJson(doc, response);
+    BlocklistFile file;
+    int status = query(BLOCKLIST_QUERY, file);
+    if (status == UBUS_STATUS_NOT_FOUND) return true; // No list, nothing to remove
+    if (status != 0) return false;
     
+    // 2. Rebuild without the target domain, reading lines in place
     String blocklistContent = "";
-    if (!doc["result"].isNull() && !doc["result"][1]["data"].isNull()) {
-        String currentContent = doc["result"][1]["data"].as<String>();
-        
-        // Split by newlines and rebuild without the target domain
-        int startPos = 0;
-        int newlinePos = 0;
-        while ((newlinePos = currentContent.indexOf('\n', startPos)) != -1) {
-            String line = currentContent.substring(startPos, newlinePos);
-            line.trim();
-            if (line != String(domain) && line.length() > 0) {
-                blocklistContent += line + "\n";
-            }
-            startPos = newlinePos + 1;
+    size_t domainLength = strlen(domain);
+    blocklistContent.reserve(file.data.length());
+    
+    LineReader lines(file.data.c_str(), file.data.length());
+    TextSpan line;
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (!line.empty() && !line.equals(domain, domainLength)) {
+            blocklistContent.concat(line.data, line.len);
+            blocklistContent += '\n';
         }
     }
     
     // 3. Write back the modified blocklist
-    params.clear();
+    JsonDocument params;
     params["path"] = "/etc/adblock/adblock.blocklist";
     params["data"] = blocklistContent;
     
-    response = sendRequest("file", "write", params);
+    String response = sendRequest(FILE_WRITE, params);
     if (response == "") return false;
 
     // 4. Trigger adblock reload
-    params.clear();
-    params["command"] = "/etc/init.d/adblock";
-    params["params"][0] = "reload";
-    
-    response = sendRequest("file", "exec", params);
+    response = sendRequest(RELOAD_ADBLOCK);
     
     return true;
 }
 
 bool OpenWrtClient::applyBlocklistChanges(JsonArray& changes) {
-    // 1. Read current blocklist
-    JsonDocument params;
-    params["path"] = "/etc/adblock/adblock.blocklist";
-    String response = sendRequest("file", "read", params);
+    // 1. Read current blocklist (a missing file is an empty list)
+    BlocklistFile file;
+    int status = query(BLOCKLIST_QUERY, file);
     
-    String blocklistContent = "";
-    if (response != "") {
-        JsonDocument doc;
-        deserializeJson(doc, response);
-        if (!doc["result"].isNull() && !doc["result"][1]["data"].isNull()) {
-            blocklistContent = doc["result"][1]["data"].as<String>();
-        }
+    // Writing back without the current contents would wipe the router's list
+    if (status != 0 && status != UBUS_STATUS_NOT_FOUND) {
+        Serial.println("ERROR: Failed to read blocklist");
+        return false;
     }
+    String& blocklistContent = file.data;
     
     // 2. Apply all changes
     for (JsonVariant change : changes) {
         String action = change["action"].as<String>();
-        String domain = change["domain"].as<String>();
+        const char* domain = change["domain"] | "";
         
         if (action == "add" || action == "enable") {
-            // Add domain if not already present
-            if (blocklistContent.indexOf(domain) == -1) {
-                blocklistContent += domain + "\n";
+            // Add domain if not already present (whole lines, so replays are no-ops)
+            if (!containsLine(blocklistContent.c_str(), blocklistContent.length(), domain)) {
+                blocklistContent += domain;
+                blocklistContent += '\n';
             }
         } else if (action == "remove" || action == "disable") {
             // Remove domain
             String newContent = "";
-            int startPos = 0;
-            int newlinePos = 0;
-            while ((newlinePos = blocklistContent.indexOf('\n', startPos)) != -1) {
-                String line = blocklistContent.substring(startPos, newlinePos);
-                line.trim();
-                if (line != domain && line.length() > 0) {
-                    newContent += line + "\n";
+            newContent.reserve(blocklistContent.length());
+            size_t domainLength = strlen(domain);
+            LineReader lines(blocklistContent.c_str(), blocklistContent.length());
+            TextSpan line;
+            while (lines.next(line)) {
+                line = line.trimmed();
+                if (!line.empty() && !line.equals(domain, domainLength)) {
+                    newContent.concat(line.data, line.len);
+                    newContent += '\n';
                 }
-                startPos = newlinePos + 1;
             }
             blocklistContent = newContent;
         }
@@ -335,12 +559,12 @@ bool OpenWrtClient::applyBlocklistChanges(JsonArray& changes) {
     
     
     // 3. Write updated blocklist back to /etc/adblock/adblock.blocklist
-    params.clear();
+    JsonDocument params;
     params["path"] = "/etc/adblock/adblock.blocklist";
     params["data"] = blocklistContent;
     
     Serial.println("Saving blocklist to /etc/adblock/adblock.blocklist");
-    response = sendRequest("file", "write", params);
+    String response = sendRequest(FILE_WRITE, params);
     if (response == "") {
         Serial.println("ERROR: Failed to save blocklist");
         return false;
@@ -349,17 +573,26 @@ bool OpenWrtClient::applyBlocklistChanges(JsonArray& changes) {
     
     // 4. Build dnsmasq configuration file content
     // Format: address=/domain/0.0.0.0 (IPv4) and address=/domain/:: (IPv6)
+    // Sized up front so the String is not regrown for every line
+    size_t configLength = 0;
+    LineReader sizing(blocklistContent.c_str(), blocklistContent.length());
+    TextSpan line;
+    while (sizing.next(line)) {
+        line = line.trimmed();
+        if (!line.empty()) configLength += 2 * line.len + 31;
+    }
     String dnsmasqConfig = "";
-    int startPos = 0;
-    int newlinePos = 0;
-    while ((newlinePos = blocklistContent.indexOf('\n', startPos)) != -1) {
-        String line = blocklistContent.substring(startPos, newlinePos);
-        line.trim();
-        if (line.length() > 0) {
-            dnsmasqConfig += "address=/" + line + "/0.0.0.0\n";
-            dnsmasqConfig += "address=/" + line + "/::\n";
+    dnsmasqConfig.reserve(configLength);
+    LineReader lines(blocklistContent.c_str(), blocklistContent.length());
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (!line.empty()) {
+            dnsmasqConfig += "address=/";
+            dnsmasqConfig.concat(line.data, line.len);
+            dnsmasqConfig += "/0.0.0.0\naddress=/";
+            dnsmasqConfig.concat(line.data, line.len);
+            dnsmasqConfig += "/::\n";
         }
-        startPos = newlinePos + 1;
     }
     
     // 5. Write to /etc/dnsmasq.d/custom_blocklist.conf
@@ -368,9 +601,10 @@ bool OpenWrtClient::applyBlocklistChanges(JsonArray& changes) {
     params["data"] = dnsmasqConfig;
     
     Serial.println("Writing to /etc/dnsmasq.d/custom_blocklist.conf");
-    Serial.println("Content: " + dnsmasqConfig);
+    Serial.print("Content: ");
+    Serial.println(dnsmasqConfig);
     
-    response = sendRequest("file", "write", params);
+    response = sendRequest(FILE_WRITE, params);
     if (response == "") {
         Serial.println("ERROR: Failed to write dnsmasq config");
         return false;
@@ -378,67 +612,184 @@ bool OpenWrtClient::applyBlocklistChanges(JsonArray& changes) {
     Serial.println("Write Response: " + response);
     
     // 6. Restart dnsmasq using rc.init
-    params.clear();
-    params["name"] = "dnsmasq";
-    params["action"] = "restart";
-    
     Serial.println("Restarting dnsmasq via rc.init...");
-    response = sendRequest("rc", "init", params);
+    response = sendRequest(RESTART_DNSMASQ);
     Serial.println("Dnsmasq Restart Response: " + response);
     
     return true;
 }
 
-String OpenWrtClient::getBlocklist() {
+bool OpenWrtClient::getBlocklist(String& content) {
     // Read the blocklist file from the router
+    BlocklistFile file;
+    content = "";
+    if (query(BLOCKLIST_QUERY, file) != 0) {
+        Serial.println("Failed to read blocklist from router");
+        return false;
+    }
+    content = file.data;
+    return true;
+}
+
+void OpenWrtClient::appendBlocklistLine(String& chunk, int file, const char* domain) {
+    if (file == 0) {
+        chunk += domain;
+        chunk += '\n';
+    } else {
+        chunk += "address=/";
+        chunk += domain;
+        chunk += "/0.0.0.0\naddress=/";
+        chunk += domain;
+        chunk += "/::\n";
+    }
+}
+
+bool OpenWrtClient::writeBlocklistChunk(int file, const String& chunk, bool append) {
     JsonDocument params;
-    params["path"] = "/etc/adblock/adblock.blocklist";
+    params["path"] = file == 0 ? "/etc/adblock/adblock.blocklist" : "/etc/dnsmasq.d/custom_blocklist.conf";
+    params["data"] = chunk;
+    if (append) params["append"] = true;
     
-    String response = sendRequest("file", "read", params);
+    String response = sendRequest(FILE_WRITE, params);
+    if (response == "") {
+        Serial.println("ERROR: Failed to write blocklist chunk");
+        return false;
+    }
+    return true;
+}
+
+bool OpenWrtClient::restartDnsmasq() {
+    return sendRequest(RESTART_DNSMASQ) != "";
+}
+
+bool OpenWrtClient::advertiseDnsServer(const String& ip) {
+    // Keep the LAN's other DHCP options, drop any DNS server (option 6) we set before
+    String response = sendRequest(GET_DHCP_OPTIONS);
+    if (response == "") {
+        Serial.println("ERROR: Failed to read DHCP options");
+        return false;
+    }
     
-    // Parse the response to extract the file content
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, response);
-    
-    if (error) {
-        Serial.println("Failed to parse blocklist response");
-        return "";
+    deserializeJson(doc, response);
+    int status = doc["result"][0] | -1;
+    if (status != 0 && status != UBUS_STATUS_NOT_FOUND) { // Not found: no options yet
+        // Writing from a failed read would drop the LAN's other options
+        Serial.println("ERROR: Failed to read DHCP options, status " + String(status));
+        return false;
     }
     
-    // Extract the data field from the response
-    if (doc["result"][1]["data"].is<const char*>()) {
-        return String(doc["result"][1]["data"].as<const char*>());
+    JsonDocument setParams;
+    setParams["config"] = "dhcp";
+    setParams["section"] = "lan";
+    JsonArray options = setParams["values"]["dhcp_option"].to<JsonArray>();
+    for (JsonVariant option : doc["result"][1]["value"].as<JsonArray>()) {
+        String value = option.as<String>();
+        if (!value.startsWith("6,")) options.add(value);
     }
+    options.add("6," + ip);
+    
+    if (sendRequest(UCI_SET, setParams) == "") return false;
     
-    return "";
+    sendRequest(COMMIT_DHCP);
+    
+    Serial.println("Advertising DNS server " + ip + " via DHCP");
+    return restartDnsmasq();
 }
 
-
 bool OpenWrtClient::allowDomain(const char* domain) {
-    // Similar to block, but maybe different list?
-    // Doc says "allowlist and blacklist". Usually adblock has a whitelist option.
-    // Assuming 'whitelist_domains' option exists in adblock config.
+    JsonDocument doc;
+    JsonArray changes = doc.to<JsonArray>();
+    JsonObject change = changes.add<JsonObject>();
+    change["action"] = "add";
+    change["domain"] = domain;
+    return applyAllowlistChanges(changes);
+}
+
+bool OpenWrtClient::unallowDomain(const char* domain) {
+    JsonDocument doc;
+    JsonArray changes = doc.to<JsonArray>();
+    JsonObject change = changes.add<JsonObject>();
+    change["action"] = "remove";
+    change["domain"] = domain;
+    return applyAllowlistChanges(changes);
+}
+
+bool OpenWrtClient::applyAllowlistChanges(JsonArray& changes) {
+    // 1. Read the current list. rpcd's uci object has no add_list/del_list,
+    //    so the whole list is edited here and written back with one set.
+    String response = sendRequest(GET_ALLOWLIST);
+    if (response == "") {
+        Serial.println("ERROR: Failed to read allowlist");
+        return false;
+    }
     
-    JsonDocument params;
-    params["config"] = "adblock";
-    params["section"] = "global";
-    params["option"] = "whitelist_domains"; // Standard adblock option
-    params["values"][0] = domain;
+    JsonDocument readDoc;
+    deserializeJson(readDoc, response);
+    int status = readDoc["result"][0] | -1;
+    if (status != 0 && status != UBUS_STATUS_NOT_FOUND) { // Not found: no list yet
+        Serial.println("ERROR: Failed to read allowlist, status " + String(status));
+        return false;
+    }
     
-    String response = sendRequest("uci", "add_list", params);
-    if (response == "") return false;
-
-    params.clear();
-    params["config"] = "adblock";
-    sendRequest("uci", "commit", params);
+    std::vector<String> allowed;
+    JsonVariant current = readDoc["result"][1]["value"];
+    if (current.is<JsonArray>()) {
+        for (JsonVariant value : current.as<JsonArray>()) {
+            allowed.push_back(value.as<String>());
+        }
+    } else if (current.is<const char*>()) {
+        allowed.push_back(current.as<String>()); // Single value written as an option
+    }
+    
+    // 2. Apply all changes
+    for (JsonVariant change : changes) {
+        String action = change["action"].as<String>();
+        String domain = change["domain"].as<String>();
+        std::vector<String>::iterator found = std::find(allowed.begin(), allowed.end(), domain);
+        if (action == "add" && found == allowed.end()) {
+            allowed.push_back(domain);
+        } else if (action == "remove" && found != allowed.end()) {
+            allowed.erase(found);
+        }
+    }
+    
+    // 3. Write, commit and apply in one round trip
+    return writeAllowlist(allowed);
+}
 
-    params.clear();
-    params["rollback"] = true;
-    sendRequest("uci", "apply", params);
+bool OpenWrtClient::writeAllowlist(const std::vector<String>& allowed) {
+    UbusBatch calls;
+    if (allowed.empty()) {
+        calls.add(DELETE_ALLOWLIST);
+    } else {
+        JsonDocument setParams;
+        setParams["config"] = "adblock";
+        setParams["section"] = "global";
+        JsonArray values = setParams["values"][ALLOWLIST_OPTION].to<JsonArray>();
+        for (const String& domain : allowed) {
+            values.add(domain);
+        }
+        calls.add(UCI_SET, setParams);
+    }
+    calls.add(COMMIT_ADBLOCK);
+    calls.add(APPLY_UCI);
     
-    return true;
+    Serial.println("Writing allowlist: " + String(allowed.size()) + " domains");
+    return sendBatch(calls);
 }
 
-// Implement unblock/unallow similarly using 'del_list' if needed, 
-// but for now the UI only requested 'block' and 'allow'. 
-// The doc mentions "active security management via domain allowlisting and blacklisting".
+void OpenWrtClient::cacheStatsToJson(JsonObject& target) const {
+    target["entries"] = _cache.entries();
+    target["bytes"] = _cache.bytes();
+    target["evictions"] = _cache.evictions();
+    
+    JsonObject methods = target["methods"].to<JsonObject>();
+    for (size_t i = 0; i < sizeof(cachePolicies) / sizeof(cachePolicies[0]); i++) {
+        const CachePolicy& policy = cachePolicies[i];
+        if (policy.ttlMs == 0) continue;
+        JsonObject stats = methods[String(policy.object) + "." + policy.method].to<JsonObject>();
+        stats["hits"] = _cacheHits[i];
+        stats["misses"] = _cacheMisses[i];
+    }
+}
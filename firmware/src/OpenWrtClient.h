@@ -4,28 +4,102 @@
 #include <Arduino.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
+#include "TrafficSeries.h"
+#include "DeviceTable.h"
+#include "ResponseCache.h"
+#include "UbusCall.h"
+#include <vector>
+
+// What the read calls come back as, each filled from a filtered response
+// (see UbusQuery)
+struct DhcpLease {
+    uint8_t mac[6];
+    uint32_t ip;
+    String hostname;
+};
+
+struct InterfaceCounters { // br-lan, from luci-rpc getNetworkDevices
+    unsigned long long rx;
+    unsigned long long tx;
+};
+
+struct BlocklistFile { // /etc/adblock/adblock.blocklist
+    String data;       // Empty for an empty file
+};
 
 class OpenWrtClient {
 public:
+    static const unsigned long LOGIN_BACKOFF_MIN_MS = 2000;
+    static const unsigned long LOGIN_BACKOFF_MAX_MS = 60000;
+    static const int PUSH_CHUNK_BYTES = 4096; // Per file write in replaceBlocklist()
+    static const int CACHE_POLICY_SLOTS = 16; // Entries in the cache policy table
+
     OpenWrtClient(const char* host, const char* username, const char* password);
     
     bool login();
-    bool checkSession();
+    bool checkSession(); // Logs in if needed; failed logins back off up to LOGIN_BACKOFF_MAX_MS
+    bool hasSession() const { return _lastLoginTime != 0; }
     
     // Telemetry
-    int getConnectedDeviceCount();
-    bool getConnectedDevices(JsonArray& targetArray); // Populates provided array
+    bool syncDevices(DeviceTable& table, uint32_t now); // Diffs current DHCP leases into the table
+    bool getLeases(std::vector<DhcpLease>& leases);      // Current DHCP leases, false on error
     bool getTrafficStats(unsigned long long& rx, unsigned long long& tx); // Raw bytes
+    int getDeviceTraffic(DeviceCounters* target, int maxDevices); // Per-MAC counters from nlbwmon, -1 on error
     void getDataUsage(String& total, String& download, String& upload); // Returns formatted strings
     String formatBytes(unsigned long long bytes); // Helper
+    bool readLog(const char* pattern, int lines, String& output); // Last `lines` syslog lines matching a regex
     
     // Control
     bool blockDomain(const char* domain);
     bool unblockDomain(const char* domain);
     bool applyBlocklistChanges(JsonArray& changes); // Batch apply
-    String getBlocklist(); // Get current blocklist from router
+    bool getBlocklist(String& content); // Current blocklist file from the router, false if unreadable
+    
+    // Rewrites the router's blocklist from scratch, for lists too big to hold
+    // as one string. forEach(emit) must call emit(const char* domain) for
+    // every domain; it runs once per router file, and each file goes out in
+    // PUSH_CHUNK_BYTES appends.
+    template <typename Source>
+    bool replaceBlocklist(Source forEach) {
+        for (int file = 0; file < BLOCKLIST_FILES; file++) {
+            String chunk;
+            chunk.reserve(PUSH_CHUNK_BYTES + 2 * DOMAIN_LINE_MAX);
+            bool append = false;
+            bool ok = true;
+            forEach([&](const char* domain) {
+                if (!ok) return;
+                appendBlocklistLine(chunk, file, domain);
+                if (chunk.length() >= (size_t)PUSH_CHUNK_BYTES) {
+                    ok = writeBlocklistChunk(file, chunk, append);
+                    append = true;
+                    chunk = "";
+                }
+            });
+            if (!ok || !writeBlocklistChunk(file, chunk, append)) return false;
+        }
+        return restartDnsmasq();
+    }
+    
+    // Allowlist (adblock's whitelist_domains). Changes are [{"action": "add" |
+    // "remove", "domain"}], written with a single uci commit and apply.
     bool allowDomain(const char* domain);
     bool unallowDomain(const char* domain);
+    bool applyAllowlistChanges(JsonArray& changes);
+    
+    // Rewrites the allowlist from scratch; forEach(emit) as for replaceBlocklist()
+    template <typename Source>
+    bool replaceAllowlist(Source forEach) {
+        std::vector<String> allowed;
+        forEach([&](const char* domain) { allowed.push_back(domain); });
+        return writeAllowlist(allowed);
+    }
+    
+    bool runCommand(const char* command, const String& argument); // file exec, true on exit code 0
+    bool advertiseDnsServer(const String& ip); // LAN DHCP option 6 -> ip, replacing any earlier one
+    
+    // Response cache
+    void cacheStatsToJson(JsonObject& target) const; // Hit/miss counters per cached method
+    void invalidateCache() { _cache.invalidate(nullptr); }
 
 private:
     const char* _host;
@@ -33,8 +107,35 @@ private:
     const char* _password;
     String _sid;
     unsigned long _lastLoginTime;
+    unsigned long _lastLoginAttempt;
+    unsigned long _loginBackoffMs;
+    ResponseCache _cache;
+    uint32_t _cacheHits[CACHE_POLICY_SLOTS]; // Per cache policy, this router only
+    uint32_t _cacheMisses[CACHE_POLICY_SLOTS];
+    
+    static const int BLOCKLIST_FILES = 2; // adblock list, dnsmasq config
+    static const int DOMAIN_LINE_MAX = 280;
+    static const int UBUS_STATUS_NOT_FOUND = 4;
+    
+    // Sends a query's call and reads result[1] into `result`. The ubus
+    // status, 0 if `result` was filled, -1 if the call or parse failed.
+    template <typename Result>
+    int query(const UbusQuery<Result>& query, Result& result) {
+        JsonDocument doc;
+        int status = fetchResult(query.call, query.filter, doc);
+        if (status != 0) return status;
+        return query.parse(doc["result"][1], result) ? 0 : -1;
+    }
+    int fetchResult(const UbusMethod& call, const char* filter, JsonDocument& doc);
     
-    String sendRequest(const char* object, const char* method, JsonDocument& params);
+    String sendRequest(const UbusMethod& call, JsonDocument& params);
+    String sendRequest(const UbusMethod& call); // Fixed params
+    String sendCall(const UbusMethod& call, const String& params);
+    bool sendBatch(const UbusBatch& calls); // One POST; true if all succeeded
+    static void appendBlocklistLine(String& chunk, int file, const char* domain);
+    bool writeBlocklistChunk(int file, const String& chunk, bool append);
+    bool restartDnsmasq();
+    bool writeAllowlist(const std::vector<String>& allowed); // set (or delete) + commit + apply
 };
 
 #endif
@@ -0,0 +1,97 @@
+#include "ResponseCache.h"
+
+ResponseCache::ResponseCache() {
+    for (int i = 0; i < SLOTS; i++) {
+        _slots[i].used = false;
+    }
+    _bytes = 0;
+    _evictions = 0;
+}
+
+uint32_t ResponseCache::makeKey(const char* object, const char* method, const char* params) {
+    // FNV-1a over object \0 method \0 params
+    uint32_t hash = 2166136261u;
+    const char* parts[] = {object, method, params};
+    for (int p = 0; p < 3; p++) {
+        for (const char* c = parts[p]; *c; c++) {
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        }
+        hash *= 16777619u; // The \0 separator
+    }
+    return hash;
+}
+
+bool ResponseCache::get(uint32_t key, unsigned long nowMs, String& response) {
+    for (int i = 0; i < SLOTS; i++) {
+        Slot& slot = _slots[i];
+        if (!slot.used || slot.key != key) continue;
+        if (expired(slot, nowMs)) {
+            release(slot);
+            return false;
+        }
+        slot.lastUsed = nowMs;
+        response = slot.response;
+        return true;
+    }
+    return false;
+}
+
+void ResponseCache::put(uint32_t key, const char* object, const String& response, unsigned long ttlMs, unsigned long nowMs) {
+    if (response.length() > MAX_BYTES / 2) return; // Would push out everything else
+
+    for (int i = 0; i < SLOTS; i++) {
+        if (_slots[i].used && _slots[i].key == key) release(_slots[i]);
+    }
+    // Make room by bytes first, then make sure there is a free slot
+    while (_bytes + response.length() > MAX_BYTES || entries() == SLOTS) {
+        release(_slots[victim(nowMs)]);
+        _evictions++;
+    }
+
+    int index = 0;
+    while (_slots[index].used) index++;
+    Slot& slot = _slots[index];
+
+    slot.key = key;
+    slot.object = object;
+    slot.response = response;
+    slot.storedAt = nowMs;
+    slot.ttlMs = ttlMs;
+    slot.lastUsed = nowMs;
+    slot.used = true;
+    _bytes += response.length();
+}
+
+void ResponseCache::invalidate(const char* object) {
+    for (int i = 0; i < SLOTS; i++) {
+        Slot& slot = _slots[i];
+        if (slot.used && (object == nullptr || strcmp(slot.object, object) == 0)) {
+            release(slot);
+        }
+    }
+}
+
+int ResponseCache::entries() const {
+    int count = 0;
+    for (int i = 0; i < SLOTS; i++) {
+        if (_slots[i].used) count++;
+    }
+    return count;
+}
+
+void ResponseCache::release(Slot& slot) {
+    _bytes -= slot.response.length();
+    slot.response = String(); // Give the heap back now, not on reuse
+    slot.used = false;
+}
+
+int ResponseCache::victim(unsigned long nowMs) const {
+    int oldest = -1;
+    for (int i = 0; i < SLOTS; i++) {
+        const Slot& slot = _slots[i];
+        if (!slot.used) continue;
+        if (expired(slot, nowMs)) return i;
+        if (oldest < 0 || nowMs - slot.lastUsed > nowMs - _slots[oldest].lastUsed) oldest = i;
+    }
+    return oldest;
+}
@@ -0,0 +1,47 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <Arduino.h>
+
+// Small LRU cache of raw ubus responses with per-entry expiry.
+// Entries are keyed by a hash of (object, method, params) and tagged with
+// their ubus object, so a mutating call can drop everything it may have
+// made stale. Memory is bounded by SLOTS and MAX_BYTES of response text.
+class ResponseCache {
+public:
+    static const int SLOTS = 8;
+    static const size_t MAX_BYTES = 16384;
+
+    ResponseCache();
+
+    static uint32_t makeKey(const char* object, const char* method, const char* params);
+
+    bool get(uint32_t key, unsigned long nowMs, String& response);
+    void put(uint32_t key, const char* object, const String& response, unsigned long ttlMs, unsigned long nowMs);
+    void invalidate(const char* object); // nullptr drops everything
+
+    int entries() const;
+    size_t bytes() const { return _bytes; }
+    uint32_t evictions() const { return _evictions; }
+
+private:
+    struct Slot {
+        uint32_t key;
+        const char* object; // Static string from the caller's policy table
+        String response;
+        unsigned long storedAt;
+        unsigned long ttlMs;
+        unsigned long lastUsed;
+        bool used;
+    };
+
+    Slot _slots[SLOTS];
+    size_t _bytes;
+    uint32_t _evictions;
+
+    bool expired(const Slot& slot, unsigned long nowMs) const { return nowMs - slot.storedAt >= slot.ttlMs; }
+    void release(Slot& slot);
+    int victim(unsigned long nowMs) const; // An expired entry, else the least recently used; -1 if empty
+};
+
+#endif
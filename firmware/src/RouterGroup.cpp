@@ -0,0 +1,276 @@
+#include "RouterGroup.h"
+#include "TextTokenizer.h"
+
+RouterGroup::RouterGroup(const char* host, const char* username, const char* password) {
+    _count = 0;
+    _username = username;
+    _password = password;
+    _job = nullptr;
+    _done = nullptr;
+    addNode(host);
+}
+
+bool RouterGroup::addNode(const char* host) {
+    if (_count >= MAX_NODES || _done != nullptr) return false;
+    Node& node = _nodes[_count];
+    node.host = host;
+    node.client = new OpenWrtClient(host, _username, _password);
+    node.task = nullptr;
+    snprintf(node.taskName, sizeof(node.taskName), "router%d", _count);
+    node.group = this;
+    node.index = _count;
+    node.result = false;
+    node.latencyMs = 0;
+    node.calls = 0;
+    node.failures = 0;
+    node.lastOk = 0;
+    node.stale = false;
+    node.consistent = -1;
+    _count++;
+    return true;
+}
+
+void RouterGroup::begin(BaseType_t core) {
+    _done = xSemaphoreCreateCounting(MAX_NODES, 0);
+    // The primary runs on the caller's task; only the others need one
+    for (int i = 1; i < _count; i++) {
+        Node& node = _nodes[i];
+        xTaskCreatePinnedToCore(nodeTaskMain, node.taskName, NODE_TASK_STACK, &node, 2, &node.task, core);
+    }
+    Serial.println("Router group: " + String(_count) + " node(s)");
+}
+
+void RouterGroup::nodeTaskMain(void* arg) {
+    Node& node = *(Node*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        node.result = node.group->run(node.index, *node.group->_job);
+        xSemaphoreGive(node.group->_done);
+    }
+}
+
+bool RouterGroup::run(int index, const Job& job) {
+    Node& node = _nodes[index];
+    unsigned long started = millis();
+    bool ok = job(*node.client, index);
+    node.latencyMs = millis() - started;
+    node.calls++;
+    if (ok) {
+        node.lastOk = millis();
+    } else {
+        node.failures++;
+    }
+    return ok;
+}
+
+uint32_t RouterGroup::fanOut(const Job& job, uint32_t mask) {
+    // Hand the job to the other nodes first, then do the primary's share here.
+    // The wait is bounded by the clients' HTTP timeouts.
+    _job = &job;
+    int waiting = 0;
+    for (int i = 1; i < _count; i++) {
+        if ((mask & (1u << i)) && _nodes[i].task != nullptr) {
+            xTaskNotifyGive(_nodes[i].task);
+            waiting++;
+        }
+    }
+
+    uint32_t succeeded = 0;
+    if ((mask & 1u) && run(0, job)) succeeded |= 1u;
+
+    for (; waiting > 0; waiting--) {
+        xSemaphoreTake(_done, portMAX_DELAY);
+    }
+    for (int i = 1; i < _count; i++) {
+        if ((mask & (1u << i)) && _nodes[i].task != nullptr && _nodes[i].result) succeeded |= 1u << i;
+    }
+    _job = nullptr;
+    return succeeded;
+}
+
+uint32_t RouterGroup::liveMask() const {
+    uint32_t mask = 0;
+    for (int i = 0; i < _count; i++) {
+        if (!_nodes[i].stale) mask |= 1u << i;
+    }
+    return mask;
+}
+
+int RouterGroup::staleCount() const {
+    int count = 0;
+    for (int i = 0; i < _count; i++) {
+        if (_nodes[i].stale) count++;
+    }
+    return count;
+}
+
+void RouterGroup::markSynced(uint32_t mask) {
+    for (int i = 0; i < _count; i++) {
+        if (mask & (1u << i)) {
+            _nodes[i].stale = false;
+            Serial.println(String("Router resynced: ") + _nodes[i].host);
+        }
+    }
+}
+
+// List writes (`tracked`) go to the nodes that are in step. If some take it
+// and some don't, the ones that didn't are stale until resynced; if none
+// take it, nothing diverged and the caller retries as with one router.
+bool RouterGroup::write(const Job& job, bool tracked) {
+    uint32_t mask = tracked ? liveMask() : allMask();
+    uint32_t succeeded = fanOut(job, mask);
+    if (succeeded == 0) return false;
+
+    if (tracked) {
+        for (int i = 0; i < _count; i++) {
+            if ((mask & ~succeeded) & (1u << i)) {
+                _nodes[i].stale = true;
+                Serial.println(String("Router missed a write, resync pending: ") + _nodes[i].host);
+            }
+        }
+    }
+    return true;
+}
+
+bool RouterGroup::checkSession() {
+    uint32_t succeeded = fanOut([](OpenWrtClient& client, int) { return client.checkSession(); }, allMask());
+    return (succeeded & 1u) != 0;
+}
+
+bool RouterGroup::syncDevices(DeviceTable& table, uint32_t now) {
+    std::vector<DhcpLease> leases[MAX_NODES];
+    uint32_t succeeded = fanOut([&](OpenWrtClient& client, int node) {
+        return client.getLeases(leases[node]);
+    }, allMask());
+    if (succeeded == 0) return false;
+
+    // A device may hold a lease on more than one node; observing it twice is harmless
+    table.beginSnapshot();
+    for (int i = 0; i < _count; i++) {
+        if (!(succeeded & (1u << i))) continue;
+        for (const DhcpLease& lease : leases[i]) {
+            table.observe(lease.mac, lease.ip, lease.hostname.c_str(), now);
+        }
+    }
+    table.endSnapshot(now);
+    return true;
+}
+
+int RouterGroup::getDeviceTraffic(DeviceCounters* target, int maxDevices) {
+    std::vector<DeviceCounters> counters[MAX_NODES];
+    int counts[MAX_NODES] = {0};
+    uint32_t succeeded = fanOut([&](OpenWrtClient& client, int node) {
+        counters[node].resize(maxDevices);
+        counts[node] = client.getDeviceTraffic(counters[node].data(), maxDevices);
+        return counts[node] >= 0;
+    }, allMask());
+    if (!(succeeded & 1u)) return -1; // Without the gateway's, counters would appear to go backwards
+
+    // Traffic through an access point also crosses the gateway, so summing
+    // would count it twice; the node with the highest count saw the most
+    int count = 0;
+    for (int i = 0; i < _count; i++) {
+        if (!(succeeded & (1u << i))) continue;
+        for (int j = 0; j < counts[i]; j++) {
+            const DeviceCounters& sample = counters[i][j];
+            int k = 0;
+            while (k < count && memcmp(target[k].mac, sample.mac, 6) != 0) k++;
+            if (k == count) {
+                if (count >= maxDevices) continue;
+                target[count++] = sample;
+                continue;
+            }
+            if (sample.rx > target[k].rx) target[k].rx = sample.rx;
+            if (sample.tx > target[k].tx) target[k].tx = sample.tx;
+        }
+    }
+    return count;
+}
+
+bool RouterGroup::getTrafficStats(unsigned long long& rx, unsigned long long& tx) {
+    return run(0, [&](OpenWrtClient& client, int) { return client.getTrafficStats(rx, tx); });
+}
+
+bool RouterGroup::readLog(const char* pattern, int lines, String& output) {
+    return run(0, [&](OpenWrtClient& client, int) { return client.readLog(pattern, lines, output); });
+}
+
+bool RouterGroup::getBlocklist(String& content) {
+    return run(0, [&](OpenWrtClient& client, int) { return client.getBlocklist(content); });
+}
+
+bool RouterGroup::runCommand(const char* command, const String& argument) {
+    return run(0, [&](OpenWrtClient& client, int) { return client.runCommand(command, argument); });
+}
+
+bool RouterGroup::applyBlocklistChanges(JsonArray& changes) {
+    // Each node reads `changes` at once; reading a JsonArray doesn't touch it
+    return write([&](OpenWrtClient& client, int) { return client.applyBlocklistChanges(changes); }, true);
+}
+
+bool RouterGroup::applyAllowlistChanges(JsonArray& changes) {
+    return write([&](OpenWrtClient& client, int) { return client.applyAllowlistChanges(changes); }, true);
+}
+
+bool RouterGroup::replaceBlocklist(const DomainList& blocklist) {
+    return write([&](OpenWrtClient& client, int) { return client.replaceBlocklist(blocklist); }, true);
+}
+
+void RouterGroup::resyncStale(const DomainList& blocklist, const DomainList& allowlist) {
+    uint32_t mask = staleMask();
+    if (mask == 0) return;
+    uint32_t synced = fanOut([&](OpenWrtClient& client, int) {
+        return client.replaceBlocklist(blocklist) && client.replaceAllowlist(allowlist);
+    }, mask);
+    markSynced(synced);
+}
+
+bool RouterGroup::advertiseDnsServer(const String& ip) {
+    return write([&](OpenWrtClient& client, int) { return client.advertiseDnsServer(ip); }, false);
+}
+
+void RouterGroup::checkConsistency(const BlocklistDigest& expected) {
+    BlocklistDigest digests[MAX_NODES];
+    uint32_t mask = liveMask();
+    uint32_t succeeded = fanOut([&](OpenWrtClient& client, int node) {
+        String content;
+        if (!client.getBlocklist(content)) return false;
+        LineReader lines(content.c_str(), content.length());
+        TextSpan line;
+        while (lines.next(line)) {
+            line = line.trimmed();
+            if (!line.empty()) digests[node].add(line.data, line.len);
+        }
+        return true;
+    }, mask);
+
+    for (int i = 0; i < _count; i++) {
+        if (!(succeeded & (1u << i))) continue;
+        bool consistent = digests[i] == expected;
+        _nodes[i].consistent = consistent ? 1 : 0;
+        if (!consistent) {
+            _nodes[i].stale = true;
+            Serial.println(String("Router blocklist differs (") + digests[i].count + " vs " + expected.count +
+                           " domains), resync pending: " + _nodes[i].host);
+        }
+    }
+}
+
+void RouterGroup::toJson(JsonArray& target) const {
+    unsigned long now = millis();
+    for (int i = 0; i < _count; i++) {
+        const Node& node = _nodes[i];
+        JsonObject item = target.add<JsonObject>();
+        item["host"] = node.host;
+        item["primary"] = i == 0;
+        item["session"] = node.client->hasSession();
+        item["latencyMs"] = (uint32_t)node.latencyMs;
+        item["calls"] = (uint32_t)node.calls;
+        item["failures"] = (uint32_t)node.failures;
+        unsigned long lastOk = node.lastOk;
+        if (lastOk != 0) item["lastOkAgoMs"] = now - lastOk;
+        item["stale"] = (bool)node.stale;
+        int8_t consistent = node.consistent;
+        if (consistent >= 0) item["consistent"] = consistent == 1;
+    }
+}
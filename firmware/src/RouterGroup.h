@@ -0,0 +1,122 @@
+#ifndef ROUTER_GROUP_H
+#define ROUTER_GROUP_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include "OpenWrtClient.h"
+#include "Crc32.h"
+#include "DomainList.h"
+
+// Order-independent digest of a blocklist: the sum of each domain's CRC-32
+// and the domain count, so the router's file and our store can be compared
+// without sorting or copying either.
+struct BlocklistDigest {
+    uint32_t sum;
+    uint32_t count;
+
+    BlocklistDigest() : sum(0), count(0) {}
+
+    void add(const char* domain, size_t len) {
+        sum += crc32Update(0, (const uint8_t*)domain, len);
+        count++;
+    }
+    bool operator==(const BlocklistDigest& other) const { return sum == other.sum && count == other.count; }
+    bool operator!=(const BlocklistDigest& other) const { return !(*this == other); }
+};
+
+// Several OpenWrt nodes driven as one router: the gateway (the primary, the
+// first node) plus mesh access points that must serve the same leases and
+// blocklists. Each extra node has its own client and its own task, so a call
+// made on every node costs one node's latency, not the sum of them all.
+//
+// Writes go to every node; one that misses a write is marked stale, left out
+// of later writes and brought back by resyncStale() with full rewrites. The
+// firewall, interface counters, query log and blocklist reads come from the
+// primary alone, since the gateway is what all traffic passes through.
+//
+// Only one task (the router task) may call in; the node tasks only ever run
+// the job it hands them.
+class RouterGroup {
+public:
+    static const int MAX_NODES = 5;
+    static const uint32_t NODE_TASK_STACK = 8192; // Same as the router task
+
+    // Runs on one node; `node` indexes per-node results
+    typedef std::function<bool(OpenWrtClient& client, int node)> Job;
+
+    RouterGroup(const char* host, const char* username, const char* password);
+
+    bool addNode(const char* host); // Same credentials as the primary; before begin()
+    void begin(BaseType_t core);    // Starts a task per extra node on `core`
+    int size() const { return _count; }
+    int staleCount() const;
+
+    // Session
+    bool checkSession(); // Every node; true if the primary has a session
+    bool hasSession() const { return _nodes[0].client->hasSession(); }
+
+    // Telemetry, merged across nodes
+    bool syncDevices(DeviceTable& table, uint32_t now);           // Leases from every node that answered
+    int getDeviceTraffic(DeviceCounters* target, int maxDevices); // Per MAC, the highest count; -1 without the primary
+    bool getTrafficStats(unsigned long long& rx, unsigned long long& tx);
+    bool readLog(const char* pattern, int lines, String& output);
+    String formatBytes(unsigned long long bytes) { return _nodes[0].client->formatBytes(bytes); }
+
+    // Control. True if at least one node took the change.
+    bool applyBlocklistChanges(JsonArray& changes);
+    bool applyAllowlistChanges(JsonArray& changes);
+    bool advertiseDnsServer(const String& ip); // Nodes without a LAN DHCP section just fail
+    bool getBlocklist(String& content);
+    bool runCommand(const char* command, const String& argument); // Primary only (firewall)
+
+    // Lists are copies taken under the caller's lock; every node walks the
+    // same one at once
+    bool replaceBlocklist(const DomainList& blocklist);
+
+    // Full rewrite of both lists on every stale node; the ones that take it
+    // rejoin the writes
+    void resyncStale(const DomainList& blocklist, const DomainList& allowlist);
+
+    // Reads every node's blocklist and marks the ones that differ from
+    // `expected` stale. Only meaningful with no edits queued.
+    void checkConsistency(const BlocklistDigest& expected);
+
+    void toJson(JsonArray& target) const; // Per node: host, latency, failures, stale, consistent
+    void cacheStatsToJson(JsonObject& target) const { _nodes[0].client->cacheStatsToJson(target); }
+
+private:
+    struct Node {
+        const char* host;
+        OpenWrtClient* client;
+        TaskHandle_t task;
+        char taskName[12];
+        RouterGroup* group;
+        int index;
+        bool result;                 // Of the last job, read once the node signalled
+        volatile uint32_t latencyMs; // Of the last job
+        volatile uint32_t calls;
+        volatile uint32_t failures;
+        volatile unsigned long lastOk;
+        volatile bool stale;
+        volatile int8_t consistent;  // -1 unknown, else the last check
+    };
+
+    Node _nodes[MAX_NODES];
+    int _count;
+    const char* _username;
+    const char* _password;
+    const Job* _job;          // The job being fanned out
+    SemaphoreHandle_t _done;  // Given by a node task when its job is done
+
+    static void nodeTaskMain(void* arg);
+    bool run(int index, const Job& job);
+    uint32_t fanOut(const Job& job, uint32_t mask); // Mask of the nodes that succeeded
+    bool write(const Job& job, bool tracked);
+    uint32_t allMask() const { return (1u << _count) - 1; }
+    uint32_t liveMask() const;
+    uint32_t staleMask() const { return allMask() & ~liveMask(); }
+    void markSynced(uint32_t mask);
+};
+
+#endif
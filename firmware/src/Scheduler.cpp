@@ -0,0 +1,327 @@
+#include "Scheduler.h"
+#include "BinarySnapshot.h"
+#include "MacAddress.h"
+
+static const char RULES_MAGIC[4] = {'N', 'G', 'S', 'C'};
+static const uint16_t RULES_VERSION = 1;
+
+Scheduler::Scheduler(const char* path) {
+    _path = path;
+    memset(_rules, 0, sizeof(_rules));
+    _nextId = 1;
+    _wheelValid = false;
+    _utcOffset = 0;
+    _blockedCount = 0;
+    _updatePending = false;
+    _transitions = 0;
+    _lock = nullptr;
+}
+
+void Scheduler::begin(BaseType_t core) {
+    _lock = xSemaphoreCreateMutex();
+    load();
+    xTaskCreatePinnedToCore(taskMain, "scheduler", 4096, this, 1, nullptr, core);
+}
+
+void Scheduler::taskMain(void* arg) {
+    Scheduler* scheduler = (Scheduler*)arg;
+    for (;;) {
+        scheduler->tick(time(nullptr));
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+}
+
+void Scheduler::tick(time_t now) {
+    if (now < VALID_TIME) return;
+
+    uint32_t minute = now / 60;
+    int offset;
+    int weekMinute = localWeekMinute(now, offset);
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    // A clock step (first NTP sync, manual change) or DST shift invalidates
+    // every computed due time; a couple of missed ticks does not.
+    if (!_wheelValid || offset != _utcOffset || minute < _wheel.current() || minute - _wheel.current() > 2) {
+        _utcOffset = offset;
+        rebuild(minute, weekMinute);
+    } else if (minute > _wheel.current()) {
+        uint8_t fired[TimerWheel::MAX_TIMERS];
+        int count = _wheel.advance(minute, fired);
+        for (int i = 0; i < count; i++) {
+            armRule(fired[i], minute, weekMinute);
+        }
+        if (count > 0) {
+            _transitions += count;
+            evaluate(weekMinute); // All rules due this minute, one update
+        }
+    }
+    xSemaphoreGive(_lock);
+}
+
+void Scheduler::rebuild(uint32_t nowMinute, int weekMinute) {
+    _wheel.reset(nowMinute);
+    for (int i = 0; i < MAX_RULES; i++) {
+        armRule(i, nowMinute, weekMinute);
+    }
+    evaluate(weekMinute);
+    _wheelValid = true;
+}
+
+void Scheduler::armRule(int slot, uint32_t nowMinute, int weekMinute) {
+    const Rule& rule = _rules[slot];
+    _wheel.cancel(slot);
+    if (rule.id == 0 || !rule.enabled) return;
+
+    int delta = minutesToNextTransition(rule, weekMinute);
+    if (delta > 0) {
+        _wheel.schedule(slot, nowMinute + delta);
+    }
+}
+
+void Scheduler::evaluate(int weekMinute) {
+    uint8_t blocked[MAX_BLOCKED][6];
+    int count = 0;
+    for (int i = 0; i < MAX_RULES; i++) {
+        const Rule& rule = _rules[i];
+        if (rule.id == 0 || !rule.enabled || !activeAt(rule, weekMinute)) continue;
+        for (int t = 0; t < rule.targetCount; t++) {
+            bool seen = false;
+            for (int j = 0; j < count && !seen; j++) {
+                seen = sameMac(blocked[j], rule.macs[t]);
+            }
+            if (!seen) memcpy(blocked[count++], rule.macs[t], 6);
+        }
+    }
+
+    bool changed = count != _blockedCount;
+    for (int i = 0; i < count && !changed; i++) {
+        bool found = false;
+        for (int j = 0; j < _blockedCount && !found; j++) {
+            found = sameMac(blocked[i], _blocked[j]);
+        }
+        changed = !found;
+    }
+    if (!changed) return;
+
+    memcpy(_blocked, blocked, (size_t)count * 6);
+    _blockedCount = count;
+    _updatePending = true;
+}
+
+bool Scheduler::takeUpdate(uint8_t (*macs)[6], int& count) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool pending = _updatePending;
+    if (pending) {
+        memcpy(macs, _blocked, (size_t)_blockedCount * 6);
+        count = _blockedCount;
+        _updatePending = false;
+    }
+    xSemaphoreGive(_lock);
+    return pending;
+}
+
+uint16_t Scheduler::upsert(const Rule& rule) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int slot = rule.id != 0 ? findSlot(rule.id) : findSlot(0);
+    uint16_t id = 0;
+    if (slot >= 0) {
+        _rules[slot] = rule;
+        if (rule.id == 0) _rules[slot].id = _nextId++;
+        id = _rules[slot].id;
+        _wheelValid = false; // Next tick re-arms and re-evaluates
+        save();
+    }
+    xSemaphoreGive(_lock);
+    return id;
+}
+
+bool Scheduler::remove(uint16_t id) {
+    if (id == 0) return false;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int slot = findSlot(id);
+    if (slot >= 0) {
+        memset(&_rules[slot], 0, sizeof(Rule));
+        _wheelValid = false;
+        save();
+    }
+    xSemaphoreGive(_lock);
+    return slot >= 0;
+}
+
+void Scheduler::toJson(JsonArray& target) {
+    time_t now = time(nullptr);
+    int offset;
+    int weekMinute = localWeekMinute(now, offset);
+    bool clockSet = now >= VALID_TIME;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (int i = 0; i < MAX_RULES; i++) {
+        const Rule& rule = _rules[i];
+        if (rule.id == 0) continue;
+
+        JsonObject item = target.add<JsonObject>();
+        item["id"] = rule.id;
+        item["name"] = rule.name;
+        item["enabled"] = rule.enabled != 0;
+
+        JsonArray days = item["days"].to<JsonArray>();
+        for (int d = 0; d < 7; d++) {
+            if (rule.days & (1 << d)) days.add(d);
+        }
+
+        char buf[6];
+        snprintf(buf, sizeof(buf), "%02d:%02d", rule.startMinute / 60, rule.startMinute % 60);
+        item["start"] = buf;
+        snprintf(buf, sizeof(buf), "%02d:%02d", rule.endMinute / 60, rule.endMinute % 60);
+        item["end"] = buf;
+
+        JsonArray macs = item["macs"].to<JsonArray>();
+        for (int t = 0; t < rule.targetCount; t++) {
+            macs.add(formatMac(rule.macs[t]));
+        }
+
+        if (clockSet && rule.enabled) {
+            item["active"] = activeAt(rule, weekMinute);
+            int delta = minutesToNextTransition(rule, weekMinute);
+            if (delta > 0) item["next"] = (uint32_t)((now / 60 + delta) * 60);
+        }
+    }
+    xSemaphoreGive(_lock);
+}
+
+static bool parseClock(const char* text, uint16_t& minute) {
+    int hours, minutes;
+    if (text == nullptr || sscanf(text, "%d:%d", &hours, &minutes) != 2) return false;
+    if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59) return false;
+    minute = hours * 60 + minutes;
+    return true;
+}
+
+bool Scheduler::fromJson(JsonVariantConst json, Rule& rule, String& error) {
+    memset(&rule, 0, sizeof(Rule));
+    rule.id = json["id"] | 0;
+    rule.enabled = (json["enabled"] | true) ? 1 : 0;
+    strlcpy(rule.name, json["name"] | "", sizeof(rule.name));
+
+    for (JsonVariantConst day : json["days"].as<JsonArrayConst>()) {
+        int d = day.as<int>();
+        if (d < 0 || d > 6) {
+            error = "days must be 0 (Sunday) to 6";
+            return false;
+        }
+        rule.days |= 1 << d;
+    }
+    if (rule.days == 0) {
+        error = "Missing days";
+        return false;
+    }
+
+    if (!parseClock(json["start"].as<const char*>(), rule.startMinute) ||
+        !parseClock(json["end"].as<const char*>(), rule.endMinute)) {
+        error = "start/end must be HH:MM";
+        return false;
+    }
+
+    for (JsonVariantConst mac : json["macs"].as<JsonArrayConst>()) {
+        if (rule.targetCount >= MAX_TARGETS || !parseMac(mac.as<const char*>(), rule.macs[rule.targetCount])) {
+            error = "Invalid or too many macs";
+            return false;
+        }
+        rule.targetCount++;
+    }
+    if (rule.targetCount == 0) {
+        error = "Missing macs";
+        return false;
+    }
+    return true;
+}
+
+bool Scheduler::activeAt(const Rule& rule, int weekMinute) {
+    int duration = rule.endMinute > rule.startMinute ? rule.endMinute - rule.startMinute
+                                                     : rule.endMinute + 24 * 60 - rule.startMinute;
+    for (int d = 0; d < 7; d++) {
+        if (!(rule.days & (1 << d))) continue;
+        int start = d * 24 * 60 + rule.startMinute;
+        if ((weekMinute - start + WEEK_MINUTES) % WEEK_MINUTES < duration) return true;
+    }
+    return false;
+}
+
+int Scheduler::minutesToNextTransition(const Rule& rule, int weekMinute) {
+    int duration = rule.endMinute > rule.startMinute ? rule.endMinute - rule.startMinute
+                                                     : rule.endMinute + 24 * 60 - rule.startMinute;
+    int best = 0;
+    for (int d = 0; d < 7; d++) {
+        if (!(rule.days & (1 << d))) continue;
+        int start = d * 24 * 60 + rule.startMinute;
+        int edges[2] = {start, start + duration};
+        for (int edge : edges) {
+            int delta = ((edge - weekMinute) % WEEK_MINUTES + WEEK_MINUTES) % WEEK_MINUTES;
+            if (delta == 0) delta = WEEK_MINUTES;
+            if (best == 0 || delta < best) best = delta;
+        }
+    }
+    return best;
+}
+
+int Scheduler::localWeekMinute(time_t now, int& utcOffset) {
+    struct tm local;
+    localtime_r(&now, &local);
+    int dayMinute = local.tm_hour * 60 + local.tm_min;
+
+    utcOffset = dayMinute - (int)((now / 60) % (24 * 60));
+    if (utcOffset > 12 * 60) utcOffset -= 24 * 60;
+    if (utcOffset < -12 * 60) utcOffset += 24 * 60;
+
+    return local.tm_wday * 24 * 60 + dayMinute;
+}
+
+int Scheduler::findSlot(uint16_t id) const {
+    for (int i = 0; i < MAX_RULES; i++) {
+        if (_rules[i].id == id) return i;
+    }
+    return -1;
+}
+
+void Scheduler::save() const {
+    Rule used[MAX_RULES];
+    uint32_t count = 0;
+    for (int i = 0; i < MAX_RULES; i++) {
+        if (_rules[i].id != 0) used[count++] = _rules[i];
+    }
+
+    uint32_t header[3] = {count, _nextId, sizeof(Rule)};
+    SnapshotPart parts[] = {
+        {header, sizeof(header)},
+        {used, sizeof(Rule) * count},
+    };
+    writeSnapshot(_path.c_str(), RULES_MAGIC, RULES_VERSION, parts, 2);
+}
+
+void Scheduler::load() {
+    size_t size;
+    uint8_t* payload = readSnapshot(_path.c_str(), RULES_MAGIC, RULES_VERSION, size);
+    if (payload == nullptr) return;
+
+    uint32_t header[3];
+    bool ok = size >= sizeof(header);
+    if (ok) {
+        memcpy(header, payload, sizeof(header));
+        ok = header[0] <= MAX_RULES && header[2] == sizeof(Rule) && size == sizeof(header) + sizeof(Rule) * header[0];
+    }
+
+    if (ok) {
+        memcpy(_rules, payload + sizeof(header), sizeof(Rule) * header[0]);
+        _nextId = header[1];
+        for (uint32_t i = 0; i < header[0]; i++) {
+            _rules[i].name[MAX_NAME] = '\0';
+            if (_rules[i].targetCount > MAX_TARGETS) _rules[i].targetCount = MAX_TARGETS;
+        }
+        Serial.print("Scheduler: ");
+        Serial.print(header[0]);
+        Serial.println(" rules");
+    } else {
+        Serial.println("Scheduler: malformed rules " + _path);
+    }
+    free(payload);
+}
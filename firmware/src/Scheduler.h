@@ -0,0 +1,84 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "TimerWheel.h"
+#include <time.h>
+
+// Weekly recurring block windows ("bedtime", "homework") for a device or a
+// group of devices. Rules are kept on LittleFS; a background task wakes once
+// a second, and a TimerWheel holds each rule's next start/end so the task
+// only re-evaluates the rules at a transition. Every rule that changes state
+// in the same minute produces one new set of blocked MACs, which the router
+// task hands to the firewall as one router call (takeUpdate()).
+//
+// Times are local (TZ as set by configTzTime); nothing fires until NTP has
+// set the clock. A clock step or UTC offset change (DST) rebuilds the wheel.
+class Scheduler {
+public:
+    static const int MAX_RULES = 16;
+    static const int MAX_TARGETS = 8;
+    static const int MAX_NAME = 23;
+    static const int MAX_BLOCKED = MAX_RULES * MAX_TARGETS;
+
+    struct Rule {
+        uint16_t id;          // 0 = unused slot
+        uint8_t days;         // Days the window starts on, bit 0 = Sunday
+        uint8_t enabled;
+        uint16_t startMinute; // Local minutes after midnight
+        uint16_t endMinute;   // At or before start: ends the next day
+        uint8_t targetCount;
+        uint8_t macs[MAX_TARGETS][6];
+        char name[MAX_NAME + 1];
+    };
+
+    explicit Scheduler(const char* path);
+
+    void begin(BaseType_t core = tskNO_AFFINITY); // Loads rules, starts the timer task on `core`
+
+    uint16_t upsert(const Rule& rule); // New rule if rule.id is 0; returns its id, 0 on failure
+    bool remove(uint16_t id);
+    void toJson(JsonArray& target);
+    static bool fromJson(JsonVariantConst json, Rule& rule, String& error);
+
+    // Copies the MACs that should be blocked right now, if that changed since
+    // the last call. `macs` must hold MAX_BLOCKED entries.
+    bool takeUpdate(uint8_t (*macs)[6], int& count);
+    uint32_t transitions() const { return _transitions; }
+
+private:
+    static const int WEEK_MINUTES = 7 * 24 * 60;
+    static const time_t VALID_TIME = 1700000000; // Before this the clock isn't set yet
+
+    String _path;
+    Rule _rules[MAX_RULES];
+    uint16_t _nextId;
+
+    TimerWheel _wheel; // Timer id = rule slot
+    bool _wheelValid;
+    int _utcOffset;    // Minutes, to spot DST changes
+
+    uint8_t _blocked[MAX_BLOCKED][6];
+    int _blockedCount;
+    bool _updatePending;
+    uint32_t _transitions;
+
+    SemaphoreHandle_t _lock;
+
+    static void taskMain(void* arg);
+    void tick(time_t now);
+    void rebuild(uint32_t nowMinute, int weekMinute);
+    void evaluate(int weekMinute);
+    void armRule(int slot, uint32_t nowMinute, int weekMinute);
+
+    static bool activeAt(const Rule& rule, int weekMinute);
+    static int minutesToNextTransition(const Rule& rule, int weekMinute); // 1..WEEK_MINUTES, 0 if none
+    static int localWeekMinute(time_t now, int& utcOffset);
+
+    int findSlot(uint16_t id) const;
+    void save() const;
+    void load();
+};
+
+#endif
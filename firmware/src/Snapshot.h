@@ -0,0 +1,93 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <new>
+
+// Hands immutable versions of a piece of state from the task that owns it to
+// request handlers on other tasks, RCU style. The writer keeps working on
+// its own copy and publish()es a new version when it changed; readers
+// acquire() whichever version is current and use it, without locking, for as
+// long as they hold the Ref. A version is freed by whoever drops the last
+// reference to it, so a slow reader only delays freeing its own version.
+//
+// Readers count themselves in _readers for the few instructions between
+// loading the pointer and taking a reference. publish() waits for that count
+// to drain before dropping its own reference to the old version, so no
+// reader can be left holding a pointer to a version that was just freed.
+// That wait sleeps, so publish() belongs in a task, one writer at a time.
+template <typename T>
+class SnapshotCell {
+    struct Node {
+        T value;
+        std::atomic<int> refs;
+
+        explicit Node(const T& initial) : value(initial), refs(1) {} // The cell's reference
+    };
+
+public:
+    class Ref {
+    public:
+        Ref() : _node(nullptr) {}
+        Ref(const Ref& other) : _node(other._node) {
+            if (_node != nullptr) _node->refs.fetch_add(1);
+        }
+        Ref& operator=(const Ref& other) {
+            if (other._node != nullptr) other._node->refs.fetch_add(1);
+            release();
+            _node = other._node;
+            return *this;
+        }
+        ~Ref() { release(); }
+
+        explicit operator bool() const { return _node != nullptr; }
+        const T& operator*() const { return _node->value; }
+        const T* operator->() const { return &_node->value; }
+
+    private:
+        friend class SnapshotCell;
+        explicit Ref(Node* node) : _node(node) {}
+
+        void release() {
+            if (_node != nullptr && _node->refs.fetch_sub(1) == 1) delete _node;
+            _node = nullptr;
+        }
+
+        Node* _node;
+    };
+
+    SnapshotCell() : _current(nullptr), _readers(0) {}
+    ~SnapshotCell() {
+        Node* node = _current.load();
+        if (node != nullptr && node->refs.fetch_sub(1) == 1) delete node;
+    }
+
+    // Empty until the first publish()
+    Ref acquire() const {
+        _readers.fetch_add(1);
+        Node* node = _current.load();
+        if (node != nullptr) node->refs.fetch_add(1);
+        _readers.fetch_sub(1);
+        return Ref(node);
+    }
+
+    // Copies `value` into a new version; false (old one stays) if out of memory
+    bool publish(const T& value) {
+        Node* next = new (std::nothrow) Node(value);
+        if (next == nullptr) return false;
+
+        Node* previous = _current.exchange(next);
+        while (_readers.load() != 0) {
+            vTaskDelay(1); // A reader is between load and fetch_add
+        }
+        if (previous != nullptr && previous->refs.fetch_sub(1) == 1) delete previous;
+        return true;
+    }
+
+private:
+    std::atomic<Node*> _current;
+    mutable std::atomic<int> _readers;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef SPACE_SAVING_H
+#define SPACE_SAVING_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Top-k heavy hitters over a stream of names in fixed memory (the
+// Space-Saving algorithm). SLOTS counters track the most frequent names seen
+// so far; an unseen name takes over the smallest counter and inherits its
+// count as `error`, so count - error is a guaranteed lower bound. Any name
+// occurring more than total/SLOTS times is always present.
+//
+// Names are matched by hash and kept truncated to MAX_NAME for display.
+template <int SLOTS>
+class SpaceSaving {
+public:
+    static const int MAX_NAME = 47;
+
+    SpaceSaving() { clear(); }
+
+    void clear() {
+        for (int i = 0; i < SLOTS; i++) {
+            _slots[i].count = 0;
+        }
+    }
+
+    void add(const char* name, size_t len, uint32_t hash) {
+        int smallest = 0;
+        for (int i = 0; i < SLOTS; i++) {
+            Slot& slot = _slots[i];
+            if (slot.count > 0 && slot.hash == hash) {
+                slot.count++;
+                return;
+            }
+            if (slot.count < _slots[smallest].count) smallest = i;
+        }
+
+        Slot& slot = _slots[smallest];
+        slot.error = slot.count; // 0 for a free slot
+        slot.count++;
+        slot.hash = hash;
+        if (len > MAX_NAME) len = MAX_NAME;
+        memcpy(slot.name, name, len);
+        slot.name[len] = '\0';
+    }
+
+    // Largest `limit` counters, highest first: [{"domain", "count", "error"}]
+    void toJson(JsonArray& target, int limit) const {
+        bool taken[SLOTS] = {false};
+        for (int n = 0; n < limit; n++) {
+            int best = -1;
+            for (int i = 0; i < SLOTS; i++) {
+                if (taken[i] || _slots[i].count == 0) continue;
+                if (best < 0 || _slots[i].count > _slots[best].count) best = i;
+            }
+            if (best < 0) break;
+            taken[best] = true;
+
+            JsonObject item = target.add<JsonObject>();
+            item["domain"] = _slots[best].name;
+            item["count"] = _slots[best].count;
+            item["error"] = _slots[best].error;
+        }
+    }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t count; // 0 = free
+        uint32_t error;
+        char name[MAX_NAME + 1];
+    };
+
+    Slot _slots[SLOTS];
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Fixed-size ring buffer between exactly one producer task and one consumer
+// task, with no lock: the producer only writes _tail, the consumer only
+// writes _head, and the release/acquire pair on each makes the slot contents
+// visible before the index that publishes them. Safe across the two cores.
+//
+// The indices run freely and wrap; CAPACITY must be a power of two so the
+// wrap lands on a slot boundary. push() fails rather than waits when full.
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+public:
+    SpscQueue() : _head(0), _tail(0) {}
+
+    bool push(const T& item) { // Producer only
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == CAPACITY) return false;
+        _items[tail & (CAPACITY - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) { // Consumer only
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) return false;
+        item = _items[head & (CAPACITY - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { // Either side; a snapshot
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+private:
+    T _items[CAPACITY];
+    std::atomic<size_t> _head; // Next slot to pop
+    std::atomic<size_t> _tail; // Next slot to push
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "TaskStats.h"
+
+TaskStats::TaskStats() {
+    _count = 0;
+    _lastSample = 0;
+}
+
+int TaskStats::append(const char* name, TaskHandle_t handle, bool measured) {
+    if (_count >= MAX_TASKS) return -1;
+    Task& task = _tasks[_count];
+    task.name = name;
+    task.handle = handle;
+    task.measured = measured;
+    task.busy = 0;
+    task.sampledBusy = 0;
+    task.load = 0;
+    return _count++;
+}
+
+int TaskStats::add(const char* name, TaskHandle_t handle) {
+    return append(name, handle, true);
+}
+
+void TaskStats::track(const char* name) {
+    append(name, xTaskGetHandle(name), false);
+}
+
+void TaskStats::busy(int id, uint32_t micros) {
+    if (id < 0) return;
+    _tasks[id].busy += micros;
+}
+
+void TaskStats::sample(unsigned long now) {
+    unsigned long window = now - _lastSample;
+    _lastSample = now;
+
+    for (int i = 0; i < _count; i++) {
+        Task& task = _tasks[i];
+        if (task.handle == nullptr) {
+            task.handle = xTaskGetHandle(task.name);
+        }
+        if (!task.measured) continue;
+
+        // Wraps every ~71 min of busy time; the difference is still right
+        uint32_t busy = task.busy;
+        uint32_t spent = busy - task.sampledBusy;
+        task.sampledBusy = busy;
+        uint32_t percent = window > 0 ? spent / 10 / window : 0; // us over ms
+        task.load = percent > 100 ? 100 : percent;
+    }
+}
+
+void TaskStats::toJson(JsonArray& target) const {
+    for (int i = 0; i < _count; i++) {
+        const Task& task = _tasks[i];
+        JsonObject item = target.add<JsonObject>();
+        item["name"] = task.name;
+        if (task.handle == nullptr) {
+            item["running"] = false;
+            continue;
+        }
+        BaseType_t core = xTaskGetAffinity(task.handle);
+        item["core"] = core == tskNO_AFFINITY ? -1 : (int)core;
+        item["stackFree"] = uxTaskGetStackHighWaterMark(task.handle); // Bytes, at the worst so far
+        if (task.measured) item["load"] = task.load;
+    }
+}
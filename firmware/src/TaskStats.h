@@ -0,0 +1,49 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Stack headroom, core and load of the tasks that matter, for /api/metrics.
+//
+// FreeRTOS run-time stats are compiled out of the Arduino core, so load is
+// what a task reports about itself: our own tasks add the microseconds they
+// spend on a round of work (busy()), and sample() turns that into a
+// percentage of the time since the previous sample. For the router task that
+// includes waiting on the router, which is the number that matters there.
+//
+// Tasks we don't own (async_tcp, loopTask) are looked up by name and report
+// stack and core only; ones that start later (async_udp) are picked up once
+// they exist.
+class TaskStats {
+public:
+    static const int MAX_TASKS = 8;
+
+    TaskStats();
+
+    int add(const char* name, TaskHandle_t handle); // Our task; returns the id for busy()
+    void track(const char* name);                   // Someone else's, by task name
+
+    void busy(int id, uint32_t micros); // From the task itself only
+    void sample(unsigned long now);     // Call every few seconds
+
+    void toJson(JsonArray& target) const;
+
+private:
+    struct Task {
+        const char* name;
+        TaskHandle_t handle;
+        bool measured;          // Reports busy time
+        volatile uint32_t busy; // Microseconds; written by the task, read by sample()
+        uint32_t sampledBusy;
+        uint8_t load;           // Percent over the last sample window
+    };
+
+    Task _tasks[MAX_TASKS];
+    int _count;
+    unsigned long _lastSample;
+
+    int append(const char* name, TaskHandle_t handle, bool measured);
+};
+
+#endif
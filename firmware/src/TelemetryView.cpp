@@ -0,0 +1,29 @@
+#include "TelemetryView.h"
+
+void TelemetryView::capture(const TrafficStats& stats, const TrafficSeries& series) {
+    statsVersion = stats.version();
+    seriesVersion = series.version();
+
+    hasData = stats.hasData();
+    totalRx = stats.totalRx();
+    totalTx = stats.totalTx();
+    rxRate = txRate = rxRate60 = txRate60 = 0;
+    stats.getRate(10000, rxRate, txRate);
+    stats.getRate(60000, rxRate60, txRate60);
+
+    deviceCount = 0;
+    series.forEachDevice([&](const uint8_t* mac) {
+        DeviceUsage& usage = devices[deviceCount];
+        if (!series.getUsage(mac, usage.rx, usage.tx)) return;
+        series.getRate(mac, usage.rxRate, usage.txRate);
+        memcpy(usage.mac, mac, 6);
+        deviceCount++;
+    });
+}
+
+const TelemetryView::DeviceUsage* TelemetryView::find(const uint8_t mac[6]) const {
+    for (int i = 0; i < deviceCount; i++) {
+        if (memcmp(devices[i].mac, mac, 6) == 0) return &devices[i];
+    }
+    return nullptr;
+}
@@ -0,0 +1,38 @@
+#ifndef TELEMETRY_VIEW_H
+#define TELEMETRY_VIEW_H
+
+#include <Arduino.h>
+#include "TrafficStats.h"
+#include "TrafficSeries.h"
+
+// What request handlers read of the traffic telemetry, captured by the
+// aggregate task after each sample and published as a snapshot. Small
+// enough to copy whole; the usage history itself stays in TrafficSeries.
+struct TelemetryView {
+    struct DeviceUsage {
+        uint8_t mac[6];
+        unsigned long long rx; // Last 24 h
+        unsigned long long tx;
+        uint32_t rxRate;       // Bytes/s
+        uint32_t txRate;
+    };
+
+    uint32_t statsVersion;
+    uint32_t seriesVersion;
+
+    bool hasData;
+    unsigned long long totalRx;
+    unsigned long long totalTx;
+    uint32_t rxRate; // Bytes/s over 10 s
+    uint32_t txRate;
+    uint32_t rxRate60; // Over 60 s
+    uint32_t txRate60;
+
+    DeviceUsage devices[TrafficSeries::MAX_DEVICES];
+    int deviceCount;
+
+    void capture(const TrafficStats& stats, const TrafficSeries& series);
+    const DeviceUsage* find(const uint8_t mac[6]) const; // nullptr if no usage recorded
+};
+
+#endif
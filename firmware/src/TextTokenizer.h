@@ -0,0 +1,116 @@
+#ifndef TEXT_TOKENIZER_H
+#define TEXT_TOKENIZER_H
+
+#include <stddef.h>
+#include <string.h>
+
+// Views into a text buffer we already hold (a router response, a logread
+// tail), so splitting it into lines and fields allocates and copies nothing.
+// A span is only valid as long as the buffer it points into.
+struct TextSpan {
+    const char* data;
+    size_t len;
+
+    TextSpan() : data(""), len(0) {}
+    TextSpan(const char* text, size_t length) : data(text), len(length) {}
+
+    bool empty() const { return len == 0; }
+    const char* end() const { return data + len; }
+
+    bool equals(const char* text, size_t length) const {
+        return len == length && memcmp(data, text, len) == 0;
+    }
+    bool equals(const char* word) const { return equals(word, strlen(word)); }
+
+    // Byte order, shorter first on a common prefix; <0, 0 or >0 like strcmp
+    int compare(const char* text, size_t length) const {
+        int order = memcmp(data, text, len < length ? len : length);
+        if (order != 0) return order;
+        return len < length ? -1 : (len > length ? 1 : 0);
+    }
+    bool operator<(const TextSpan& other) const { return compare(other.data, other.len) < 0; }
+
+    // Without leading and trailing spaces, tabs and carriage returns
+    TextSpan trimmed() const {
+        const char* first = data;
+        const char* last = end();
+        while (first < last && isBlank(*first)) first++;
+        while (last > first && isBlank(last[-1])) last--;
+        return TextSpan(first, last - first);
+    }
+
+    // First occurrence in the span, nullptr if absent
+    const char* find(char c) const {
+        return (const char*)memchr(data, c, len);
+    }
+    const char* find(const char* needle) const {
+        size_t needleLen = strlen(needle);
+        const char* pos = data;
+        while ((size_t)(end() - pos) >= needleLen) {
+            const char* hit = (const char*)memchr(pos, needle[0], end() - pos - needleLen + 1);
+            if (hit == nullptr) return nullptr;
+            if (memcmp(hit, needle, needleLen) == 0) return hit;
+            pos = hit + 1;
+        }
+        return nullptr;
+    }
+
+    // The rest of the span from `pos`, which must point into it
+    TextSpan from(const char* pos) const { return TextSpan(pos, end() - pos); }
+
+    static bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+};
+
+// Lines split on '\n'; the last one needs no terminator. Lines are returned
+// as they are (including any '\r'), so callers trim as they need.
+class LineReader {
+public:
+    LineReader(const char* text, size_t length) : _pos(text), _end(text + length) {}
+
+    bool next(TextSpan& line) {
+        if (_pos >= _end) return false;
+        const char* newline = (const char*)memchr(_pos, '\n', _end - _pos);
+        const char* lineEnd = newline ? newline : _end;
+        line = TextSpan(_pos, lineEnd - _pos);
+        _pos = newline ? newline + 1 : _end;
+        return true;
+    }
+
+    const char* position() const { return _pos; } // Start of the next line
+
+private:
+    const char* _pos;
+    const char* _end;
+};
+
+// Fields of one line separated by runs of spaces, tabs or carriage returns
+class FieldReader {
+public:
+    explicit FieldReader(const TextSpan& text) : _pos(text.data), _end(text.end()) {}
+
+    bool next(TextSpan& field) {
+        while (_pos < _end && TextSpan::isBlank(*_pos)) _pos++;
+        if (_pos >= _end) return false;
+        const char* start = _pos;
+        while (_pos < _end && !TextSpan::isBlank(*_pos)) _pos++;
+        field = TextSpan(start, _pos - start);
+        return true;
+    }
+
+private:
+    const char* _pos;
+    const char* _end;
+};
+
+// True if one of the lines in `text`, trimmed, is exactly `line`
+inline bool containsLine(const char* text, size_t length, const char* line) {
+    size_t lineLen = strlen(line);
+    LineReader lines(text, length);
+    TextSpan current;
+    while (lines.next(current)) {
+        if (current.trimmed().equals(line, lineLen)) return true;
+    }
+    return false;
+}
+
+#endif
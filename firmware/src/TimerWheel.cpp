@@ -0,0 +1,104 @@
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel() {
+    reset(0);
+}
+
+void TimerWheel::reset(uint32_t nowMinute) {
+    _current = nowMinute;
+    for (int i = 0; i < MINUTE_SLOTS + HOUR_SLOTS; i++) {
+        _heads[i] = NONE;
+    }
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        _slot[i] = NONE;
+        _next[i] = NONE;
+        _prev[i] = NONE;
+        _due[i] = 0;
+    }
+}
+
+bool TimerWheel::schedule(uint8_t id, uint32_t dueMinute) {
+    if (id >= MAX_TIMERS) return false;
+    if (dueMinute <= _current || dueMinute - _current > MAX_DELAY) return false;
+
+    unlink(id);
+    _due[id] = dueMinute;
+    place(id);
+    return true;
+}
+
+void TimerWheel::cancel(uint8_t id) {
+    if (id < MAX_TIMERS) unlink(id);
+}
+
+int TimerWheel::advance(uint32_t nowMinute, uint8_t fired[MAX_TIMERS]) {
+    int count = 0;
+    while (_current < nowMinute) {
+        _current++;
+
+        // New hour: bring its timers down into the minute wheel
+        if (_current % 60 == 0) {
+            int hourSlot = MINUTE_SLOTS + (_current / 60) % HOUR_SLOTS;
+            int8_t id = _heads[hourSlot];
+            while (id != NONE) {
+                int8_t next = _next[id];
+                unlink(id);
+                place(id);
+                id = next;
+            }
+        }
+
+        int8_t id = _heads[_current % MINUTE_SLOTS];
+        while (id != NONE) {
+            int8_t next = _next[id];
+            if (_due[id] <= _current) {
+                unlink(id);
+                fired[count++] = id;
+            }
+            id = next;
+        }
+    }
+    return count;
+}
+
+int TimerWheel::pending() const {
+    int count = 0;
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (_slot[i] != NONE) count++;
+    }
+    return count;
+}
+
+void TimerWheel::place(uint8_t id) {
+    uint32_t due = _due[id];
+    // Within the hour ahead, the minute slot comes round exactly at `due`;
+    // otherwise the hour slot does, at the start of due's hour
+    int slot;
+    if (due - _current < MINUTE_SLOTS) {
+        slot = due % MINUTE_SLOTS;
+    } else {
+        slot = MINUTE_SLOTS + (due / 60) % HOUR_SLOTS;
+    }
+
+    _slot[id] = slot;
+    _prev[id] = NONE;
+    _next[id] = _heads[slot];
+    if (_heads[slot] != NONE) _prev[_heads[slot]] = id;
+    _heads[slot] = id;
+}
+
+void TimerWheel::unlink(uint8_t id) {
+    int slot = _slot[id];
+    if (slot == NONE) return;
+
+    if (_prev[id] != NONE) {
+        _next[_prev[id]] = _next[id];
+    } else {
+        _heads[slot] = _next[id];
+    }
+    if (_next[id] != NONE) _prev[_next[id]] = _prev[id];
+
+    _slot[id] = NONE;
+    _next[id] = NONE;
+    _prev[id] = NONE;
+}
@@ -0,0 +1,48 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <Arduino.h>
+
+// Two-level hashed timer wheel with one-minute resolution, for timers up to
+// a week out. Timers due within the hour sit in the minute wheel; later ones
+// sit in the hour wheel and move down when their hour starts. Scheduling,
+// cancelling and firing cost O(timers in one slot), not O(all timers).
+//
+//   wheel.reset(nowMinute);
+//   wheel.schedule(id, dueMinute);
+//   int n = wheel.advance(nowMinute, fired); // ids that came due
+class TimerWheel {
+public:
+    static const int MINUTE_SLOTS = 60;
+    static const int HOUR_SLOTS = 168;
+    static const int MAX_TIMERS = 32;
+    static const uint32_t MAX_DELAY = (uint32_t)HOUR_SLOTS * 60; // Minutes
+
+    TimerWheel();
+
+    void reset(uint32_t nowMinute); // Drops every timer
+    bool schedule(uint8_t id, uint32_t dueMinute); // Replaces the timer's previous due time
+    void cancel(uint8_t id);
+
+    // Walks every minute up to nowMinute, collecting due timers (which are
+    // then unscheduled). Each timer fires at most once, so MAX_TIMERS is enough.
+    int advance(uint32_t nowMinute, uint8_t fired[MAX_TIMERS]);
+
+    uint32_t current() const { return _current; }
+    int pending() const;
+
+private:
+    static const int8_t NONE = -1;
+
+    uint32_t _current;
+    uint32_t _due[MAX_TIMERS];
+    int8_t _next[MAX_TIMERS];
+    int8_t _prev[MAX_TIMERS];
+    int16_t _slot[MAX_TIMERS]; // Minute slots, then hour slots; NONE if unscheduled
+    int8_t _heads[MINUTE_SLOTS + HOUR_SLOTS];
+
+    void place(uint8_t id);
+    void unlink(uint8_t id);
+};
+
+#endif
@@ -0,0 +1,221 @@
+#include "TrafficSeries.h"
+#include "MacAddress.h"
+#include "TrafficStats.h"
+
+static const uint32_t MINUTE_SECONDS = 60;
+static const uint32_t QUARTER_SECONDS = 15 * 60;
+static const uint32_t DAY_SECONDS = 24 * 60 * 60;
+
+TrafficSeries::TrafficSeries() {
+    memset(_devices, 0, sizeof(_devices));
+    _minuteIndex = 0;
+    _quarterIndex = 0;
+    _dayIndex = 0;
+    _lastSampleTime = 0;
+    _version = 0;
+    _writes = 0;
+}
+
+void TrafficSeries::addSample(const DeviceCounters* samples, int count, uint32_t now) {
+    _writes.fetch_add(1); // Odd: readers elsewhere retry
+    advance(now);
+
+    uint32_t elapsed = (_lastSampleTime > 0 && now > _lastSampleTime) ? now - _lastSampleTime : 0;
+
+    // Devices missing from this sample are idle
+    bool changed = false;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (_devices[i].rxRate != 0 || _devices[i].txRate != 0) changed = true;
+        _devices[i].rxRate = 0;
+        _devices[i].txRate = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const DeviceCounters& sample = samples[i];
+        Device* device = find(sample.mac);
+        if (device == nullptr) {
+            // First sighting only establishes the baseline
+            device = findOrAdd(sample.mac, now);
+            device->lastRx = sample.rx;
+            device->lastTx = sample.tx;
+            continue;
+        }
+
+        // Handles nlbwmon starting a new period and router reboots
+        unsigned long long rxDelta = TrafficStats::counterDelta(device->lastRx, sample.rx);
+        unsigned long long txDelta = TrafficStats::counterDelta(device->lastTx, sample.tx);
+
+        device->lastRx = sample.rx;
+        device->lastTx = sample.tx;
+        device->lastSeen = now;
+
+        if (elapsed > 0) {
+            device->rxRate = rxDelta / elapsed;
+            device->txRate = txDelta / elapsed;
+        }
+
+        record(*device, rxDelta, txDelta);
+        if (rxDelta > 0 || txDelta > 0) changed = true;
+    }
+
+    if (changed) _version++;
+
+    _lastSampleTime = now;
+    _writes.fetch_add(1);
+}
+
+void TrafficSeries::record(Device& device, unsigned long long rxBytes, unsigned long long txBytes) {
+    rxBytes += device.rxRemainder;
+    txBytes += device.txRemainder;
+    device.rxRemainder = rxBytes % 1024;
+    device.txRemainder = txBytes % 1024;
+
+    uint32_t rxKiB = (rxBytes / 1024) > 0xFFFFFFFFull ? 0xFFFFFFFF : (uint32_t)(rxBytes / 1024);
+    uint32_t txKiB = (txBytes / 1024) > 0xFFFFFFFFull ? 0xFFFFFFFF : (uint32_t)(txBytes / 1024);
+
+    addToBucket(device.minute[_minuteIndex % MINUTE_SLOTS], rxKiB, txKiB);
+    addToBucket(device.quarter[_quarterIndex % QUARTER_SLOTS], rxKiB, txKiB);
+    addToBucket(device.day[_dayIndex % DAY_SLOTS], rxKiB, txKiB);
+}
+
+void TrafficSeries::addToBucket(Bucket& bucket, uint32_t rxKiB, uint32_t txKiB) {
+    // Saturate instead of wrapping
+    bucket.rxKiB = (bucket.rxKiB > 0xFFFFFFFF - rxKiB) ? 0xFFFFFFFF : bucket.rxKiB + rxKiB;
+    bucket.txKiB = (bucket.txKiB > 0xFFFFFFFF - txKiB) ? 0xFFFFFFFF : bucket.txKiB + txKiB;
+}
+
+void TrafficSeries::advance(uint32_t now) {
+    uint32_t minute = now / MINUTE_SECONDS;
+    uint32_t quarter = now / QUARTER_SECONDS;
+    uint32_t day = now / DAY_SECONDS;
+
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        Device& device = _devices[i];
+        if (!device.used) continue;
+        if (minute != _minuteIndex) clearSlots(device.minute, MINUTE_SLOTS, _minuteIndex, minute);
+        if (quarter != _quarterIndex) clearSlots(device.quarter, QUARTER_SLOTS, _quarterIndex, quarter);
+        if (day != _dayIndex) clearSlots(device.day, DAY_SLOTS, _dayIndex, day);
+    }
+
+    _minuteIndex = minute;
+    _quarterIndex = quarter;
+    _dayIndex = day;
+}
+
+void TrafficSeries::clearSlots(Bucket* slots, int count, uint32_t fromIndex, uint32_t toIndex) {
+    // Zero every bucket we skipped over; a clock jump (either way) clears the tier
+    if (toIndex < fromIndex || toIndex - fromIndex >= (uint32_t)count) {
+        memset(slots, 0, sizeof(Bucket) * count);
+        return;
+    }
+    for (uint32_t i = fromIndex + 1; i <= toIndex; i++) {
+        slots[i % count] = {0, 0};
+    }
+}
+
+TrafficSeries::Device* TrafficSeries::find(const uint8_t mac[6]) {
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (_devices[i].used && sameMac(_devices[i].mac, mac)) return &_devices[i];
+    }
+    return nullptr;
+}
+
+const TrafficSeries::Device* TrafficSeries::find(const uint8_t mac[6]) const {
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (_devices[i].used && sameMac(_devices[i].mac, mac)) return &_devices[i];
+    }
+    return nullptr;
+}
+
+TrafficSeries::Device* TrafficSeries::findOrAdd(const uint8_t mac[6], uint32_t now) {
+    Device* device = find(mac);
+    if (device != nullptr) return device;
+
+    // Take a free slot, or recycle the device that has been quiet the longest
+    Device* victim = &_devices[0];
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (!_devices[i].used) {
+            victim = &_devices[i];
+            break;
+        }
+        if (_devices[i].lastSeen < victim->lastSeen) victim = &_devices[i];
+    }
+
+    memset(victim, 0, sizeof(Device));
+    victim->used = true;
+    memcpy(victim->mac, mac, 6);
+    victim->lastSeen = now;
+    return victim;
+}
+
+bool TrafficSeries::query(const uint8_t mac[6], Resolution res, uint32_t from, uint32_t to, JsonArray& target) const {
+    const Device* device = find(mac);
+    if (device == nullptr) return false;
+
+    const Bucket* slots;
+    int count;
+    uint32_t length;
+    uint32_t current;
+    switch (res) {
+        case MINUTE:  slots = device->minute;  count = MINUTE_SLOTS;  length = MINUTE_SECONDS;  current = _minuteIndex;  break;
+        case QUARTER: slots = device->quarter; count = QUARTER_SLOTS; length = QUARTER_SECONDS; current = _quarterIndex; break;
+        default:      slots = device->day;     count = DAY_SLOTS;     length = DAY_SECONDS;     current = _dayIndex;     break;
+    }
+
+    // Oldest to newest: [start, rxBytes, txBytes]
+    uint32_t oldest = current >= (uint32_t)(count - 1) ? current - (count - 1) : 0;
+    for (uint32_t index = oldest; index <= current; index++) {
+        uint32_t start = index * length;
+        if (start + length <= from || start > to) continue;
+
+        const Bucket& bucket = slots[index % count];
+        JsonArray point = target.add<JsonArray>();
+        point.add(start);
+        point.add((unsigned long long)bucket.rxKiB * 1024);
+        point.add((unsigned long long)bucket.txKiB * 1024);
+    }
+    return true;
+}
+
+bool TrafficSeries::getUsage(const uint8_t mac[6], unsigned long long& rx, unsigned long long& tx) const {
+    const Device* device = find(mac);
+    if (device == nullptr) return false;
+
+    rx = 0;
+    tx = 0;
+    for (int i = 0; i < QUARTER_SLOTS; i++) {
+        rx += (unsigned long long)device->quarter[i].rxKiB * 1024;
+        tx += (unsigned long long)device->quarter[i].txKiB * 1024;
+    }
+    return true;
+}
+
+bool TrafficSeries::getRate(const uint8_t mac[6], uint32_t& rxRate, uint32_t& txRate) const {
+    const Device* device = find(mac);
+    if (device == nullptr) return false;
+
+    rxRate = device->rxRate;
+    txRate = device->txRate;
+    return true;
+}
+
+int TrafficSeries::deviceCount() const {
+    int count = 0;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (_devices[i].used) count++;
+    }
+    return count;
+}
+
+bool TrafficSeries::parseResolution(const String& name, Resolution& res) {
+    if (name == "minute") {
+        res = MINUTE;
+    } else if (name == "quarter") {
+        res = QUARTER;
+    } else if (name == "day") {
+        res = DAY;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,94 @@
+#ifndef TRAFFIC_SERIES_H
+#define TRAFFIC_SERIES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+
+// Cumulative byte counters for one device, as reported by the router
+struct DeviceCounters {
+    uint8_t mac[6];
+    unsigned long long rx; // Bytes received by the device (download)
+    unsigned long long tx; // Bytes sent by the device (upload)
+};
+
+// Per-device traffic history in fixed memory.
+// Each sample is turned into a byte delta and added to three ring-buffer
+// tiers at once, so coarser tiers never need a separate downsampling pass:
+//   MINUTE  - 1 minute buckets for the last hour
+//   QUARTER - 15 minute buckets for the last 24 hours
+//   DAY     - 1 day buckets for the last 30 days
+// Buckets hold KiB in 32 bits; a full table is ~24 KB of RAM.
+//
+// Too big to publish as a snapshot, so readers on other tasks check
+// writeSequence() instead: it is odd while addSample() runs, and a read is
+// good if the value was even before it and unchanged after it.
+class TrafficSeries {
+public:
+    static const int MAX_DEVICES = 16;
+
+    enum Resolution { MINUTE, QUARTER, DAY };
+
+    TrafficSeries();
+
+    void addSample(const DeviceCounters* samples, int count, uint32_t now); // now = epoch seconds
+    bool query(const uint8_t mac[6], Resolution res, uint32_t from, uint32_t to, JsonArray& target) const;
+    bool getUsage(const uint8_t mac[6], unsigned long long& rx, unsigned long long& tx) const; // Last 24 h
+    bool getRate(const uint8_t mac[6], uint32_t& rxRate, uint32_t& txRate) const; // Bytes/s
+    int deviceCount() const;
+    uint32_t version() const { return _version; } // Bumped by every sample that adds traffic
+    uint32_t writeSequence() const { return _writes.load(); }
+
+    template <typename F>
+    void forEachDevice(F f) const { // f(const uint8_t* mac)
+        for (int i = 0; i < MAX_DEVICES; i++) {
+            if (_devices[i].used) f(_devices[i].mac);
+        }
+    }
+
+    static bool parseResolution(const String& name, Resolution& res);
+
+private:
+    static const int MINUTE_SLOTS = 60;
+    static const int QUARTER_SLOTS = 96;
+    static const int DAY_SLOTS = 30;
+
+    struct Bucket {
+        uint32_t rxKiB;
+        uint32_t txKiB;
+    };
+
+    struct Device {
+        bool used;
+        uint8_t mac[6];
+        uint32_t lastSeen;
+        unsigned long long lastRx; // Previous raw counters, for deltas
+        unsigned long long lastTx;
+        uint16_t rxRemainder; // Bytes not yet folded into a whole KiB
+        uint16_t txRemainder;
+        uint32_t rxRate;
+        uint32_t txRate;
+        Bucket minute[MINUTE_SLOTS];
+        Bucket quarter[QUARTER_SLOTS];
+        Bucket day[DAY_SLOTS];
+    };
+
+    Device _devices[MAX_DEVICES];
+    uint32_t _minuteIndex;  // Absolute bucket numbers (epoch / bucket length)
+    uint32_t _quarterIndex;
+    uint32_t _dayIndex;
+    uint32_t _lastSampleTime;
+    uint32_t _version;
+    std::atomic<uint32_t> _writes;
+
+    void advance(uint32_t now);
+    Device* find(const uint8_t mac[6]);
+    const Device* find(const uint8_t mac[6]) const;
+    Device* findOrAdd(const uint8_t mac[6], uint32_t now);
+    void record(Device& device, unsigned long long rxBytes, unsigned long long txBytes);
+
+    static void addToBucket(Bucket& bucket, uint32_t rxKiB, uint32_t txKiB);
+    static void clearSlots(Bucket* slots, int count, uint32_t fromIndex, uint32_t toIndex);
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "TrafficStats.h"
+#include <Preferences.h>
+
+static const char* STATS_NAMESPACE = "traffic";
+
+TrafficStats::TrafficStats() {
+    _lastRawRx = 0;
+    _lastRawTx = 0;
+    _totalRx = 0;
+    _totalTx = 0;
+    _samples = 0;
+    _windowHead = 0;
+    _windowCount = 0;
+    _lastPersist = 0;
+    _dirty = false;
+    _version = 0;
+    _lastChangeMs = 0;
+}
+
+void TrafficStats::begin() {
+    Preferences prefs;
+    prefs.begin(STATS_NAMESPACE, true); // Read-only
+    _totalRx = prefs.getULong64("rx", 0);
+    _totalTx = prefs.getULong64("tx", 0);
+    prefs.end();
+
+    Serial.print("Restored traffic totals: rx=");
+    Serial.print((unsigned long)(_totalRx / 1024));
+    Serial.print(" KB, tx=");
+    Serial.print((unsigned long)(_totalTx / 1024));
+    Serial.println(" KB");
+}
+
+unsigned long long TrafficStats::counterDelta(unsigned long long previous, unsigned long long current) {
+    if (current >= previous) return current - previous;
+
+    // A 32-bit counter that was in its upper half and is now small wrapped;
+    // anything else going backwards is a reset and counts from zero.
+    if (previous <= 0xFFFFFFFFull && previous - current > 0x80000000ull) {
+        return (0x100000000ull - previous) + current;
+    }
+    return current;
+}
+
+void TrafficStats::addSample(unsigned long long rawRx, unsigned long long rawTx, unsigned long nowMs) {
+    if (_samples > 0) {
+        unsigned long long rxDelta = counterDelta(_lastRawRx, rawRx);
+        unsigned long long txDelta = counterDelta(_lastRawTx, rawTx);
+        if (rxDelta > 0 || txDelta > 0) {
+            _totalRx += rxDelta;
+            _totalTx += txDelta;
+            _dirty = true;
+            _lastChangeMs = nowMs;
+        }
+    }
+    // The first sample after boot only sets the baseline: whatever the
+    // router counted while we were down is not attributable.
+
+    _lastRawRx = rawRx;
+    _lastRawTx = rawTx;
+    _samples++;
+
+    Sample& slot = _window[_windowHead];
+    slot.timeMs = nowMs;
+    slot.rx = _totalRx;
+    slot.tx = _totalTx;
+    _windowHead = (_windowHead + 1) % WINDOW_SLOTS;
+    if (_windowCount < WINDOW_SLOTS) _windowCount++;
+
+    // Rates keep moving until the last change has left every window
+    if (_samples == 1 || nowMs - _lastChangeMs <= WINDOW_SPAN_MS) {
+        _version++;
+    }
+
+    persist();
+}
+
+bool TrafficStats::getRate(unsigned long windowMs, uint32_t& rxRate, uint32_t& txRate) const {
+    rxRate = 0;
+    txRate = 0;
+    if (_windowCount < 2) return false;
+
+    const Sample& newest = _window[(_windowHead - 1 + WINDOW_SLOTS) % WINDOW_SLOTS];
+
+    // Walk back to the oldest sample still inside the window
+    const Sample* oldest = nullptr;
+    for (int i = 2; i <= _windowCount; i++) {
+        const Sample& s = _window[(_windowHead - i + WINDOW_SLOTS) % WINDOW_SLOTS];
+        if (newest.timeMs - s.timeMs > windowMs) break;
+        oldest = &s;
+    }
+    if (oldest == nullptr || newest.timeMs == oldest->timeMs) return false;
+
+    unsigned long elapsedMs = newest.timeMs - oldest->timeMs;
+    rxRate = (uint32_t)((newest.rx - oldest->rx) * 1000 / elapsedMs);
+    txRate = (uint32_t)((newest.tx - oldest->tx) * 1000 / elapsedMs);
+    return true;
+}
+
+void TrafficStats::persist(bool force) {
+    if (!_dirty) return;
+    if (!force && millis() - _lastPersist < PERSIST_INTERVAL_MS) return;
+
+    Preferences prefs;
+    prefs.begin(STATS_NAMESPACE, false); // Read-write
+    prefs.putULong64("rx", _totalRx);
+    prefs.putULong64("tx", _totalTx);
+    prefs.end();
+
+    _lastPersist = millis();
+    _dirty = false;
+}
@@ -0,0 +1,56 @@
+#ifndef TRAFFIC_STATS_H
+#define TRAFFIC_STATS_H
+
+#include <Arduino.h>
+
+// Turns the router's raw interface counters into monotonic totals.
+// Raw counters reset when the router reboots or the interface restarts, and
+// wrap at 2^32 on 32-bit kernels; each sample is converted into a delta that
+// survives both, added to 64-bit totals, and the totals are saved to NVS
+// (at most every PERSIST_INTERVAL_MS) so they also survive our own reboots.
+class TrafficStats {
+public:
+    static const unsigned long PERSIST_INTERVAL_MS = 10UL * 60UL * 1000UL;
+
+    TrafficStats();
+
+    void begin(); // Restore persisted totals
+    void addSample(unsigned long long rawRx, unsigned long long rawTx, unsigned long nowMs);
+    void persist(bool force = false);
+
+    bool hasData() const { return _samples > 0; }
+    uint32_t version() const { return _version; } // Changes whenever totals or rates do
+    unsigned long long totalRx() const { return _totalRx; }
+    unsigned long long totalTx() const { return _totalTx; }
+    bool getRate(unsigned long windowMs, uint32_t& rxRate, uint32_t& txRate) const; // Bytes/s over the window
+
+    static unsigned long long counterDelta(unsigned long long previous, unsigned long long current);
+
+private:
+    static const int WINDOW_SLOTS = 16;
+    static const unsigned long WINDOW_SPAN_MS = 60000; // Longest window getRate() is asked for
+
+    struct Sample {
+        unsigned long timeMs;
+        unsigned long long rx; // Accumulated totals at this time
+        unsigned long long tx;
+    };
+
+    unsigned long long _lastRawRx;
+    unsigned long long _lastRawTx;
+    unsigned long long _totalRx;
+    unsigned long long _totalTx;
+    uint32_t _samples;
+
+    Sample _window[WINDOW_SLOTS];
+    int _windowHead;
+    int _windowCount;
+
+    unsigned long _lastPersist;
+    bool _dirty;
+
+    uint32_t _version;
+    unsigned long _lastChangeMs;
+};
+
+#endif
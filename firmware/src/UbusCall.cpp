@@ -0,0 +1,58 @@
+#include "UbusCall.h"
+
+void appendUbusCall(String& body, int id, const String& sid, const UbusMethod& call, const String& params) {
+    body += "{\"jsonrpc\":\"2.0\",\"id\":";
+    body += id;
+    body += ",\"method\":\"call\",\"params\":[\"";
+    body += sid;
+    body += call.tail;
+    if (!call.fixedParams) {
+        body += params;
+        body += "]}";
+    }
+}
+
+int ubusStatus(const String& response) {
+    int pos = response.indexOf("\"result\":[");
+    if (pos < 0) return -1;
+    const char* status = response.c_str() + pos + 10;
+    if (*status < '0' || *status > '9') return -1;
+    return atoi(status);
+}
+
+UbusBatch::UbusBatch() {
+    _count = 0;
+}
+
+bool UbusBatch::add(const UbusMethod& call, JsonDocument& params) {
+    if (_count >= MAX_CALLS) return false;
+    _calls[_count] = &call;
+    _params[_count] = "";
+    serializeJson(params, _params[_count]);
+    _count++;
+    return true;
+}
+
+bool UbusBatch::add(const UbusMethod& call) {
+    if (_count >= MAX_CALLS) return false;
+    _calls[_count] = &call;
+    _params[_count] = "";
+    _count++;
+    return true;
+}
+
+String UbusBatch::body(const String& sid) const {
+    size_t length = 2;
+    for (int i = 0; i < _count; i++) {
+        length += UBUS_ENVELOPE_BYTES + sid.length() + _calls[i]->tailLength + _params[i].length() + 1;
+    }
+    String body;
+    body.reserve(length);
+    body += '[';
+    for (int i = 0; i < _count; i++) {
+        if (i > 0) body += ',';
+        appendUbusCall(body, i + 1, sid, *_calls[i], _params[i]);
+    }
+    body += ']';
+    return body;
+}
@@ -0,0 +1,78 @@
+#ifndef UBUS_CALL_H
+#define UBUS_CALL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// A ubus method with the constant part of its JSON-RPC envelope spelled out
+// at compile time. A call goes out as
+//
+//   {"jsonrpc":"2.0","id":<id>,"method":"call","params":["<sid>" + tail + <params> ]}
+//
+// where tail is `","<object>","<method>",`, so sending one is a handful of
+// appends rather than a JsonDocument built around the params. Calls whose
+// params never change (UBUS_FIXED_CALL) carry them, and the closing `]}`,
+// in the tail as well and need no JSON work at all.
+struct UbusMethod {
+    const char* object;
+    const char* method;
+    const char* tail;
+    size_t tailLength;
+    bool fixedParams;
+};
+
+#define UBUS_TAIL(object, method) "\",\"" object "\",\"" method "\","
+
+#define UBUS_METHOD(object, method) \
+    { object, method, UBUS_TAIL(object, method), sizeof(UBUS_TAIL(object, method)) - 1, false }
+
+#define UBUS_FIXED_CALL(object, method, params) \
+    { object, method, UBUS_TAIL(object, method) params "]}", sizeof(UBUS_TAIL(object, method) params "]}") - 1, true }
+
+// Bytes around the session id and tail, ids up to 3 digits; for reserve()
+static const size_t UBUS_ENVELOPE_BYTES = 56;
+
+// Appends one call; `params` is the serialized params object, ignored for a fixed call
+void appendUbusCall(String& body, int id, const String& sid, const UbusMethod& call, const String& params);
+
+// The ubus status in result[0] of a call's response, -1 if there is none
+// (a JSON-RPC error such as an expired session). Read off the text, so it
+// survives a filter that drops result[0].
+int ubusStatus(const String& response);
+
+// A fixed read call together with the typed result it is read into.
+// `filter` keeps only the fields parse() looks at, so the response is cut
+// down as it is deserialized; UBUS_RESULT_FILTER turns a filter for
+// result[1] into one for the whole response. ArduinoJson applies an array
+// filter's first element to every element, so the status in result[0] is
+// dropped and read with ubusStatus() instead.
+#define UBUS_RESULT_FILTER(filter) "{\"result\":[" filter "]}"
+
+template <typename Result>
+struct UbusQuery {
+    const UbusMethod& call;
+    const char* filter;
+    bool (*parse)(JsonVariantConst result, Result& out); // result[1]; false if malformed
+};
+
+// Calls sent as one JSON-RPC batch, each answered with its own ubus status
+class UbusBatch {
+public:
+    static const int MAX_CALLS = 4;
+
+    UbusBatch();
+
+    bool add(const UbusMethod& call, JsonDocument& params); // false if full
+    bool add(const UbusMethod& call);                       // Fixed params
+
+    int size() const { return _count; }
+    const UbusMethod& call(int index) const { return *_calls[index]; }
+    String body(const String& sid) const; // Ids 1..size()
+
+private:
+    const UbusMethod* _calls[MAX_CALLS];
+    String _params[MAX_CALLS];
+    int _count;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "WifiLink.h"
+
+WifiLink::WifiLink() {
+    _ssid = "";
+    _password = "";
+    _state = IDLE;
+    _stateSince = 0;
+    _backoffMs = BACKOFF_MIN_MS;
+    _connectedSince = 0;
+    _attempts = 0;
+}
+
+void WifiLink::begin(const char* ssid, const char* password) {
+    _ssid = ssid;
+    _password = password;
+
+    // Retries are ours, with backoff; the driver's own reconnect would race them
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+    startAttempt(millis());
+}
+
+bool WifiLink::poll(unsigned long nowMs) {
+    switch (_state) {
+        case IDLE:
+            break;
+
+        case CONNECTING:
+            if (WiFi.status() == WL_CONNECTED) {
+                _state = CONNECTED;
+                _stateSince = nowMs;
+                _connectedSince = nowMs;
+                _backoffMs = BACKOFF_MIN_MS;
+                Serial.print("WiFi connected: ");
+                Serial.println(WiFi.localIP());
+            } else if (nowMs - _stateSince > CONNECT_TIMEOUT_MS) {
+                Serial.println("WiFi connect timed out");
+                WiFi.disconnect();
+                scheduleRetry(nowMs);
+            }
+            break;
+
+        case CONNECTED:
+            if (WiFi.status() != WL_CONNECTED) {
+                Serial.println("WiFi link lost");
+                WiFi.disconnect();
+                scheduleRetry(nowMs);
+            }
+            break;
+
+        case BACKOFF:
+            if (nowMs - _stateSince > _backoffMs) {
+                _backoffMs *= 2;
+                if (_backoffMs > BACKOFF_MAX_MS) _backoffMs = BACKOFF_MAX_MS;
+                startAttempt(nowMs);
+            }
+            break;
+    }
+    return _state == CONNECTED;
+}
+
+const char* WifiLink::stateName() const {
+    switch (_state) {
+        case CONNECTING: return "connecting";
+        case CONNECTED: return "connected";
+        case BACKOFF: return "waiting";
+        default: return "idle";
+    }
+}
+
+void WifiLink::startAttempt(unsigned long nowMs) {
+    _state = CONNECTING;
+    _stateSince = nowMs;
+    _attempts++;
+    WiFi.begin(_ssid, _password);
+}
+
+void WifiLink::scheduleRetry(unsigned long nowMs) {
+    _state = BACKOFF;
+    _stateSince = nowMs;
+    Serial.print("WiFi retry in ");
+    Serial.print(_backoffMs);
+    Serial.println(" ms");
+}
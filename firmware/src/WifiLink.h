@@ -0,0 +1,54 @@
+#ifndef WIFI_LINK_H
+#define WIFI_LINK_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Non-blocking Wi-Fi station connection, driven from loop().
+//
+//   CONNECTING --connected--> CONNECTED --link lost--> BACKOFF
+//       |                                                 ^  |
+//       +-------------- timed out ------------------------+  |
+//       ^---------------------- retry time reached ----------+
+//
+// Failed attempts wait BACKOFF_MIN_MS, doubling up to BACKOFF_MAX_MS; the
+// backoff resets once a connection succeeds. setup() never waits on Wi-Fi,
+// so the web server can answer from local state while the link comes up.
+class WifiLink {
+public:
+    static const unsigned long CONNECT_TIMEOUT_MS = 10000;
+    static const unsigned long BACKOFF_MIN_MS = 1000;
+    static const unsigned long BACKOFF_MAX_MS = 60000;
+
+    enum State {
+        IDLE,
+        CONNECTING,
+        CONNECTED,
+        BACKOFF
+    };
+
+    WifiLink();
+
+    void begin(const char* ssid, const char* password); // Starts the first attempt
+    bool poll(unsigned long nowMs); // Advances the state machine, true while connected
+
+    State state() const { return _state; }
+    const char* stateName() const;
+    bool connected() const { return _state == CONNECTED; }
+    unsigned long connectedSince() const { return _connectedSince; }
+    uint32_t attempts() const { return _attempts; } // Connection attempts since boot
+
+private:
+    const char* _ssid;
+    const char* _password;
+    State _state;
+    unsigned long _stateSince;
+    unsigned long _backoffMs;
+    unsigned long _connectedSince;
+    uint32_t _attempts;
+
+    void startAttempt(unsigned long nowMs);
+    void scheduleRetry(unsigned long nowMs);
+};
+
+#endif
@@ -4,8 +4,31 @@
 <<<<<<< HEAD
 #include <LittleFS.h>
 #include <ArduinoJson.h>
-#include "OpenWrtClient.h"
+#include "RouterGroup.h"
+#include "TrafficSeries.h"
+#include "TrafficStats.h"
+#include "DeviceTable.h"
+#include "MacAddress.h"
+#include "WifiLink.h"
+#include "DomainStore.h"
+#include "OpJournal.h"
+#include "FirewallControl.h"
+#include "Scheduler.h"
+#include "AppBundles.h"
+#include "HostsImporter.h"
+#include "DnsProxy.h"
+#include "DnsQueryLog.h"
+#include "TextTokenizer.h"
+#include "AdmissionControl.h"
+#include "SpscQueue.h"
+#include "TaskStats.h"
+#include "Snapshot.h"
+#include "TelemetryView.h"
+#include "DomainList.h"
 #include <esp_task_wdt.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
 
 // Config
 const char* ssid = "OpenWrt";
@@ -16,50 +39,531 @@ const char* router_host = "192.168.10.100";
 const char* router_user = "root";
 const char* router_pass = ""; // Default, user should change this
 
+// Mesh access points to keep in step with the router (same credentials),
+// e.g. {"192.168.10.101", "192.168.10.102", nullptr}
+const char* mesh_hosts[] = {nullptr};
+
+// Local time for schedules, as a POSIX TZ string (e.g. "CET-1CEST,M3.5.0,M10.5.0/3")
+const char* time_zone = "UTC0";
+
+// Telemetry sampling intervals
+const unsigned long STATS_POLL_INTERVAL_MS = 5000;
+const unsigned long DEVICE_POLL_INTERVAL_MS = 15000;
+const unsigned long TRAFFIC_POLL_INTERVAL_MS = 30000;
+
+// dnsmasq query log (needs logqueries=1); a busy house logs a few lines a second
+const unsigned long QUERY_LOG_POLL_INTERVAL_MS = 3000;
+const int QUERY_LOG_TAIL_LINES = 300;
+const char* QUERY_LOG_PATTERN = "dnsmasq.*(query\\[| is )";
+
+// Local state snapshots
+const char* DEVICE_SNAPSHOT_PATH = "/devices.img";
+const unsigned long DEVICE_SAVE_INTERVAL_MS = 60000;
+
+// Router edit replay
+const unsigned long JOURNAL_RETRY_INTERVAL_MS = 10000;
+const int JOURNAL_BATCH_SIZE = OpJournal::CAPACITY; // A whole app bundle in one router write
+const unsigned long ALLOWLIST_SETTLE_MS = 2000; // Quiet time before allowlist edits go out as one commit
+const unsigned long CONSISTENCY_CHECK_INTERVAL_MS = 300000; // Blocklist on each router vs ours
+
+// Bulk list imports stop here; at ~25 bytes a domain the store image stays
+// under 80 KiB, with room for the copy made while compacting
+const int IMPORT_MAX_DOMAINS = 3000;
+
+// Answer DNS on the ESP32 itself: the router hands out our address via DHCP
+// option 6, blocked names are answered locally and the rest go to the router
+const bool DNS_PROXY_ENABLED = false;
+
+// Full rebuild of the firewall table, in case the router rebooted
+const unsigned long FIREWALL_RESYNC_INTERVAL_MS = 300000;
+
+// Tasks. Wi-Fi, lwIP and async_tcp (CONFIG_ASYNC_TCP_RUNNING_CORE in
+// platformio.ini) serve requests on the PRO core; the router task and the
+// aggregate task run on the APP core, so a slow router call never holds up
+// a request and a request never holds up a router call.
+const BaseType_t WORKER_CORE = APP_CPU_NUM;
+const uint32_t ROUTER_TASK_STACK = 8192; // HTTPClient + a JsonDocument or two
+const uint32_t AGGREGATE_TASK_STACK = 4096;
+const unsigned long ROUTER_TICK_MS = 100; // Router task wake-up with nothing queued
+const unsigned long TASK_STATS_INTERVAL_MS = 5000;
+
+// Boot milestones, in ms since power-on
+struct BootTimes {
+    unsigned long stateLoaded;
+    unsigned long wifiConnected;
+    unsigned long serverStarted;
+    unsigned long firstResponse;
+};
+BootTimes bootTimes = {0, 0, 0, 0};
+
 AsyncWebServer server(80);
-OpenWrtClient router(router_host, router_user, router_pass);
+WifiLink wifiLink;
+RouterGroup router(router_host, router_user, router_pass);
+TrafficSeries trafficSeries;
+TrafficStats trafficStats;
+DeviceTable deviceTable;
+DomainStore blocklist("/blocklist"); // What the parent asked for; the router catches up via the journal
+DomainStore allowlist("/allowlist"); // Never blocked, whatever the lists say
+unsigned long lastAllowlistEdit = 0;
+AppBundles apps;
+HostsImporter importer;
+DnsProxy dnsProxy;
+DnsQueryLog queryLog;
+SemaphoreHandle_t policyLock; // blocklist, allowlist + apps: too big to snapshot, shared with the DNS proxy and router tasks
+uint32_t blocklistEdits = 0;  // Bumped under policyLock by every blocklist/app edit, for pullBlocklist()
+OpJournal journal("/journal.img");
+FirewallControl firewall("/firewall.img");
+Scheduler scheduler("/schedules.img");
+AdmissionControl admission;
 
-void setup() {
-  Serial.begin(115200);
+// Router task -> aggregate task: raw telemetry to fold into local state.
+// Pointers are owned by whoever holds the item.
+struct Telemetry {
+    enum Kind : uint8_t { INTERFACE_COUNTERS, DEVICE_COUNTERS, QUERY_LOG };
+    Kind kind;
+    unsigned long at;         // millis() for INTERFACE_COUNTERS, time() for DEVICE_COUNTERS
+    unsigned long long rx;    // INTERFACE_COUNTERS
+    unsigned long long tx;
+    int count;                // DEVICE_COUNTERS
+    DeviceCounters* devices;
+    String* text;             // QUERY_LOG
+};
 
-  // Initialize LittleFS
-  if(!LittleFS.begin(true)){
-    Serial.println("An Error has occurred while mounting LittleFS");
-    return;
-  }
+// Request handlers -> router task: device blocks, the one edit that is not journaled
+struct DeviceBlockCommand {
+    uint8_t macs[FirewallControl::MAX_BLOCKED][6];
+    uint8_t count;
+    bool blocked;
+};
 
-  // Connect to Wi-Fi
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.println("Connecting to WiFi..");
-  }
-  Serial.println(WiFi.localIP());
+SpscQueue<Telemetry, 8> telemetryQueue;
+SpscQueue<DeviceBlockCommand, 4> deviceBlockQueue;
+uint32_t telemetryDropped = 0;
+volatile bool linkUp = false; // Set by loop(), which owns Wi-Fi
+TaskHandle_t routerTask = nullptr;
+TaskHandle_t aggregateTask = nullptr;
+TaskStats taskStats;
+int routerTaskId = -1;
+int aggregateTaskId = -1;
 
-  // Increase watchdog timeout to 30 seconds to allow dnsmasq restart
-  esp_task_wdt_init(30, true);
-  esp_task_wdt_add(NULL);
+// What request handlers read of state the worker tasks own: immutable
+// copies, republished by the owning task whenever the state changes
+SnapshotCell<DeviceTable> deviceView;       // Router task
+SnapshotCell<FirewallControl> firewallView; // Router task
+SnapshotCell<TelemetryView> telemetryView;  // Aggregate task
+typedef SnapshotCell<DeviceTable>::Ref DeviceTableRef;
+typedef SnapshotCell<FirewallControl>::Ref FirewallRef;
+typedef SnapshotCell<TelemetryView>::Ref TelemetryRef;
 
+void onDeviceEvent(DeviceEvent event, const uint8_t mac[6], const char* hostname) {
+    Serial.print(event == DEVICE_JOINED ? "Device joined: " : "Device left: ");
+    Serial.print(formatMac(mac));
+    Serial.print(" ");
+    Serial.println(hostname);
+}
 
-  // API: Get Stats
-  server.on("/api/stats", HTTP_GET, [](AsyncWebServerRequest *request){
-    JsonDocument doc;
+void markFirstResponse() {
+    if (bootTimes.firstResponse != 0) return;
+    bootTimes.firstResponse = millis();
+    Serial.printf("Boot: state %lu ms, Wi-Fi %lu ms, server %lu ms, first response %lu ms\n",
+                  bootTimes.stateLoaded, bootTimes.wifiConnected, bootTimes.serverStarted, bootTimes.firstResponse);
+}
+
+// Answers 304 if the client's If-None-Match already matches the current ETag
+bool notModified(AsyncWebServerRequest *request, const String& etag) {
+    markFirstResponse();
+    if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        request->send(response);
+        return true;
+    }
+    return false;
+}
+
+// Runs `handler` only for requests admission control lets in; `limit` is
+// how many of this route's responses may be in flight at once
+ArRequestHandlerFunction guarded(const char* route, uint8_t limit, ArRequestHandlerFunction handler) {
+    int id = admission.addRoute(route, limit);
+    return [id, handler](AsyncWebServerRequest *request) {
+        if (admission.admit(request, id)) handler(request);
+    };
+}
+
+// Same for body handlers: admitted on the first chunk, later chunks follow it
+ArBodyHandlerFunction guardedBody(const char* route, uint8_t limit, ArBodyHandlerFunction handler) {
+    int id = admission.addRoute(route, limit);
+    return [id, handler](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        if (index == 0 ? admission.admit(request, id) : admission.admitted(request)) {
+            handler(request, data, len, index, total);
+        }
+    };
+}
+
+bool runNft(const String& command) {
+    return router.runCommand("/usr/sbin/nft", command);
+}
+
+// Adds blocked state, 24 h usage and current rate to device objects
+void attachDeviceUsage(JsonArray& devices, const FirewallControl& firewallState, const TelemetryView& telemetry) {
+    for (JsonObject device : devices) {
+        uint8_t mac[6];
+        if (!parseMac(device["macaddr"].as<const char*>(), mac)) continue;
+        device["blocked"] = firewallState.isBlocked(mac);
+        const TelemetryView::DeviceUsage* usage = telemetry.find(mac);
+        if (usage != nullptr) {
+            device["usage"] = router.formatBytes(usage->rx + usage->tx);
+            device["rxRate"] = usage->rxRate;
+            device["txRate"] = usage->txRate;
+        }
+    }
+}
+
+// Hands telemetry to the aggregate task; dropped if it has fallen behind
+void postTelemetry(const Telemetry& item) {
+    if (telemetryQueue.push(item)) {
+        xTaskNotifyGive(aggregateTask);
+        return;
+    }
+    telemetryDropped++;
+    delete[] item.devices;
+    delete item.text;
+}
+
+void sampleTrafficStats() {
+    Telemetry item = {};
+    if (router.getTrafficStats(item.rx, item.tx)) {
+        item.kind = Telemetry::INTERFACE_COUNTERS;
+        item.at = millis();
+        postTelemetry(item);
+    }
+}
+
+void sampleDeviceTraffic() {
+    DeviceCounters* counters = new DeviceCounters[TrafficSeries::MAX_DEVICES];
+    int count = router.getDeviceTraffic(counters, TrafficSeries::MAX_DEVICES);
+    if (count < 0) {
+        delete[] counters;
+        return;
+    }
+    Telemetry item = {};
+    item.kind = Telemetry::DEVICE_COUNTERS;
+    item.at = time(nullptr);
+    item.count = count;
+    item.devices = counters;
+    postTelemetry(item);
+}
+
+void sampleQueryLog() {
+    String* output = new String();
+    if (!router.readLog(QUERY_LOG_PATTERN, QUERY_LOG_TAIL_LINES, *output)) {
+        delete output;
+        return;
+    }
+    Telemetry item = {};
+    item.kind = Telemetry::QUERY_LOG;
+    item.text = output;
+    postTelemetry(item);
+}
+
+// Queues a blocklist edit for the router, keeping local state in step.
+// seq is the journal entry, or 0 if the router needs no change.
+bool queueBlocklistEdit(const String& domain, bool block, uint32_t& seq) {
+    seq = 0;
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    bool covered = apps.covers(domain.c_str());
+    bool changed = block ? blocklist.add(domain) : blocklist.remove(domain);
+    blocklistEdits++;
+    xSemaphoreGive(policyLock);
     
-    // Get real data from router
-    doc["connectedDevices"] = router.getConnectedDeviceCount();
+    if (!block && covered) return true; // Stays blocked by an app bundle
+    seq = journal.append(block ? OpJournal::BLOCK : OpJournal::UNBLOCK, domain);
+    if (seq == 0 && changed) {
+        // Not journaled, so the router would never get it; take it back
+        xSemaphoreTake(policyLock, portMAX_DELAY);
+        if (block) {
+            blocklist.remove(domain);
+        } else {
+            blocklist.add(domain);
+        }
+        blocklistEdits++;
+        xSemaphoreGive(policyLock);
+    }
+    return seq != 0;
+}
+
+// Queues an allowlist edit. Edits that arrive together are held for
+// ALLOWLIST_SETTLE_MS so the replay commits them to the router at once.
+bool queueAllowlistEdit(const String& domain, bool allow, uint32_t& seq) {
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    bool changed = allow ? allowlist.add(domain) : allowlist.remove(domain);
+    xSemaphoreGive(policyLock);
     
-    // Get full device list directly into the doc
-    JsonArray devicesArray = doc["devices"].to<JsonArray>();
-    router.getConnectedDevices(devicesArray);
+    lastAllowlistEdit = millis();
+    seq = journal.append(allow ? OpJournal::ALLOW : OpJournal::UNALLOW, domain);
+    if (seq == 0 && changed) {
+        xSemaphoreTake(policyLock, portMAX_DELAY); // Not journaled; take it back
+        if (allow) {
+            allowlist.remove(domain);
+        } else {
+            allowlist.add(domain);
+        }
+        xSemaphoreGive(policyLock);
+    }
+    return seq != 0;
+}
+
+// Blocks or unblocks an app bundle; only domains whose coverage changed are
+// queued, and the replay sends them to the router as one blocklist change
+bool queueAppToggle(int app, bool enabled) {
+    std::vector<String> blocked, unblocked;
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    apps.setEnabled(app, enabled, [&](const char* domain, bool block) {
+        if (block) {
+            blocked.push_back(domain);
+        } else if (!blocklist.contains(domain)) { // Else still a custom block
+            unblocked.push_back(domain);
+        }
+    });
+    blocklistEdits++;
+    xSemaphoreGive(policyLock);
+    
+    // One journal save per toggle, not one per domain
+    bool queued = true;
+    if (!blocked.empty()) queued = journal.appendAll(OpJournal::BLOCK, blocked) != 0;
+    if (!unblocked.empty()) queued = journal.appendAll(OpJournal::UNBLOCK, unblocked) != 0 && queued;
+    return queued;
+}
+
+// DNS proxy policy, called from the AsyncUDP task. A name is blocked if it
+// or a parent is blocked, unless it or a parent is allowlisted: allowing
+// www.example.com wins over a block on example.com.
+bool isDomainBlocked(const char* name) {
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    bool allowed = anyDomainSuffix(name, [](const char* domain) {
+        return allowlist.contains(domain);
+    });
+    bool blocked = !allowed && anyDomainSuffix(name, [](const char* domain) {
+        return apps.covers(domain) || blocklist.contains(domain);
+    });
+    xSemaphoreGive(policyLock);
+    return blocked;
+}
+
+// Every domain the router should block: custom entries plus enabled app bundles
+struct RouterBlocklist {
+    template <typename Emit>
+    void operator()(Emit emit) const {
+        blocklist.forEach(emit);
+        apps.forEachCovered([&](const char* domain) {
+            if (!blocklist.contains(domain)) emit(domain);
+        });
+    }
+};
+
+// RouterBlocklist() copied out under policyLock. Router writes take
+// seconds and handler edits may compact the stores meanwhile, so they walk
+// this copy instead.
+DomainList snapshotBlocklist() {
+    DomainList list;
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    size_t bytes = 0;
+    RouterBlocklist()([&](const char* domain) {
+        bytes += strlen(domain) + 1;
+    });
+    list.reserve(bytes);
+    RouterBlocklist()([&](const char* domain) {
+        list.add(domain);
+    });
+    xSemaphoreGive(policyLock);
+    return list;
+}
+
+// Same for the allowlist
+DomainList snapshotAllowlist() {
+    DomainList list;
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    size_t bytes = 0;
+    allowlist.forEach([&](const char* domain) {
+        bytes += strlen(domain) + 1;
+    });
+    list.reserve(bytes);
+    allowlist.forEach([&](const char* domain) {
+        list.add(domain);
+    });
+    xSemaphoreGive(policyLock);
+    return list;
+}
+
+// What each router's blocklist file should add up to
+BlocklistDigest expectedBlocklistDigest() {
+    BlocklistDigest digest;
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    RouterBlocklist()([&](const char* domain) {
+        digest.add(domain, strlen(domain));
+    });
+    xSemaphoreGive(policyLock);
+    return digest;
+}
+
+// Replays the oldest journal batch; false if the router did not take it
+bool replayJournal() {
+    std::vector<OpJournal::Entry> batch;
+    if (journal.nextBatch(batch, JOURNAL_BATCH_SIZE) == 0) return true;
+    
+    bool applied;
+    if (batch[0].op == OpJournal::ALLOW || batch[0].op == OpJournal::UNALLOW) {
+        if (millis() - lastAllowlistEdit < ALLOWLIST_SETTLE_MS) return true; // More may be coming
+        
+        // One uci read, then set + commit + apply for the whole run
+        JsonDocument doc;
+        JsonArray changes = doc.to<JsonArray>();
+        for (const OpJournal::Entry& entry : batch) {
+            JsonObject change = changes.add<JsonObject>();
+            change["action"] = entry.op == OpJournal::ALLOW ? "add" : "remove";
+            change["domain"] = entry.domain;
+        }
+        applied = router.applyAllowlistChanges(changes);
+    } else if (batch[0].op == OpJournal::REPLACE) {
+        if (importer.busy()) return true; // Rest of the import still to come
+        applied = router.replaceBlocklist(snapshotBlocklist());
+    } else {
+        // One read/write/restart on the router for the whole run of edits
+        JsonDocument doc;
+        JsonArray changes = doc.to<JsonArray>();
+        for (const OpJournal::Entry& entry : batch) {
+            JsonObject change = changes.add<JsonObject>();
+            change["action"] = entry.op == OpJournal::BLOCK ? "add" : "remove";
+            change["domain"] = entry.domain;
+        }
+        applied = router.applyBlocklistChanges(changes);
+    }
+    
+    if (!applied) return false;
+    journal.complete(batch.back().seq);
+    return true;
+}
+
+// Adopts the router's blocklist as local state; only safe with nothing queued.
+// An edit that lands while the file is being fetched (its journal entry is
+// appended after policyLock is given back) would otherwise be undone, so
+// the edit count is compared again under the lock before anything changes.
+void pullBlocklist() {
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    uint32_t edits = blocklistEdits;
+    xSemaphoreGive(policyLock);
+    if (!journal.empty()) return;
+    
+    String content;
+    if (!router.getBlocklist(content)) return;
+    
+    // Lines stay in `content`; only domains new to us get copied out
+    std::vector<TextSpan> remote;
+    LineReader lines(content.c_str(), content.length());
+    TextSpan line;
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (!line.empty()) {
+            remote.push_back(line);
+        }
+    }
+    // Sorted before policyLock is taken, so each lookup under it is a
+    // binary search rather than a walk of the whole file
+    std::sort(remote.begin(), remote.end());
+    auto inRemote = [&](const char* domain) {
+        size_t len = strlen(domain);
+        auto it = std::lower_bound(remote.begin(), remote.end(), TextSpan(domain, len));
+        return it != remote.end() && it->equals(domain, len);
+    };
+    
+    xSemaphoreTake(policyLock, portMAX_DELAY);
+    if (blocklistEdits != edits || !journal.empty()) {
+        xSemaphoreGive(policyLock); // Edited meanwhile; the next warm-up tries again
+        return;
+    }
+    // A custom entry an app also covers stays custom even if the router lost
+    // it: the app puts it back below, and turning the app off must not drop it
+    std::vector<String> stale;
+    blocklist.forEach([&](const char* domain) {
+        if (!inRemote(domain) && !apps.covers(domain)) {
+            stale.push_back(domain);
+        }
+    });
+    for (const String& domain : stale) {
+        blocklist.remove(domain);
+    }
+    // Router entries an app covers can't be told apart from the app's own;
+    // adopting them would keep them blocked once the app is turned off
+    for (const TextSpan& entry : remote) {
+        String domain;
+        domain.concat(entry.data, entry.len);
+        if (!apps.covers(domain.c_str())) {
+            blocklist.add(domain); // No-op if present
+        }
+    }
+    // App bundles are ours to keep; put back anything the router lost
+    std::vector<String> lost;
+    apps.forEachCovered([&](const char* domain) {
+        if (!inRemote(domain)) {
+            lost.push_back(domain);
+        }
+    });
+    xSemaphoreGive(policyLock);
+    
+    if (!lost.empty()) journal.appendAll(OpJournal::BLOCK, lost);
+}
+
+// First round of router calls after the link comes up, so the session and
+// telemetry are ready before a client asks instead of on its first request
+void warmRouter() {
+    if (!router.checkSession()) return;
+    firewall.install();
+    // A stale node's file may lack writes the others took, and those are
+    // no longer journaled; our list stands until resyncStale() pushes it
+    if (router.staleCount() == 0) pullBlocklist();
+    
+    // Once per boot: our address may have changed since the last one
+    static bool dnsAdvertised = false;
+    if (dnsProxy.running() && !dnsAdvertised) {
+        dnsAdvertised = router.advertiseDnsServer(WiFi.localIP().toString());
+    }
+    sampleTrafficStats();
+    router.syncDevices(deviceTable, time(nullptr));
+    sampleDeviceTraffic();
+}
+
+// Body of /api/stats, from snapshots of what the router and aggregate tasks keep up to date
+String buildStatsJson(const String& since, const DeviceTable& devices, const FirewallControl& firewallState,
+                      const TelemetryView& telemetry) {
+    JsonDocument doc;
+    doc["connectedDevices"] = devices.onlineCount();
+    
+    // ?since=<deviceVersion> swaps the device list for a delta
+    if (since.length() > 0) {
+        JsonObject delta = doc["deviceDelta"].to<JsonObject>();
+        devices.toJsonDelta(delta, since.toInt());
+        JsonArray devicesArray = delta["devices"];
+        attachDeviceUsage(devicesArray, firewallState, telemetry);
+    } else {
+        JsonArray devicesArray = doc["devices"].to<JsonArray>();
+        devices.toJson(devicesArray);
+        attachDeviceUsage(devicesArray, firewallState, telemetry);
+    }
     
     String total, down, up;
-    unsigned long long rx = 0, tx = 0;
     
-    // Get raw stats (Single Request)
-    if(router.getTrafficStats(rx, tx)) {
+    // Traffic totals are precomputed by the aggregate task and never go backwards
+    if(telemetry.hasData) {
+        unsigned long long rx = telemetry.totalRx;
+        unsigned long long tx = telemetry.totalTx;
         doc["traffic"]["rx"] = rx;
         doc["traffic"]["tx"] = tx;
         
+        doc["traffic"]["rxRate"] = telemetry.rxRate;
+        doc["traffic"]["txRate"] = telemetry.txRate;
+        doc["traffic"]["rxRate60"] = telemetry.rxRate60;
+        doc["traffic"]["txRate60"] = telemetry.txRate60;
+        
         // Format for display using the public helper
         down = router.formatBytes(tx); // TX from router is Download for client
         up = router.formatBytes(rx);   // RX to router is Upload from client
@@ -74,12 +578,285 @@ void setup() {
     doc["dataUsage"]["download"] = down;
     doc["dataUsage"]["upload"] = up;
     
+    String response;
+    serializeJson(doc, response);
+    return response;
+}
+
+// Everything that talks to the router, on its own schedule; called from the
+// router task while the link is up
+void runRouterJobs() {
+    // Replay router edits queued while it was unreachable
+    static unsigned long lastJournalFailure = 0;
+    if (!journal.empty() && (lastJournalFailure == 0 || millis() - lastJournalFailure > JOURNAL_RETRY_INTERVAL_MS)) {
+        lastJournalFailure = replayJournal() ? 0 : millis();
+    }
+    
+    // Bring routers that missed a write back in step, then check now and
+    // then that they still are (only with nothing queued, or they'd differ)
+    static unsigned long lastResync = 0;
+    if (router.staleCount() > 0 && millis() - lastResync > JOURNAL_RETRY_INTERVAL_MS) {
+        lastResync = millis();
+        router.resyncStale(snapshotBlocklist(), snapshotAllowlist());
+    }
+    static unsigned long lastConsistencyCheck = 0;
+    if (journal.empty() && millis() - lastConsistencyCheck > CONSISTENCY_CHECK_INTERVAL_MS) {
+        lastConsistencyCheck = millis();
+        router.checkConsistency(expectedBlocklistDigest());
+    }
+    
+    // Schedule transitions: every rule that flipped this minute, in one router call
+    static_assert(Scheduler::MAX_BLOCKED <= FirewallControl::MAX_SCHEDULED, "scheduled set too small for the Scheduler");
+    static uint8_t scheduledMacs[Scheduler::MAX_BLOCKED][6];
+    int scheduledCount = 0;
+    if (scheduler.takeUpdate(scheduledMacs, scheduledCount)) {
+        firewall.setScheduled(scheduledMacs, scheduledCount);
+    }
+    
+    // Rebuild the firewall table now and then, or after a failed update
+    static unsigned long lastFirewallSync = 0;
+    if (millis() - lastFirewallSync > FIREWALL_RESYNC_INTERVAL_MS) {
+        lastFirewallSync = millis();
+        firewall.install();
+    } else if (!firewall.installed() && millis() - lastFirewallSync > JOURNAL_RETRY_INTERVAL_MS) {
+        lastFirewallSync = millis();
+        firewall.sync();
+    }
+    
+    // Keep session alive
+    static unsigned long lastCheck = 0;
+    if (millis() - lastCheck > 60000) {
+        lastCheck = millis();
+        router.checkSession();
+    }
+    
+    // Sample interface counters for the monotonic totals and rates
+    static unsigned long lastStatsPoll = 0;
+    if (millis() - lastStatsPoll > STATS_POLL_INTERVAL_MS) {
+        lastStatsPoll = millis();
+        sampleTrafficStats();
+    }
+    
+    // Diff DHCP leases into the device table
+    static unsigned long lastDevicePoll = 0;
+    if (millis() - lastDevicePoll > DEVICE_POLL_INTERVAL_MS) {
+        lastDevicePoll = millis();
+        router.syncDevices(deviceTable, time(nullptr));
+    }
+    
+    // Sample per-device counters for the usage history
+    static unsigned long lastTrafficPoll = 0;
+    if (millis() - lastTrafficPoll > TRAFFIC_POLL_INTERVAL_MS) {
+        lastTrafficPoll = millis();
+        sampleDeviceTraffic();
+    }
+    
+    // Tail the dnsmasq query log for the aggregate task
+    static unsigned long lastQueryLogPoll = 0;
+    if (millis() - lastQueryLogPoll > QUERY_LOG_POLL_INTERVAL_MS) {
+        lastQueryLogPoll = millis();
+        sampleQueryLog();
+    }
+}
+
+// Republishes the device table and firewall state for request handlers when
+// they changed. Copies are ~3 KB and ~1 KB; devices change every 15 s at most.
+void publishRouterViews() {
+    DeviceTableRef devices = deviceView.acquire();
+    if (!devices || devices->version() != deviceTable.version()) {
+        deviceView.publish(deviceTable);
+    }
+    FirewallRef firewallState = firewallView.acquire();
+    if (!firewallState || firewallState->version() != firewall.version() ||
+        firewallState->installed() != firewall.installed()) {
+        firewallView.publish(firewall);
+    }
+}
+
+// The only task that calls into `router` (which fans calls out to its own
+// per-node tasks), so router calls never interleave and a slow one only
+// delays the next router call. Woken early by device blocks.
+void routerTaskMain(void* arg) {
+    esp_task_wdt_add(NULL); // Same 30 s as loop(), enough for a dnsmasq restart
+    bool routerWarm = false;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ROUTER_TICK_MS));
+        esp_task_wdt_reset();
+        unsigned long started = micros();
+        
+        // Device blocks: kept locally either way, the router side is retried by the resync
+        DeviceBlockCommand command;
+        while (deviceBlockQueue.pop(command)) {
+            firewall.setDevicesBlocked(command.macs, command.count, command.blocked);
+        }
+        
+        // Everything below talks to the router; wait for the link, then warm up
+        if (!linkUp) {
+            routerWarm = false;
+        } else {
+            if (!routerWarm) {
+                routerWarm = true;
+                if (bootTimes.wifiConnected == 0) {
+                    bootTimes.wifiConnected = millis();
+                    configTzTime(time_zone, "pool.ntp.org", "time.google.com"); // SNTP keeps it synced from here
+                }
+                if (DNS_PROXY_ENABLED && !dnsProxy.running()) {
+                    IPAddress upstream;
+                    upstream.fromString(router_host);
+                    dnsProxy.begin(upstream, isDomainBlocked);
+                }
+                warmRouter();
+            }
+            runRouterJobs();
+        }
+        publishRouterViews();
+        taskStats.busy(routerTaskId, micros() - started);
+    }
+}
+
+// Folds telemetry into local state, so parsing a log tail or rolling up a
+// sample never delays the next router call. Also snapshots the device table.
+void aggregateTaskMain(void* arg) {
+    esp_task_wdt_add(NULL);
+    uint32_t savedDeviceVersion = 0;
+    unsigned long lastDeviceSave = 0;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        esp_task_wdt_reset();
+        unsigned long started = micros();
+        
+        Telemetry item;
+        bool trafficChanged = false;
+        while (telemetryQueue.pop(item)) {
+            switch (item.kind) {
+                case Telemetry::INTERFACE_COUNTERS:
+                    trafficStats.addSample(item.rx, item.tx, item.at);
+                    trafficChanged = true;
+                    break;
+                case Telemetry::DEVICE_COUNTERS:
+                    trafficSeries.addSample(item.devices, item.count, item.at);
+                    trafficChanged = true;
+                    delete[] item.devices;
+                    break;
+                case Telemetry::QUERY_LOG:
+                    queryLog.ingest(*item.text);
+                    delete item.text;
+                    break;
+            }
+        }
+        if (trafficChanged) {
+            TelemetryView view;
+            view.capture(trafficStats, trafficSeries);
+            telemetryView.publish(view);
+        }
+        
+        // Save the device table when it changed, at most once a minute; the
+        // published copy, since the router task may be updating the table
+        DeviceTableRef devices = deviceView.acquire();
+        if (devices->version() != savedDeviceVersion && millis() - lastDeviceSave > DEVICE_SAVE_INTERVAL_MS) {
+            lastDeviceSave = millis();
+            if (devices->save(DEVICE_SNAPSHOT_PATH)) {
+                savedDeviceVersion = devices->version();
+            }
+        }
+        taskStats.busy(aggregateTaskId, micros() - started);
+    }
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  // Initialize LittleFS
+  if(!LittleFS.begin(true)){
+    Serial.println("An Error has occurred while mounting LittleFS");
+    return;
+  }
+
+  // Restore local state so the API can answer before the router is reachable
+  policyLock = xSemaphoreCreateMutex();
+  queryLog.begin();
+  trafficStats.begin();
+  blocklist.begin();
+  allowlist.begin();
+  apps.begin();
+  journal.begin();
+  firewall.begin(runNft);
+  scheduler.begin(WORKER_CORE);
+  deviceTable.load(DEVICE_SNAPSHOT_PATH);
+  deviceTable.onEvent(onDeviceEvent);
+  TelemetryView telemetry;
+  telemetry.capture(trafficStats, trafficSeries);
+  telemetryView.publish(telemetry);
+  publishRouterViews(); // Before the router task starts; it republishes from here on
+  bootTimes.stateLoaded = millis();
+
+  // Start connecting; loop() finishes the job while the server is already up
+  wifiLink.begin(ssid, password);
+
+  // Increase watchdog timeout to 30 seconds to allow dnsmasq restart
+  esp_task_wdt_init(30, true);
+  esp_task_wdt_add(NULL);
+
+  // Router I/O and aggregation on the worker core; loop() keeps Wi-Fi
+  for (int i = 0; mesh_hosts[i] != nullptr; i++) {
+    router.addNode(mesh_hosts[i]);
+  }
+  router.begin(WORKER_CORE);
+  xTaskCreatePinnedToCore(aggregateTaskMain, "aggregate", AGGREGATE_TASK_STACK, nullptr, 1, &aggregateTask, WORKER_CORE);
+  xTaskCreatePinnedToCore(routerTaskMain, "router", ROUTER_TASK_STACK, nullptr, 2, &routerTask, WORKER_CORE);
+  routerTaskId = taskStats.add("router", routerTask);
+  aggregateTaskId = taskStats.add("aggregate", aggregateTask);
+  taskStats.track("loopTask");
+  taskStats.track("scheduler");
+  taskStats.track("async_tcp"); // Started by server.begin()
+  if (DNS_PROXY_ENABLED) taskStats.track("async_udp");
+
+
+  // API: Get Stats
+  server.on("/api/stats", HTTP_GET, guarded("/api/stats", 2, [](AsyncWebServerRequest *request){
+    // Everything below is precomputed by the worker tasks; the versions say whether it changed
+    DeviceTableRef devices = deviceView.acquire();
+    FirewallRef firewallState = firewallView.acquire();
+    TelemetryRef telemetry = telemetryView.acquire();
+    String etag = "\"s" + String(devices->version()) + "-" + String(telemetry->statsVersion) +
+                  "-" + String(telemetry->seriesVersion) + "-" + String(firewallState->version()) + "\"";
+    if (notModified(request, etag)) return;
+    
+    // Dashboards polling together share one body while it is being sent
+    String since = request->hasParam("since") ? request->getParam("since")->value() : "";
+    admission.sendShared(request, AdmissionControl::key(etag + since), etag, [&]() {
+        return buildStatsJson(since, *devices, *firewallState, *telemetry);
+    });
+  }));
+
+  // API: Device list (full, or a delta with ?since=<version>)
+  server.on("/api/devices", HTTP_GET, guarded("/api/devices", 2, [](AsyncWebServerRequest *request){
+    DeviceTableRef devices = deviceView.acquire();
+    String etag = "\"d" + String(devices->version()) + "\"";
+    if (notModified(request, etag)) return;
+    
+    uint32_t since = request->hasParam("since") ? request->getParam("since")->value().toInt() : 0;
+    admission.sendShared(request, AdmissionControl::key(etag + since), etag, [&]() {
+        JsonDocument doc;
+        JsonObject delta = doc.to<JsonObject>();
+        devices->toJsonDelta(delta, since);
+        
+        String response;
+        serializeJson(doc, response);
+        return response;
+    });
+  }));
 =======
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include <Preferences.h>
+#include <memory>
 
 #include "openwrt.h"
+#include "AdblockLogTail.h"
+#include "DomainStore.h"
+#include "FirewallControl.h"
+#include "AppBundles.h"
 
 // Configuration - Update these with your actual credentials
 const char* ssid = "YOUR_WIFI_SSID";
@@ -91,120 +868,173 @@ const char* routerPass = "password";       // OpenWRT Password
 // Set to true for testing without a router, false for production
 #define SIMULATION_MODE false 
 
+// Adblock log tailing: how often to poll and how many syslog lines to read
+const unsigned long LOG_POLL_INTERVAL_MS = 5000;
+const int LOG_TAIL_LINES = 200;
+
 AsyncWebServer server(80);
 Preferences preferences;
 OpenWRTClient router(routerHost, routerUser, routerPass);
+AdblockLogTail adblockLogs;
 
-// Blocklist storage
-const int MAX_BLOCKED_DOMAINS = 50;
-String blockedDomains[MAX_BLOCKED_DOMAINS];
-int blockedDomainsCount = 0;
+// Blocklist storage (append-only log + snapshot on LittleFS)
+DomainStore blocklist("/blocklist");
+DomainStore allowlist("/allowlist");
+AppBundles apps;
 
-// Load blocklist from Preferences
-void loadBlocklist() {
-  preferences.begin("blocklist", true); // Read-only
-  blockedDomainsCount = preferences.getInt("count", 0);
-  
-  for (int i = 0; i < blockedDomainsCount && i < MAX_BLOCKED_DOMAINS; i++) {
-    String key = "domain" + String(i);
-    blockedDomains[i] = preferences.getString(key.c_str(), "");
-  }
-  
-  preferences.end();
-  Serial.print("Loaded ");
-  Serial.print(blockedDomainsCount);
-  Serial.println(" blocked domains");
+// Internet blocking via nftables sets on the router
+FirewallControl firewall("/firewall.img");
+const unsigned long FIREWALL_RESYNC_INTERVAL_MS = 300000;
+
+bool runNft(const String& command) {
+  return router.runCommand("/usr/sbin/nft", command);
 }
 
-// Save blocklist to Preferences
-void saveBlocklist() {
-  preferences.begin("blocklist", false); // Read-write
-  preferences.putInt("count", blockedDomainsCount);
+// One-time import of the old per-key NVS blocklist into the store
+void migrateBlocklist() {
+  preferences.begin("blocklist", false);
+  int count = preferences.getInt("count", 0);
   
-  for (int i = 0; i < blockedDomainsCount; i++) {
+  for (int i = 0; i < count; i++) {
     String key = "domain" + String(i);
-    preferences.putString(key.c_str(), blockedDomains[i]);
+    String domain = preferences.getString(key.c_str(), "");
+    if (domain.length() > 0) {
+      blocklist.add(domain);
+    }
   }
   
+  if (count > 0) {
+    preferences.clear();
+    Serial.print("Migrated ");
+    Serial.print(count);
+    Serial.println(" blocked domains from NVS");
+  }
   preferences.end();
-  Serial.print("Saved ");
-  Serial.print(blockedDomainsCount);
-  Serial.println(" blocked domains");
 }
 
 // Add domain to blocklist
 bool addBlockedDomain(String domain) {
-  // Check if already exists
-  for (int i = 0; i < blockedDomainsCount; i++) {
-    if (blockedDomains[i] == domain) {
-      Serial.println("Domain already blocked: " + domain);
-      return false;
-    }
+  if (blocklist.contains(domain)) {
+    Serial.println("Domain already blocked: " + domain);
+    return false;
   }
   
-  // Add to array
-  if (blockedDomainsCount < MAX_BLOCKED_DOMAINS) {
-    blockedDomains[blockedDomainsCount] = domain;
-    blockedDomainsCount++;
-    saveBlocklist();
-    
-    // Add to OpenWRT
-    if (router.blockDomain(domain)) {
-      Serial.println("Domain added and blocked: " + domain);
-      return true;
-    } else {
-      // Rollback if OpenWRT fails
-      blockedDomainsCount--;
-      saveBlocklist();
-      Serial.println("Failed to block domain on router: " + domain);
-      return false;
-    }
+  if (!blocklist.add(domain)) {
+    Serial.println("Failed to store domain: " + domain);
+    return false;
+  }
+  
+  // Add to OpenWRT
+  if (router.blockDomain(domain)) {
+    Serial.println("Domain added and blocked: " + domain);
+    return true;
   }
   
-  Serial.println("Blocklist full!");
+  // Rollback if OpenWRT fails
+  blocklist.remove(domain);
+  Serial.println("Failed to block domain on router: " + domain);
   return false;
 }
 
 // Remove domain from blocklist
 bool removeBlockedDomain(String domain) {
-  for (int i = 0; i < blockedDomainsCount; i++) {
-    if (blockedDomains[i] == domain) {
-      // Shift array left
-      for (int j = i; j < blockedDomainsCount - 1; j++) {
-        blockedDomains[j] = blockedDomains[j + 1];
-      }
-      blockedDomainsCount--;
-      saveBlocklist();
-      
-      // Remove from OpenWRT
-      router.unblockDomain(domain);
-      
-      Serial.println("Domain removed: " + domain);
-      return true;
-    }
+  if (!blocklist.remove(domain)) {
+    Serial.println("Domain not found: " + domain);
+    return false;
   }
   
-  Serial.println("Domain not found: " + domain);
+  // Remove from OpenWRT, unless an app bundle still blocks it
+  if (!apps.covers(domain.c_str())) {
+    router.unblockDomain(domain);
+  }
+  
+  Serial.println("Domain removed: " + domain);
+  return true;
+}
+
+// Block or unblock an app bundle; only domains whose coverage changed go to the router
+bool setAppBlocked(int app, bool enabled) {
+  std::vector<String> add, remove;
+  apps.setEnabled(app, enabled, [&](const char* domain, bool blocked) {
+    if (blocked) {
+      add.push_back(domain);
+    } else if (!blocklist.contains(domain)) {
+      remove.push_back(domain);
+    }
+  });
+  if (SIMULATION_MODE || (add.empty() && remove.empty())) return true;
+  
+  if (router.applyHostsChanges(add, remove)) return true;
+  
+  // Rollback if OpenWRT fails
+  apps.setEnabled(app, !enabled, [](const char* domain, bool blocked) {});
+  Serial.println("Failed to update app bundle on router: " + String(apps.name(app)));
   return false;
 }
 
 // Get blocklist as JSON array
 String getBlocklistJSON() {
-  DynamicJsonDocument doc(2048);
+  DynamicJsonDocument doc(512 + blocklist.size() * 96);
+  JsonObject appsObj = doc.createNestedObject("apps");
+  apps.toJson(appsObj);
   JsonArray customArray = doc.createNestedArray("custom");
   
-  for (int i = 0; i < blockedDomainsCount; i++) {
+  int id = 1;
+  blocklist.forEach([&](const char* domain) {
     JsonObject domainObj = customArray.createNestedObject();
-    domainObj["id"] = i + 1;
-    domainObj["domain"] = blockedDomains[i];
+    domainObj["id"] = id++;
+    domainObj["domain"] = domain;
     domainObj["active"] = true;
-  }
+  });
+  
+  String response;
+  serializeJson(doc, response);
+  return response;
+}
+
+// Get allowlist as JSON array
+String getAllowlistJSON() {
+  DynamicJsonDocument doc(256 + allowlist.size() * 96);
+  JsonArray array = doc.to<JsonArray>();
+  
+  int id = 1;
+  allowlist.forEach([&](const char* domain) {
+    JsonObject domainObj = array.createNestedObject();
+    domainObj["id"] = id++;
+    domainObj["domain"] = domain;
+    domainObj["active"] = true;
+  });
   
   String response;
   serializeJson(doc, response);
   return response;
 }
 
+// Allow or unallow several domains; the router gets one commit for all of them
+bool setAllowed(const std::vector<String>& domains, bool allowed) {
+  std::vector<String> changed;
+  for (const String& domain : domains) {
+    if (allowed ? allowlist.add(domain) : allowlist.remove(domain)) {
+      changed.push_back(domain);
+    }
+  }
+  if (SIMULATION_MODE || changed.empty()) return true;
+  
+  std::vector<String> none;
+  if (router.applyAllowlistChanges(allowed ? changed : none, allowed ? none : changed)) return true;
+  
+  // Rollback if OpenWRT fails
+  for (const String& domain : changed) {
+    if (allowed) {
+      allowlist.remove(domain);
+    } else {
+      allowlist.add(domain);
+    }
+  }
+  Serial.println("Failed to update allowlist on router");
+  return false;
+}
+
 struct Device {
   int id;
   String name;
@@ -235,21 +1065,25 @@ void setupRoutes() {
   server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request){
     DynamicJsonDocument doc(1024);
     doc["internet_active"] = internetActive;
->>>>>>> e2fc66cd8c03be46ac1e8eb273be9970ba1bd19a
     String response;
     serializeJson(doc, response);
     request->send(200, "application/json", response);
   });
+>>>>>>> e2fc66cd8c03be46ac1e8eb273be9970ba1bd19a
 
 <<<<<<< HEAD
   // API: Block Domain
+  // Edits are acknowledged from local state; the journal delivers them to the router
   server.on("/api/block", HTTP_POST, [](AsyncWebServerRequest *request){
     if(request->hasParam("domain", true)){
         String domain = request->getParam("domain", true)->value();
-        if(router.blockDomain(domain.c_str())){
-            request->send(200, "text/plain", "Blocked");
+        uint32_t seq;
+        if(queueBlocklistEdit(domain, true, seq)){
+            AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Blocked");
+            response->addHeader("X-Op-Seq", String(seq));
+            request->send(response);
         } else {
-            request->send(500, "text/plain", "Failed to block");
+            request->send(503, "text/plain", "Failed to queue block");
         }
     } else {
         request->send(400, "text/plain", "Missing domain param");
@@ -260,47 +1094,99 @@ void setupRoutes() {
   server.on("/api/blocklist/custom", HTTP_DELETE, [](AsyncWebServerRequest *request){
     if(request->hasParam("domain")){
         String domain = request->getParam("domain")->value();
-        if(router.unblockDomain(domain.c_str())){
-            request->send(200, "text/plain", "Unblocked");
+        uint32_t seq;
+        if(queueBlocklistEdit(domain, false, seq)){
+            AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Unblocked");
+            response->addHeader("X-Op-Seq", String(seq));
+            request->send(response);
         } else {
-            request->send(500, "text/plain", "Failed to unblock");
+            request->send(503, "text/plain", "Failed to queue unblock");
         }
     } else {
         request->send(400, "text/plain", "Missing domain param");
     }
   });
 
-  // API: Get Custom Blocklist
-  server.on("/api/blocklist/custom", HTTP_GET, [](AsyncWebServerRequest *request){
-    String blocklist = router.getBlocklist();
-    if (blocklist.length() > 0) {
-      // Parse blocklist and return as JSON array
-      JsonDocument doc;
-      JsonArray array = doc["blocklist"].to<JsonArray>();
-      
-      int startPos = 0;
-      int newlinePos = 0;
-      while ((newlinePos = blocklist.indexOf('\n', startPos)) != -1) {
-        String line = blocklist.substring(startPos, newlinePos);
-        line.trim();
-        if (line.length() > 0) {
-          array.add(line);
+  // API: Get Custom Blocklist (local state, including edits not yet on the router)
+  server.on("/api/blocklist/custom", HTTP_GET, guarded("/api/blocklist/custom", 2, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonArray array = doc["blocklist"].to<JsonArray>();
+    xSemaphoreTake(policyLock, portMAX_DELAY); // pullBlocklist() edits it from the router task
+    blocklist.forEach([&](const char* domain) {
+        array.add(domain);
+    });
+    xSemaphoreGive(policyLock);
+    doc["pending"] = journal.size();
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  }));
+
+
+  // API: Import a hosts file / domain list, streamed (send as text/plain)
+  server.on("/api/blocklist/import", HTTP_POST, [](AsyncWebServerRequest *request){
+    if (request->contentLength() == 0) {
+      request->send(400, "text/plain", "Empty list");
+    }
+  }, NULL, 
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+      static AsyncWebServerRequest* importRequest = nullptr;
+      static bool replaceQueued = false;
+      if (index == 0) {
+        if (!importer.begin(&blocklist, IMPORT_MAX_DOMAINS)) {
+          request->send(409, "text/plain", "Import already running");
+          return;
         }
-        startPos = newlinePos + 1;
+        importRequest = request;
+        replaceQueued = false;
+      }
+      if (request != importRequest) return; // Rest of a rejected upload
+      
+      xSemaphoreTake(policyLock, portMAX_DELAY);
+      importer.feed(data, len);
+      bool last = index + len >= total;
+      bool ok = !last || importer.finish();
+      blocklistEdits++;
+      xSemaphoreGive(policyLock);
+      if (importer.compactDue()) {
+        blocklist.compact(policyLock); // Flash write without the lock DNS lookups wait on
+      }
+      
+      // Too many for single edits. Queued with the first domains in rather
+      // than at the end, which an abandoned upload never reaches; the replay
+      // holds it until the import is over.
+      if (!replaceQueued && importer.added() > 0) {
+        replaceQueued = journal.append(OpJournal::REPLACE, "") != 0;
       }
+      if (!last) return;
+      
+      importRequest = nullptr;
+      ok = ok && (replaceQueued || importer.added() == 0);
+      
+      JsonDocument doc;
+      JsonObject stats = doc.to<JsonObject>();
+      importer.toJson(stats);
       
       String response;
       serializeJson(doc, response);
-      request->send(200, "application/json", response);
-    } else {
-      request->send(200, "application/json", "{\"blocklist\":[]}");
-    }
+      request->send(ok ? 200 : 500, "application/json", response);
   });
 
+  // API: Last import's counts and throughput
+  server.on("/api/blocklist/import", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonObject stats = doc.to<JsonObject>();
+    importer.toJson(stats);
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
 
   // API: Apply Blocklist Changes (Batch)
   server.on("/api/blocklist/apply", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL, 
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+    guardedBody("/api/blocklist/apply", 1, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
       JsonDocument doc;
       deserializeJson(doc, (const char*)data);
       
@@ -310,41 +1196,383 @@ void setupRoutes() {
       }
       
       JsonArray changes = doc["changes"];
-      bool success = router.applyBlocklistChanges(changes);
+      uint32_t lastSeq = 0;
+      bool success = true;
+      for (JsonVariant change : changes) {
+        String action = change["action"].as<String>();
+        String domain = change["domain"].as<String>();
+        bool block = action == "add" || action == "enable";
+        if (!block && action != "remove" && action != "disable") continue;
+        
+        uint32_t seq;
+        success = queueBlocklistEdit(domain, block, seq) && success;
+        if (seq != 0) lastSeq = seq;
+      }
       
       if(success){
-        request->send(200, "text/plain", "Changes applied");
+        AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Changes applied");
+        response->addHeader("X-Op-Seq", String(lastSeq));
+        request->send(response);
       } else {
-        request->send(500, "text/plain", "Failed to apply changes");
+        request->send(503, "text/plain", "Failed to queue changes");
       }
+  }));
+
+  // API: App bundles ({"youtube": true, ...})
+  server.on("/api/blocklist/app", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonObject state = doc.to<JsonObject>();
+    apps.toJson(state);
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
   });
 
+  // Body: {"id": "youtube"} toggles, or add "blocked": true/false to set it
+  server.on("/api/blocklist/app", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL, 
+    guardedBody("/api/blocklist/app", 1, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+      JsonDocument doc;
+      deserializeJson(doc, (const char*)data, len);
+      
+      int app = apps.find(doc["id"] | "");
+      if (app < 0) {
+        request->send(404, "text/plain", "Unknown app");
+        return;
+      }
+      
+      bool enabled = doc["blocked"].is<bool>() ? doc["blocked"].as<bool>() : !apps.isEnabled(app);
+      if (!queueAppToggle(app, enabled)) {
+        request->send(503, "text/plain", "Failed to queue app change");
+        return;
+      }
+      
+      JsonDocument result;
+      JsonObject state = result.to<JsonObject>();
+      apps.toJson(state);
+      
+      String response;
+      serializeJson(result, response);
+      request->send(200, "application/json", response);
+  }));
+
   // API: Allow Domain
   server.on("/api/allow", HTTP_POST, [](AsyncWebServerRequest *request){
     if(request->hasParam("domain", true)){
         String domain = request->getParam("domain", true)->value();
-        if(router.allowDomain(domain.c_str())){
-            request->send(200, "text/plain", "Allowed");
+        uint32_t seq;
+        if(queueAllowlistEdit(domain, true, seq)){
+            AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Allowed");
+            response->addHeader("X-Op-Seq", String(seq));
+            request->send(response);
         } else {
-            request->send(500, "text/plain", "Failed to allow");
+            request->send(503, "text/plain", "Failed to queue allow");
         }
     } else {
         request->send(400, "text/plain", "Missing domain param");
     }
   });
 
+  // API: Remove Domain from the allowlist
+  server.on("/api/allow", HTTP_DELETE, [](AsyncWebServerRequest *request){
+    if(request->hasParam("domain")){
+        String domain = request->getParam("domain")->value();
+        uint32_t seq;
+        if(queueAllowlistEdit(domain, false, seq)){
+            AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", "Unallowed");
+            response->addHeader("X-Op-Seq", String(seq));
+            request->send(response);
+        } else {
+            request->send(503, "text/plain", "Failed to queue unallow");
+        }
+    } else {
+        request->send(400, "text/plain", "Missing domain param");
+    }
+  });
+
+  // API: Get Allowlist (local state, including edits not yet on the router)
+  server.on("/api/allowlist", HTTP_GET, guarded("/api/allowlist", 2, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonArray array = doc["allowlist"].to<JsonArray>();
+    allowlist.forEach([&](const char* domain) {
+        array.add(domain);
+    });
+    doc["pending"] = journal.size();
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  }));
+
+  // API: Allow or unallow several domains, committed on the router together
+  // Body: {"domains": ["example.com", ...], "allowed": true}
+  server.on("/api/allowlist", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL,
+    guardedBody("/api/allowlist", 1, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+      JsonDocument doc;
+      deserializeJson(doc, (const char*)data, len);
+      
+      if(!doc["domains"].is<JsonArray>()){
+        request->send(400, "text/plain", "Invalid allowlist request");
+        return;
+      }
+      
+      bool allow = doc["allowed"] | true;
+      uint32_t seq = 0;
+      bool queued = true;
+      for (JsonVariant domain : doc["domains"].as<JsonArray>()) {
+        queued = queueAllowlistEdit(domain.as<String>(), allow, seq) && queued;
+      }
+      
+      if(queued){
+        AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", allow ? "Allowed" : "Unallowed");
+        response->addHeader("X-Op-Seq", String(seq));
+        request->send(response);
+      } else {
+        request->send(503, "text/plain", "Failed to queue allowlist edits");
+      }
+  }));
+
+  // API: Block or unblock devices' internet access
+  // Body: {"macs": ["aa:bb:cc:dd:ee:ff", ...], "blocked": true}
+  server.on("/api/devices/block", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL, 
+    guardedBody("/api/devices/block", 1, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+      JsonDocument doc;
+      deserializeJson(doc, (const char*)data, len);
+      
+      if(!doc["macs"].is<JsonArray>() || !doc["blocked"].is<bool>()){
+        request->send(400, "text/plain", "Invalid block request");
+        return;
+      }
+      
+      DeviceBlockCommand command;
+      command.count = 0;
+      command.blocked = doc["blocked"].as<bool>();
+      for (JsonVariant mac : doc["macs"].as<JsonArray>()) {
+        if (command.count >= FirewallControl::MAX_BLOCKED || !parseMac(mac.as<const char*>(), command.macs[command.count])) {
+          request->send(400, "text/plain", "Invalid or too many macs");
+          return;
+        }
+        command.count++;
+      }
+      
+      // Applied by the router task; GET /api/status shows the result
+      if (!deviceBlockQueue.push(command)) {
+        request->send(503, "text/plain", "Busy");
+        return;
+      }
+      xTaskNotifyGive(routerTask);
+      request->send(202, "application/json", "{\"queued\":true}");
+  }));
+
+  // API: Weekly block schedules
+  server.on("/api/schedules", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonArray rules = doc["schedules"].to<JsonArray>();
+    scheduler.toJson(rules);
+    doc["transitions"] = scheduler.transitions();
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
+  // Body: {"id"?, "name", "days": [0-6], "start": "21:00", "end": "07:00", "macs": [...], "enabled"?}
+  server.on("/api/schedules", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL, 
+    guardedBody("/api/schedules", 1, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+      JsonDocument doc;
+      if (deserializeJson(doc, (const char*)data, len)) {
+        request->send(400, "text/plain", "Invalid JSON");
+        return;
+      }
+      
+      Scheduler::Rule rule;
+      String error;
+      if (!Scheduler::fromJson(doc.as<JsonVariantConst>(), rule, error)) {
+        request->send(400, "text/plain", error);
+        return;
+      }
+      
+      uint16_t id = scheduler.upsert(rule);
+      if (id == 0) {
+        request->send(rule.id != 0 ? 404 : 507, "text/plain", rule.id != 0 ? "Unknown schedule" : "Schedule table full");
+        return;
+      }
+      request->send(200, "application/json", "{\"id\":" + String(id) + "}");
+  }));
+
+  server.on("/api/schedules", HTTP_DELETE, [](AsyncWebServerRequest *request){
+    if (!request->hasParam("id")) {
+        request->send(400, "text/plain", "Missing id param");
+        return;
+    }
+    if (scheduler.remove(request->getParam("id")->value().toInt())) {
+        request->send(200, "text/plain", "Deleted");
+    } else {
+        request->send(404, "text/plain", "Unknown schedule");
+    }
+  });
+
+  // API: Router edits still waiting to be applied
+  server.on("/api/journal", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonArray pending = doc["pending"].to<JsonArray>();
+    journal.toJson(pending);
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
+  // API: Per-device usage history
+  // /api/usage?mac=aa:bb:cc:dd:ee:ff&res=minute|quarter|day&from=<epoch>&to=<epoch>
+  server.on("/api/usage", HTTP_GET, guarded("/api/usage", 2, [](AsyncWebServerRequest *request){
+    uint8_t mac[6];
+    if(!request->hasParam("mac") || !parseMac(request->getParam("mac")->value().c_str(), mac)){
+        request->send(400, "text/plain", "Missing or invalid mac param");
+        return;
+    }
+    
+    TrafficSeries::Resolution res = TrafficSeries::MINUTE;
+    if(request->hasParam("res") && !TrafficSeries::parseResolution(request->getParam("res")->value(), res)){
+        request->send(400, "text/plain", "Invalid res param");
+        return;
+    }
+    
+    uint32_t from = request->hasParam("from") ? request->getParam("from")->value().toInt() : 0;
+    uint32_t to = request->hasParam("to") ? request->getParam("to")->value().toInt() : 0xFFFFFFFF;
+    
+    JsonDocument doc;
+    doc["mac"] = formatMac(mac);
+    JsonArray points = doc["points"].to<JsonArray>(); // [start, rxBytes, txBytes]
+    
+    // The aggregate task may be adding a sample meanwhile; read again if so
+    bool found = false;
+    bool consistent = false;
+    for (int attempt = 0; attempt < 3 && !consistent; attempt++) {
+        uint32_t sequence = trafficSeries.writeSequence();
+        if (sequence & 1) {
+            yield(); // addSample() is short; retry as soon as it is done
+            continue;
+        }
+        points.clear();
+        found = trafficSeries.query(mac, res, from, to, points);
+        std::atomic_thread_fence(std::memory_order_acquire); // Keep the reads above before the check
+        consistent = trafficSeries.writeSequence() == sequence;
+    }
+    if(!consistent){
+        request->send(503, "text/plain", "Busy");
+        return;
+    }
+    if(!found){
+        request->send(404, "text/plain", "Unknown device");
+        return;
+    }
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  }));
+
+  // API: Link and router session state, answerable before Wi-Fi is up
+  server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request){
+    markFirstResponse();
+    JsonDocument doc;
+    doc["wifi"] = wifiLink.stateName();
+    doc["wifiAttempts"] = wifiLink.attempts();
+    doc["routerSession"] = router.hasSession();
+    JsonArray routers = doc["routers"].to<JsonArray>();
+    router.toJson(routers);
+    doc["pendingOps"] = journal.size();
+    JsonObject firewallState = doc["firewall"].to<JsonObject>();
+    firewallView.acquire()->toJson(firewallState);
+    doc["uptimeMs"] = millis();
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
+  // API: Router response cache counters
+  server.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonObject cache = doc["routerCache"].to<JsonObject>();
+    router.cacheStatsToJson(cache);
+    JsonObject filter = doc["blocklistFilter"].to<JsonObject>();
+    JsonObject allowFilter = doc["allowlistFilter"].to<JsonObject>();
+    xSemaphoreTake(policyLock, portMAX_DELAY); // Rebuilt by compaction
+    blocklist.filter().toJson(filter);
+    allowlist.filter().toJson(allowFilter);
+    xSemaphoreGive(policyLock);
+    JsonObject admissionStats = doc["admission"].to<JsonObject>();
+    admission.toJson(admissionStats);
+    JsonArray tasks = doc["tasks"].to<JsonArray>();
+    taskStats.toJson(tasks);
+    doc["telemetryDropped"] = telemetryDropped;
+    doc["freeHeap"] = ESP.getFreeHeap();
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
+  // API: What each device looks up (dnsmasq query log); ?domain= adds estimated counts for one name
+  server.on("/api/dns/queries", HTTP_GET, guarded("/api/dns/queries", 1, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonObject stats = doc.to<JsonObject>();
+    DeviceTableRef devices = deviceView.acquire();
+    queryLog.toJson(stats, *devices);
+    
+    if (request->hasParam("domain")) {
+      String domain = request->getParam("domain")->value();
+      uint32_t queries, blocked;
+      queryLog.estimate(domain.c_str(), queries, blocked);
+      JsonObject estimate = doc["estimate"].to<JsonObject>();
+      estimate["domain"] = domain;
+      estimate["queries"] = queries;
+      estimate["blocked"] = blocked;
+    }
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  }));
+
+  // API: DNS proxy counters, overall and per client
+  server.on("/api/dns", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonDocument doc;
+    JsonObject stats = doc.to<JsonObject>();
+    dnsProxy.toJson(stats);
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
+  // API: Boot timing milestones
+  server.on("/api/boot", HTTP_GET, [](AsyncWebServerRequest *request){
+    markFirstResponse();
+    JsonDocument doc;
+    doc["stateLoadedMs"] = bootTimes.stateLoaded;
+    doc["wifiConnectedMs"] = bootTimes.wifiConnected;
+    doc["serverStartedMs"] = bootTimes.serverStarted;
+    doc["firstResponseMs"] = bootTimes.firstResponse;
+    
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response);
+  });
+
   // Serve Static Files (Moved to end to avoid capturing API requests)
   server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html");
+  bootTimes.serverStarted = millis();
 
 =======
   server.on("/api/toggle-internet", HTTP_POST, [](AsyncWebServerRequest *request){
     internetActive = !internetActive;
     
     if (!SIMULATION_MODE) {
-        // Attempt to login and send command to OpenWRT
-        if (router.login()) {
-            router.setInternet(internetActive);
-        }
+        // One set element on the router; a failed update is retried by the resync in loop()
+        firewall.setLanBlocked(!internetActive);
     }
     
     DynamicJsonDocument doc(1024);
@@ -407,7 +1635,22 @@ void setupRoutes() {
 
   server.on("/api/blocklist/app", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-      request->send(200, "application/json", "{}");
+      DynamicJsonDocument doc(256);
+      DeserializationError error = deserializeJson(doc, data, len);
+      
+      int app = error ? -1 : apps.find(doc["id"] | "");
+      if (app < 0) {
+        request->send(400, "application/json", "{\"error\":\"Unknown app\"}");
+        return;
+      }
+      
+      bool enabled = doc.containsKey("blocked") ? doc["blocked"].as<bool>() : !apps.isEnabled(app);
+      if (setAppBlocked(app, enabled)) {
+        String response = getBlocklistJSON();
+        request->send(200, "application/json", response);
+      } else {
+        request->send(500, "application/json", "{\"error\":\"Failed to update app\"}");
+      }
   });
 
   server.on("/api/blocklist/custom", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL,
@@ -432,12 +1675,49 @@ void setupRoutes() {
   });
 
   server.on("/api/allowlist", HTTP_GET, [](AsyncWebServerRequest *request){
-      request->send(200, "application/json", "[]");
+      String response = getAllowlistJSON();
+      request->send(200, "application/json", response);
   });
 
+  // Body: {"domain": "example.com"} or {"domains": [...]}, optional "allowed": false
   server.on("/api/allowlist", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-      request->send(200, "application/json", "[]");
+      DynamicJsonDocument doc(2048);
+      DeserializationError error = deserializeJson(doc, data, len);
+      
+      std::vector<String> domains;
+      if (!error && doc.containsKey("domain")) {
+        domains.push_back(doc["domain"].as<String>());
+      } else if (!error && doc["domains"].is<JsonArray>()) {
+        for (JsonVariant domain : doc["domains"].as<JsonArray>()) {
+          domains.push_back(domain.as<String>());
+        }
+      }
+      if (domains.empty()) {
+        request->send(400, "application/json", "{\"error\":\"Invalid request\"}");
+        return;
+      }
+      
+      if (setAllowed(domains, doc["allowed"] | true)) {
+        String response = getAllowlistJSON();
+        request->send(200, "application/json", response);
+      } else {
+        request->send(500, "application/json", "{\"error\":\"Failed to update allowlist\"}");
+      }
+  });
+
+  server.on("/api/allowlist", HTTP_DELETE, [](AsyncWebServerRequest *request){
+      if (!request->hasParam("domain")) {
+        request->send(400, "application/json", "{\"error\":\"Missing domain param\"}");
+        return;
+      }
+      std::vector<String> domains(1, request->getParam("domain")->value());
+      if (setAllowed(domains, false)) {
+        String response = getAllowlistJSON();
+        request->send(200, "application/json", response);
+      } else {
+        request->send(500, "application/json", "{\"error\":\"Failed to update allowlist\"}");
+      }
   });
 
   // New Adblock endpoints
@@ -446,8 +1726,23 @@ void setupRoutes() {
     request->send(200, "application/json", response);
   });
 
+  // Served from the in-memory tail; pass ?since=<seq> to get only newer entries
   server.on("/api/adblock/logs", HTTP_GET, [](AsyncWebServerRequest *request){
-    String response = router.getAdblockLogs();
+    uint32_t since = 0;
+    if (request->hasParam("since")) {
+      since = request->getParam("since")->value().toInt();
+    }
+    
+    // Sized for the entries returned, text copied or not; a fixed size cut off a full tail
+    std::unique_ptr<DynamicJsonDocument> doc;
+    adblockLogs.toJson(since, [&doc](int entries) {
+      doc.reset(new DynamicJsonDocument(JSON_ARRAY_SIZE(entries) +
+                                        entries * (JSON_OBJECT_SIZE(4) + AdblockLogTail::TIMESTAMP_LEN + AdblockLogTail::MESSAGE_LEN)));
+      return doc->to<JsonArray>();
+    });
+    
+    String response;
+    serializeJson(*doc, response);
     request->send(200, "application/json", response);
   });
 
@@ -483,8 +1778,15 @@ void setup() {
 
   setupWiFi();
   
-  // Load blocked domains from Preferences
-  loadBlocklist();
+  // Load blocked domains from LittleFS
+  blocklist.begin();
+  allowlist.begin();
+  migrateBlocklist();
+  apps.begin();
+  adblockLogs.begin();
+  
+  firewall.begin(runNft);
+  internetActive = !firewall.lanBlocked();
   
   setupRoutes();
   
@@ -497,12 +1799,29 @@ void loop() {
     // Feed the watchdog timer to prevent timeout
     esp_task_wdt_reset();
     
-    // Keep session alive
-    static unsigned long lastCheck = 0;
-    if (millis() - lastCheck > 60000) {
-        lastCheck = millis();
-        router.checkSession();
+    // Wi-Fi is managed here; the router task waits for the link
+    linkUp = wifiLink.poll(millis());
+    
+    static unsigned long lastTaskSample = 0;
+    if (millis() - lastTaskSample > TASK_STATS_INTERVAL_MS) {
+        lastTaskSample = millis();
+        taskStats.sample(lastTaskSample);
     }
+    
+    delay(20); // Leave the worker core to the worker tasks
 =======
+  // Tail the adblock syslog in the background so requests never wait on logread
+  static unsigned long lastLogPoll = 0;
+  if (!SIMULATION_MODE && millis() - lastLogPoll > LOG_POLL_INTERVAL_MS) {
+    lastLogPoll = millis();
+    adblockLogs.ingest(router.readAdblockLog(LOG_TAIL_LINES));
+  }
+  
+  // Rebuild the firewall table now and then in case the router rebooted
+  static unsigned long lastFirewallSync = 0;
+  if (!SIMULATION_MODE && (lastFirewallSync == 0 || millis() - lastFirewallSync > FIREWALL_RESYNC_INTERVAL_MS)) {
+    lastFirewallSync = millis();
+    firewall.install();
+  }
 >>>>>>> e2fc66cd8c03be46ac1e8eb273be9970ba1bd19a
 }
@@ -4,6 +4,8 @@
 #include <WiFi.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
+#include <algorithm>
+#include <vector>
 
 class OpenWRTClient {
 private:
@@ -267,6 +269,156 @@ public:
         return httpResponseCode > 0;
     }
 
+    // Add and remove several hosts entries with one read and one write
+    bool applyHostsChanges(const std::vector<String>& add, const std::vector<String>& remove) {
+        if (session_id == "00000000000000000000000000000000") {
+            if (!login()) return false;
+        }
+
+        String hostsContent = readHostsFile();
+        if (hostsContent == "") {
+            Serial.println("OpenWRT: Failed to read hosts file");
+            return false;
+        }
+
+        for (const String& domain : remove) {
+            hostsContent.replace("0.0.0.0 " + domain + "\n", "");
+            hostsContent.replace("0.0.0.0 www." + domain + "\n", "");
+        }
+        for (const String& domain : add) {
+            if (hostsContent.indexOf("0.0.0.0 " + domain + "\n") >= 0) continue;
+            hostsContent += "0.0.0.0 " + domain + "\n";
+            hostsContent += "0.0.0.0 www." + domain + "\n";
+        }
+
+        if (!writeHostsFile(hostsContent)) {
+            Serial.println("OpenWRT: Failed to write hosts file");
+            return false;
+        }
+        Serial.printf("OpenWRT: Hosts updated (+%d, -%d)\n", (int)add.size(), (int)remove.size());
+        return true;
+    }
+
+    // Allow and unallow several domains in adblock's whitelist_domains list.
+    // ubus has no add_list/del_list, so the list is read, edited here and
+    // written back; set, commit and apply go out as one JSON-RPC batch.
+    bool applyAllowlistChanges(const std::vector<String>& add, const std::vector<String>& remove) {
+        if (session_id == "00000000000000000000000000000000") {
+            if (!login()) return false;
+        }
+
+        // Read the current list
+        DynamicJsonDocument doc(512);
+        doc["jsonrpc"] = "2.0";
+        doc["method"] = "call";
+        doc["id"] = 10;
+
+        JsonArray params = doc.createNestedArray("params");
+        params.add(session_id);
+        params.add("uci");
+        params.add("get");
+
+        JsonObject getParams = params.createNestedObject();
+        getParams["config"] = "adblock";
+        getParams["section"] = "global";
+        getParams["option"] = "whitelist_domains";
+
+        String requestBody;
+        serializeJson(doc, requestBody);
+
+        HTTPClient http;
+        http.begin(url);
+        http.addHeader("Content-Type", "application/json");
+
+        int httpResponseCode = http.POST(requestBody);
+        if (httpResponseCode <= 0) {
+            http.end();
+            Serial.println("OpenWRT: Failed to read allowlist");
+            return false;
+        }
+        String response = http.getString();
+        http.end();
+
+        DynamicJsonDocument resDoc(8192);
+        deserializeJson(resDoc, response);
+        int status = resDoc["result"][0] | -1;
+        if (status != 0 && status != 4) { // 4: no list yet
+            Serial.println("OpenWRT: Failed to read allowlist: " + response);
+            return false;
+        }
+
+        std::vector<String> allowed;
+        JsonVariant current = resDoc["result"][1]["value"];
+        if (current.is<JsonArray>()) {
+            for (JsonVariant value : current.as<JsonArray>()) allowed.push_back(value.as<String>());
+        } else if (current.is<const char*>()) {
+            allowed.push_back(current.as<String>());
+        }
+
+        for (const String& domain : remove) {
+            allowed.erase(std::remove(allowed.begin(), allowed.end(), domain), allowed.end());
+        }
+        for (const String& domain : add) {
+            if (std::find(allowed.begin(), allowed.end(), domain) == allowed.end()) allowed.push_back(domain);
+        }
+
+        // Write, commit and apply in one request
+        DynamicJsonDocument batch(1024 + allowed.size() * 96);
+        const char* methods[] = {allowed.empty() ? "delete" : "set", "commit", "apply"};
+        for (int i = 0; i < 3; i++) {
+            JsonObject call = batch.createNestedObject();
+            call["jsonrpc"] = "2.0";
+            call["method"] = "call";
+            call["id"] = 11 + i;
+
+            JsonArray callParams = call.createNestedArray("params");
+            callParams.add(session_id);
+            callParams.add("uci");
+            callParams.add(methods[i]);
+
+            JsonObject args = callParams.createNestedObject();
+            if (i == 0) {
+                args["config"] = "adblock";
+                args["section"] = "global";
+                if (allowed.empty()) {
+                    args["option"] = "whitelist_domains";
+                } else {
+                    JsonArray values = args.createNestedObject("values").createNestedArray("whitelist_domains");
+                    for (const String& domain : allowed) values.add(domain);
+                }
+            } else if (i == 1) {
+                args["config"] = "adblock";
+            } else {
+                args["rollback"] = false; // A rollback would need a uci confirm
+            }
+        }
+
+        requestBody = "";
+        serializeJson(batch, requestBody);
+
+        http.begin(url);
+        http.addHeader("Content-Type", "application/json");
+        httpResponseCode = http.POST(requestBody);
+
+        bool ok = false;
+        if (httpResponseCode > 0) {
+            DynamicJsonDocument results(1024);
+            deserializeJson(results, http.getString());
+            ok = results.size() == 3;
+            for (JsonVariant result : results.as<JsonArray>()) {
+                if ((result["result"][0] | -1) != 0) ok = false;
+            }
+        }
+        http.end();
+
+        if (!ok) {
+            Serial.println("OpenWRT: Failed to write allowlist");
+            return false;
+        }
+        Serial.printf("OpenWRT: Allowlist updated (+%d, -%d)\n", (int)add.size(), (int)remove.size());
+        return true;
+    }
+
     // Add a new section to UCI config
     String addDhcpSection() {
         DynamicJsonDocument doc(512);
@@ -422,17 +574,46 @@ public:
         Serial.println("OpenWRT: Note - Router restart required to fully remove domain");
     }
 
-    // Toggle Firewall Rule
-    void setInternet(bool active) {
-        DynamicJsonDocument doc(256);
-        JsonObject p = doc.to<JsonObject>();
-        p["scope"] = "uci"; 
-        
-        if (call("session", "access", p)) {
-             Serial.println(active ? "OpenWRT: Internet UNBLOCKED (Command Sent)" : "OpenWRT: Internet BLOCKED (Command Sent)");
-        } else {
-             Serial.println("OpenWRT: Command Failed");
+    // Run a command on the router via file exec; true if it exited 0
+    bool runCommand(const char* command, const String& argument) {
+        if (session_id == "00000000000000000000000000000000") {
+            if (!login()) return false;
         }
+
+        DynamicJsonDocument doc(1024 + argument.length());
+        doc["jsonrpc"] = "2.0";
+        doc["method"] = "call";
+        doc["id"] = 11;
+
+        JsonArray params = doc.createNestedArray("params");
+        params.add(session_id);
+        params.add("file");
+        params.add("exec");
+        JsonObject execParams = params.createNestedObject();
+        execParams["command"] = command;
+        execParams.createNestedArray("params").add(argument);
+
+        String requestBody;
+        serializeJson(doc, requestBody);
+
+        HTTPClient http;
+        http.begin(url);
+        http.addHeader("Content-Type", "application/json");
+
+        int httpResponseCode = http.POST(requestBody);
+        bool success = false;
+        if (httpResponseCode > 0) {
+            String response = http.getString();
+            DynamicJsonDocument resDoc(2048);
+            deserializeJson(resDoc, response);
+            success = resDoc["result"][0].as<int>() == 0 && resDoc["result"][1]["code"].as<int>() == 0;
+            if (!success) {
+                Serial.println("OpenWRT: Command failed: " + response);
+            }
+        }
+
+        http.end();
+        return success;
     }
 
     // Get adblock status by checking if adblock daemon is running
@@ -474,10 +655,12 @@ public:
         return "{\"status\":\"" + status + "\"}";
     }
 
-    // Get adblock logs from syslog
-    String getAdblockLogs() {
+    // Fetch the tail of the adblock syslog (raw stdout of logread).
+    // Only the last `lines` messages are read, so the payload stays small;
+    // AdblockLogTail works out which of them are new.
+    String readAdblockLog(int lines) {
         if (session_id == "00000000000000000000000000000000") {
-            if (!login()) return "[]";
+            if (!login()) return "";
         }
 
         HTTPClient http;
@@ -497,75 +680,34 @@ public:
         JsonObject execParams = params.createNestedObject();
         execParams["command"] = "logread";
         JsonArray argsArray = execParams.createNestedArray("params");
+        argsArray.add("-l");
+        argsArray.add(String(lines));
         argsArray.add("-e");
         argsArray.add("adblock");
 
         String requestBody;
         serializeJson(doc, requestBody);
 
-        Serial.println("OpenWRT: Fetching adblock logs...");
         int httpResponseCode = http.POST(requestBody);
+        String logOutput = "";
         
         if (httpResponseCode > 0) {
             String response = http.getString();
-            Serial.println("OpenWRT: Log Response: " + response);
             
-            // Parse the response to extract logs
-            DynamicJsonDocument resDoc(8192);
+            // Size the document from the payload so long logs are not truncated
+            DynamicJsonDocument resDoc(response.length() + 512);
             deserializeJson(resDoc, response);
             
             if (resDoc.containsKey("result") && resDoc["result"].size() > 1) {
                 JsonObject resultObj = resDoc["result"][1];
                 if (resultObj.containsKey("stdout")) {
-                    String logOutput = resultObj["stdout"].as<String>();
-                    
-                    // Parse log lines and create JSON array
-                    DynamicJsonDocument logsDoc(6144);
-                    JsonArray logsArray = logsDoc.to<JsonArray>();
-                    
-                    int startIdx = 0;
-                    int lineCount = 0;
-                    while (startIdx < logOutput.length() && lineCount < 50) {
-                        int endIdx = logOutput.indexOf('\n', startIdx);
-                        if (endIdx == -1) endIdx = logOutput.length();
-                        
-                        String line = logOutput.substring(startIdx, endIdx);
-                        if (line.length() > 0) {
-                            // Parse log line: timestamp + message
-                            int colonIdx = line.indexOf(": ");
-                            if (colonIdx > 0) {
-                                JsonObject logEntry = logsArray.createNestedObject();
-                                logEntry["timestamp"] = line.substring(0, colonIdx);
-                                logEntry["message"] = line.substring(colonIdx + 2);
-                                
-                                // Determine log level
-                                String message = line.substring(colonIdx + 2);
-                                message.toLowerCase();
-                                if (message.indexOf("failed") >= 0 || message.indexOf("error") >= 0) {
-                                    logEntry["level"] = "error";
-                                } else if (message.indexOf("successfully") >= 0 || message.indexOf("loaded") >= 0) {
-                                    logEntry["level"] = "success";
-                                } else {
-                                    logEntry["level"] = "info";
-                                }
-                                
-                                lineCount++;
-                            }
-                        }
-                        
-                        startIdx = endIdx + 1;
-                    }
-                    
-                    String logsJson;
-                    serializeJson(logsArray, logsJson);
-                    http.end();
-                    return logsJson;
+                    logOutput = resultObj["stdout"].as<String>();
                 }
             }
         }
         
         http.end();
-        return "[]";
+        return logOutput;
     }
 };
 
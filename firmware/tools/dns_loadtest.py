@@ -0,0 +1,124 @@
+"""Load test for the ESP32 DNS proxy (DNS_PROXY_ENABLED), run from a Linux box.
+
+  upstream   A stand-in resolver: answers every A query with 192.0.2.1 and
+             everything else with an empty NOERROR. Point the firmware's
+             router_host (the proxy's upstream) at this machine.
+
+  load       Sends queries to the proxy at a fixed rate and reports answered,
+             blocked (0.0.0.0) and lost queries plus latency percentiles.
+
+  python tools/dns_loadtest.py upstream --port 53
+  python tools/dns_loadtest.py load 192.168.10.50 --qps 200 --seconds 10 \\
+      --names 500 --blocked ads.example.com
+"""
+import argparse
+import random
+import socket
+import struct
+import time
+
+TYPE_A = 1
+
+
+def build_query(qid, name, qtype=TYPE_A):
+    header = struct.pack("!HHHHHH", qid, 0x0100, 1, 0, 0, 0)  # RD
+    labels = b"".join(bytes([len(p)]) + p.encode() for p in name.split("."))
+    return header + labels + b"\x00" + struct.pack("!HH", qtype, 1)
+
+
+def question_end(packet):
+    pos = 12
+    while packet[pos] != 0:
+        pos += 1 + packet[pos]
+    return pos + 5
+
+
+def serve_upstream(port, ttl):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", port))
+    print(f"stand-in resolver on udp/{port}")
+    served = 0
+    while True:
+        query, addr = sock.recvfrom(1500)
+        if len(query) < 12:
+            continue
+        end = question_end(query)
+        qtype = struct.unpack("!H", query[end - 4:end - 2])[0]
+        answers = 1 if qtype == TYPE_A else 0
+        header = struct.pack("!HHHHHH", struct.unpack("!H", query[:2])[0], 0x8180, 1, answers, 0, 0)
+        response = header + query[12:end]
+        if answers:
+            response += struct.pack("!HHHIH", 0xC00C, TYPE_A, 1, ttl, 4) + socket.inet_aton("192.0.2.1")
+        sock.sendto(response, addr)
+        served += 1
+        if served % 1000 == 0:
+            print(f"served {served}")
+
+
+def run_load(proxy, port, qps, seconds, names, blocked):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setblocking(False)
+    pool = [f"host{i}.loadtest.example" for i in range(names)] + blocked
+
+    sent = {}
+    latencies = []
+    zeroed = 0
+    qid = 0
+    interval = 1.0 / qps
+    start = time.monotonic()
+    next_send = start
+    deadline = start + seconds
+
+    while True:
+        now = time.monotonic()
+        if now < deadline and now >= next_send:
+            qid = (qid + 1) & 0xFFFF
+            sock.sendto(build_query(qid, random.choice(pool)), (proxy, port))
+            sent[qid] = now
+            next_send += interval
+        try:
+            response, _ = sock.recvfrom(1500)
+        except BlockingIOError:
+            if now > deadline + 2:
+                break
+            time.sleep(0.0005)
+            continue
+        rid = struct.unpack("!H", response[:2])[0]
+        if rid in sent:
+            latencies.append(time.monotonic() - sent.pop(rid))
+            if response.endswith(b"\x00\x00\x00\x00"):
+                zeroed += 1
+
+    total = len(latencies) + len(sent)
+    print(f"sent {total}, answered {len(latencies)}, blocked {zeroed}, lost {len(sent)}")
+    if latencies:
+        latencies.sort()
+        pick = lambda q: latencies[min(len(latencies) - 1, int(q * len(latencies)))] * 1000
+        print(f"latency ms: p50 {pick(0.5):.1f}  p90 {pick(0.9):.1f}  p99 {pick(0.99):.1f}  max {latencies[-1] * 1000:.1f}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    up = sub.add_parser("upstream")
+    up.add_argument("--port", type=int, default=53)
+    up.add_argument("--ttl", type=int, default=60)
+
+    load = sub.add_parser("load")
+    load.add_argument("proxy")
+    load.add_argument("--port", type=int, default=53)
+    load.add_argument("--qps", type=int, default=100)
+    load.add_argument("--seconds", type=int, default=10)
+    load.add_argument("--names", type=int, default=200, help="distinct unblocked names (cache hit rate)")
+    load.add_argument("--blocked", nargs="*", default=[], help="names expected to be blocked")
+
+    args = parser.parse_args()
+    if args.mode == "upstream":
+        serve_upstream(args.port, args.ttl)
+    else:
+        run_load(args.proxy, args.port, args.qps, args.seconds, args.names, args.blocked)
+
+
+if __name__ == "__main__":
+    main()
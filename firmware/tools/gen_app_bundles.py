@@ -0,0 +1,96 @@
+"""Generates src/AppBundlesData.h from tools/app_bundles.json.
+
+Domains shared by several apps are stored once; each bundle is a list of
+indices into one sorted, NUL-separated domain pool, so the firmware can
+binary-search a domain and refcount it across bundles.
+
+Runs standalone (python tools/gen_app_bundles.py) or as a PlatformIO
+pre-build script (extra_scripts = pre:tools/gen_app_bundles.py).
+"""
+import json
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(ROOT, "tools", "app_bundles.json")
+TARGET = os.path.join(ROOT, "src", "AppBundlesData.h")
+
+
+def generate(bundles):
+    domains = sorted({d.strip().lower() for members in bundles.values() for d in members})
+    index = {d: i for i, d in enumerate(domains)}
+
+    offsets, pos = [], 0
+    for d in domains:
+        offsets.append(pos)
+        pos += len(d) + 1
+
+    members, defs = [], []
+    for app in sorted(bundles):
+        ids = sorted({index[d.strip().lower()] for d in bundles[app]})
+        defs.append((app, len(members), len(ids)))
+        members.extend(ids)
+
+    assert pos < 65536 and len(domains) < 65536, "bundle tables outgrew uint16_t"
+    assert len(defs) <= 32, "AppBundles keeps enabled apps in a 32-bit mask"
+
+    out = []
+    out.append("// Generated by tools/gen_app_bundles.py from tools/app_bundles.json. Do not edit.")
+    out.append("#ifndef APP_BUNDLES_DATA_H")
+    out.append("#define APP_BUNDLES_DATA_H")
+    out.append("")
+    out.append("#include <stdint.h>")
+    out.append("")
+    out.append("struct AppBundleDef {")
+    out.append("    const char* name;")
+    out.append("    uint16_t first; // Into APP_BUNDLE_MEMBERS")
+    out.append("    uint16_t count;")
+    out.append("};")
+    out.append("")
+    out.append("constexpr int APP_DOMAIN_COUNT = %d;" % len(domains))
+    out.append("constexpr int APP_BUNDLE_COUNT = %d;" % len(defs))
+    out.append("")
+    out.append("// Sorted, NUL-separated")
+    out.append("constexpr char APP_DOMAIN_POOL[] =")
+    for d in domains:
+        out.append('    "%s\\0"' % d)
+    out.append("    ;")
+    out.append("")
+    out.append("constexpr uint16_t APP_DOMAIN_OFFSETS[APP_DOMAIN_COUNT] = {")
+    for i in range(0, len(offsets), 12):
+        out.append("    " + ", ".join(str(o) for o in offsets[i:i + 12]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("constexpr uint16_t APP_BUNDLE_MEMBERS[] = {")
+    for app, first, count in defs:
+        out.append("    " + ", ".join(str(m) for m in members[first:first + count]) + ", // " + app)
+    out.append("};")
+    out.append("")
+    out.append("constexpr AppBundleDef APP_BUNDLES[APP_BUNDLE_COUNT] = {")
+    for app, first, count in defs:
+        out.append('    {"%s", %d, %d},' % (app, first, count))
+    out.append("};")
+    out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    with open(SOURCE) as f:
+        text = generate(json.load(f))
+    try:
+        with open(TARGET) as f:
+            if f.read() == text:
+                return
+    except FileNotFoundError:
+        pass
+    with open(TARGET, "w") as f:
+        f.write(text)
+    print("Generated " + os.path.relpath(TARGET, ROOT))
+
+
+main()
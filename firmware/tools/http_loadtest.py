@@ -0,0 +1,425 @@
+"""Load test for the firmware's HTTP API, run from a Linux box.
+
+  router     A stand-in OpenWrt router: answers the ubus JSON-RPC calls the
+             firmware makes (session, file, uci, luci-rpc; single and batched)
+             from memory, with synthetic leases, traffic counters, a blocklist
+             and dnsmasq query log. Point router_host at this machine so a run
+             measures the ESP32 rather than the router.
+
+  run        Drives the device with a scenario at one or more concurrency
+             levels. Each step records per-route latency percentiles, 429/503
+             sheds (admission control) and other errors, while /api/metrics is
+             polled for the free-heap trend. Results go to a JSON file.
+
+  compare    Lines up two result files step by step, e.g. before and after a
+             change, and exits non-zero if p99 or the error rate got worse by
+             more than --tolerance.
+
+Scenarios:
+  stats      /api/stats, half of them with ?since= (the dashboard poll)
+  blocklist  /api/blocklist/custom, plus /api/blocklist/apply adding and
+             removing a throwaway domain (every apply is undone)
+  static     index.html and the assets it references
+  mixed      all of the above, weighted like a few open dashboards
+
+  python tools/http_loadtest.py router --port 80 --devices 40 --domains 2000
+  python tools/http_loadtest.py run 192.168.10.50 --scenario mixed \\
+      --concurrency 1 4 8 16 --seconds 20 --out results/$(git rev-parse --short HEAD).json
+  python tools/http_loadtest.py compare results/a1b2c3d.json results/e4f5a6b.json
+"""
+import argparse
+import http.client
+import json
+import random
+import re
+import secrets
+import subprocess
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+UBUS_OK = 0
+UBUS_NOT_FOUND = 4
+UBUS_PERMISSION_DENIED = 6
+
+
+# --- Stand-in router -------------------------------------------------------
+
+class Router:
+    def __init__(self, devices, domains, delay_ms):
+        self.lock = threading.Lock()
+        self.delay = delay_ms / 1000.0
+        self.sessions = set()
+        self.calls = 0
+        self.leases = [{
+            "macaddr": "02:00:00:00:%02x:%02x" % (i // 256, i % 256),
+            "ipaddr": "192.168.1.%d" % (20 + i % 200),
+            "hostname": "device-%d" % i,
+        } for i in range(devices)]
+        self.files = {
+            "/etc/adblock/adblock.blocklist":
+                "".join("blocked%d.loadtest.example\n" % i for i in range(domains)),
+        }
+        self.uci = {"adblock": {"global": {}}, "dhcp": {}}
+        self.rx = 0
+        self.tx = 0
+
+    def call(self, sid, obj, method, args):
+        with self.lock:
+            self.calls += 1
+            if self.calls % 1000 == 0:
+                print(f"served {self.calls} ubus calls")
+            if obj == "session" and method == "login":
+                sid = secrets.token_hex(16)
+                self.sessions.add(sid)
+                return [UBUS_OK, {"ubus_rpc_session": sid, "timeout": 300, "expires": 300}]
+            if sid not in self.sessions:
+                return [UBUS_PERMISSION_DENIED]
+            handler = getattr(self, "%s_%s" % (obj.replace("-", "_"), method), None)
+            if handler is None:
+                return [UBUS_NOT_FOUND]
+            return handler(args)
+
+    def luci_rpc_getDHCPLeases(self, args):
+        return [UBUS_OK, {"dhcp_leases": self.leases}]
+
+    def luci_rpc_getNetworkDevices(self, args):
+        self.rx += random.randint(10000, 500000)
+        self.tx += random.randint(100000, 5000000)
+        return [UBUS_OK, {"br-lan": {"stats": {"rx_bytes": self.rx, "tx_bytes": self.tx}}}]
+
+    def file_read(self, args):
+        data = self.files.get(args.get("path"))
+        return [UBUS_NOT_FOUND] if data is None else [UBUS_OK, {"data": data}]
+
+    def file_write(self, args):
+        self.files[args.get("path")] = args.get("data", "")
+        return [UBUS_OK]
+
+    def file_exec(self, args):
+        command = args.get("command", "")
+        stdout = ""
+        if command == "/sbin/logread":
+            stdout = self.query_log(int(args.get("params", ["-l", "100"])[1]))
+        elif command == "/usr/sbin/nlbw":
+            stdout = json.dumps({
+                "columns": ["mac", "conns", "rx_bytes", "tx_bytes"],
+                "data": [[lease["macaddr"], 3, random.randint(0, 10 ** 8), random.randint(0, 10 ** 9)]
+                         for lease in self.leases],
+            })
+        return [UBUS_OK, {"code": 0, "stdout": stdout}]
+
+    def query_log(self, lines):
+        names = ["www.youtube.com", "api.example.com", "cdn.loadtest.example", "blocked1.loadtest.example"]
+        out = []
+        for _ in range(lines):
+            lease = random.choice(self.leases) if self.leases else {"ipaddr": "192.168.1.20"}
+            out.append("Mon Jan  1 00:00:00 2024 daemon.info dnsmasq[812]: query[A] %s from %s"
+                       % (random.choice(names), lease["ipaddr"]))
+        return "\n".join(out) + "\n"
+
+    def uci_get(self, args):
+        section = self.uci.get(args.get("config"), {}).get(args.get("section"))
+        option = args.get("option")
+        if section is None or (option and option not in section):
+            return [UBUS_NOT_FOUND]
+        return [UBUS_OK, {"value": section[option]} if option else {"values": section}]
+
+    def uci_set(self, args):
+        config = self.uci.setdefault(args.get("config"), {})
+        config.setdefault(args.get("section"), {}).update(args.get("values", {}))
+        return [UBUS_OK]
+
+    def uci_delete(self, args):
+        section = self.uci.get(args.get("config"), {}).get(args.get("section"), {})
+        section.pop(args.get("option"), None)
+        return [UBUS_OK]
+
+    def uci_commit(self, args):
+        return [UBUS_OK]
+
+    def uci_apply(self, args):
+        return [UBUS_OK]
+
+
+def serve_router(port, devices, domains, delay_ms):
+    router = Router(devices, domains, delay_ms)
+
+    class Handler(BaseHTTPRequestHandler):
+        def do_POST(self):
+            if self.path != "/ubus":
+                self.send_error(404)
+                return
+            body = json.loads(self.rfile.read(int(self.headers.get("Content-Length", 0))))
+            batch = isinstance(body, list)
+            replies = []
+            for request in body if batch else [body]:
+                sid, obj, method, args = (request.get("params", []) + [None, None, None, {}])[:4]
+                replies.append({"jsonrpc": "2.0", "id": request.get("id"),
+                                "result": router.call(sid, obj, method, args or {})})
+            if router.delay:
+                time.sleep(router.delay)
+            payload = json.dumps(replies if batch else replies[0]).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(payload)))
+            self.end_headers()
+            self.wfile.write(payload)
+
+        def log_message(self, *args):
+            pass
+
+    server = ThreadingHTTPServer(("0.0.0.0", port), Handler)
+    print(f"stand-in router on tcp/{port}: {devices} leases, {domains} blocklist domains")
+    server.serve_forever()
+
+
+# --- Load generator --------------------------------------------------------
+
+def find_assets(host, port, timeout):
+    status, body = fetch(host, port, "GET", "/", None, timeout)
+    if status != 200:
+        return ["/"]
+    return ["/"] + sorted(set(re.findall(r'(?:src|href)="(/assets/[^"]+)"', body.decode(errors="replace"))))
+
+
+def build_scenario(name, host, port, timeout):
+    """List of (weight, label, request factory); a factory returns (method, path, body)."""
+    since = lambda: ("GET", "/api/stats?since=%d" % random.randint(0, 50), None)
+    stats = [
+        (1, "/api/stats", lambda: ("GET", "/api/stats", None)),
+        (1, "/api/stats?since", since),
+    ]
+    flip = {"add": True}
+
+    def apply():
+        action = "add" if flip["add"] else "remove"
+        flip["add"] = not flip["add"]
+        body = json.dumps({"changes": [{"action": action, "domain": "loadtest-probe.example"}]})
+        return "POST", "/api/blocklist/apply", body
+
+    blocklist = [
+        (4, "/api/blocklist/custom", lambda: ("GET", "/api/blocklist/custom", None)),
+        (1, "/api/blocklist/apply", apply),
+    ]
+    static = [(1, path, (lambda p=path: ("GET", p, None))) for path in find_assets(host, port, timeout)]
+
+    if name == "stats":
+        return stats
+    if name == "blocklist":
+        return blocklist
+    if name == "static":
+        return static
+    # A dashboard polls stats every few seconds and loads the app now and then
+    return [(w * 6, l, f) for w, l, f in stats] + [(w, l, f) for w, l, f in blocklist] + static
+
+
+def fetch(host, port, method, path, body, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        headers = {"Content-Type": "application/json"} if body is not None else {}
+        conn.request(method, path, body=body, headers=headers)
+        response = conn.getresponse()
+        return response.status, response.read()
+    except (OSError, http.client.HTTPException):
+        return 0, b""
+    finally:
+        conn.close()
+
+
+def percentile(values, q):
+    if not values:
+        return None
+    return round(values[min(len(values) - 1, int(q * len(values)))] * 1000, 1)
+
+
+def summarize(samples):
+    latencies = sorted(latency for latency, status in samples if status == 200)
+    shed = sum(1 for _, status in samples if status in (429, 503))
+    return {
+        "requests": len(samples),
+        "ok": len(latencies),
+        "shed": shed,
+        "errors": len(samples) - len(latencies) - shed,
+        "p50": percentile(latencies, 0.5),
+        "p90": percentile(latencies, 0.9),
+        "p99": percentile(latencies, 0.99),
+        "max": round(latencies[-1] * 1000, 1) if latencies else None,
+    }
+
+
+def heap_trend(points):
+    """points: [(seconds, freeHeap)]. Slope by least squares, bytes per minute."""
+    if not points:
+        return {"samples": 0}
+    trend = {"samples": len(points), "start": points[0][1], "end": points[-1][1],
+             "min": min(h for _, h in points)}
+    if len(points) > 1:
+        mean_t = sum(t for t, _ in points) / len(points)
+        mean_h = sum(h for _, h in points) / len(points)
+        var = sum((t - mean_t) ** 2 for t, _ in points)
+        if var > 0:
+            slope = sum((t - mean_t) * (h - mean_h) for t, h in points) / var
+            trend["slopePerMin"] = round(slope * 60)
+    return trend
+
+
+def run_step(host, port, scenario, concurrency, seconds, timeout, interval):
+    weights = [w for w, _, _ in scenario]
+    samples = {label: [] for _, label, _ in scenario}
+    heap = []
+    metrics = {}
+    deadline = time.monotonic() + seconds
+    start = time.monotonic()
+
+    def worker():
+        while time.monotonic() < deadline:
+            _, label, factory = random.choices(scenario, weights)[0]
+            method, path, body = factory()
+            began = time.monotonic()
+            status, _ = fetch(host, port, method, path, body, timeout)
+            samples[label].append((time.monotonic() - began, status))
+            if interval:
+                time.sleep(random.uniform(0, 2 * interval))
+
+    def sampler():
+        while time.monotonic() < deadline:
+            status, body = fetch(host, port, "GET", "/api/metrics", None, timeout)
+            if status == 200:
+                try:
+                    doc = json.loads(body)
+                    heap.append((time.monotonic() - start, doc["freeHeap"]))
+                    metrics.update(doc)
+                except (ValueError, KeyError):
+                    pass
+            time.sleep(1)
+
+    threads = [threading.Thread(target=worker) for _ in range(concurrency)]
+    threads.append(threading.Thread(target=sampler))
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    elapsed = time.monotonic() - start
+    everything = [sample for route in samples.values() for sample in route]
+    step = summarize(everything)
+    step.update({
+        "concurrency": concurrency,
+        "seconds": round(elapsed, 1),
+        "rps": round(len(everything) / elapsed, 1),
+        "routes": {label: summarize(route) for label, route in samples.items()},
+        "heap": heap_trend(heap),
+        "admission": metrics.get("admission"),
+    })
+    return step
+
+
+def print_step(scenario, step):
+    heap = step["heap"]
+    print(f"{scenario:9} c={step['concurrency']:<3} {step['rps']:7.1f} req/s  ok {step['ok']:<6} "
+          f"shed {step['shed']:<5} err {step['errors']:<5} "
+          f"p50 {step['p50']}  p90 {step['p90']}  p99 {step['p99']} ms  "
+          f"heap min {heap.get('min')} slope {heap.get('slopePerMin')} B/min")
+
+
+def git_revision():
+    try:
+        return subprocess.run(["git", "describe", "--always", "--dirty"], capture_output=True,
+                              text=True, timeout=5).stdout.strip() or None
+    except OSError:
+        return None
+
+
+def run_load(args):
+    result = {
+        "target": f"{args.host}:{args.port}",
+        "revision": args.revision or git_revision(),
+        "started": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "settings": {"seconds": args.seconds, "timeout": args.timeout, "think": args.think},
+        "steps": [],
+    }
+    for name in args.scenario:
+        scenario = build_scenario(name, args.host, args.port, args.timeout)
+        for concurrency in args.concurrency:
+            step = run_step(args.host, args.port, scenario, concurrency, args.seconds,
+                            args.timeout, args.think)
+            step["scenario"] = name
+            result["steps"].append(step)
+            print_step(name, step)
+            time.sleep(args.settle)
+    if args.out:
+        with open(args.out, "w") as out:
+            json.dump(result, out, indent=2)
+        print(f"wrote {args.out}")
+
+
+def error_rate(step):
+    return step["errors"] / step["requests"] if step["requests"] else 0.0
+
+
+def compare(base_path, new_path, tolerance):
+    with open(base_path) as f:
+        base = json.load(f)
+    with open(new_path) as f:
+        new = json.load(f)
+    print(f"{base.get('revision')} -> {new.get('revision')}")
+    before = {(s["scenario"], s["concurrency"]): s for s in base["steps"]}
+    worse = 0
+    for step in new["steps"]:
+        old = before.get((step["scenario"], step["concurrency"]))
+        if old is None:
+            continue
+        line = f"{step['scenario']:9} c={step['concurrency']:<3}"
+        for key in ("rps", "p50", "p99"):
+            line += f"  {key} {old[key]} -> {step[key]}"
+        line += f"  err {error_rate(old):.1%} -> {error_rate(step):.1%}"
+        line += f"  heap min {old['heap'].get('min')} -> {step['heap'].get('min')}"
+        regressed = (old["p99"] and step["p99"] and step["p99"] > old["p99"] * (1 + tolerance)) or \
+            error_rate(step) > error_rate(old) + tolerance
+        if regressed:
+            line += "  WORSE"
+            worse += 1
+        print(line)
+    return 1 if worse else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    router = sub.add_parser("router")
+    router.add_argument("--port", type=int, default=80)
+    router.add_argument("--devices", type=int, default=20, help="DHCP leases to report")
+    router.add_argument("--domains", type=int, default=500, help="lines in the adblock blocklist")
+    router.add_argument("--delay-ms", type=int, default=0, help="added to every ubus reply")
+
+    run = sub.add_parser("run")
+    run.add_argument("host")
+    run.add_argument("--port", type=int, default=80)
+    run.add_argument("--scenario", nargs="+", default=["mixed"],
+                     choices=["stats", "blocklist", "static", "mixed"])
+    run.add_argument("--concurrency", type=int, nargs="+", default=[1, 4, 8])
+    run.add_argument("--seconds", type=int, default=15, help="per concurrency step")
+    run.add_argument("--timeout", type=float, default=5.0)
+    run.add_argument("--think", type=float, default=0.0, help="mean pause between a client's requests, s")
+    run.add_argument("--settle", type=float, default=3.0, help="pause between steps, s")
+    run.add_argument("--revision", help="label for the results (default: git describe)")
+    run.add_argument("--out", help="write results as JSON")
+
+    cmp = sub.add_parser("compare")
+    cmp.add_argument("base")
+    cmp.add_argument("new")
+    cmp.add_argument("--tolerance", type=float, default=0.2, help="allowed relative p99 / absolute error rate rise")
+
+    args = parser.parse_args()
+    if args.mode == "router":
+        serve_router(args.port, args.devices, args.domains, args.delay_ms)
+    elif args.mode == "run":
+        run_load(args)
+    else:
+        raise SystemExit(compare(args.base, args.new, args.tolerance))
+
+
+if __name__ == "__main__":
+    main()
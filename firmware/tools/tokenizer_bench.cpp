@@ -0,0 +1,133 @@
+// Host micro-benchmark for src/TextTokenizer.h against the substring/trim
+// loop it replaced, on a synthetic blocklist. Counts heap allocations by
+// replacing operator new; std::string stands in for Arduino's String (both
+// keep short strings inline, and these domains are longer than that).
+//
+//   g++ -O2 -std=c++11 -I src tools/tokenizer_bench.cpp -o /tmp/tokenizer_bench
+//   /tmp/tokenizer_bench 10000
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "TextTokenizer.h"
+
+static unsigned long allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static void trim(std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r");
+    size_t last = s.find_last_not_of(" \t\r");
+    s = first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+}
+
+// The loop as it was in unblockDomain / applyBlocklistChanges
+static std::string removeLegacy(const std::string& content, const std::string& domain) {
+    std::string result;
+    size_t startPos = 0;
+    size_t newlinePos;
+    while ((newlinePos = content.find('\n', startPos)) != std::string::npos) {
+        std::string line = content.substr(startPos, newlinePos - startPos);
+        trim(line);
+        if (line != domain && line.length() > 0) {
+            result += line + "\n";
+        }
+        startPos = newlinePos + 1;
+    }
+    return result;
+}
+
+static std::string removeSpans(const std::string& content, const char* domain) {
+    std::string result;
+    result.reserve(content.length());
+    size_t domainLength = strlen(domain);
+    LineReader lines(content.c_str(), content.length());
+    TextSpan line;
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (!line.empty() && !line.equals(domain, domainLength)) {
+            result.append(line.data, line.len);
+            result += '\n';
+        }
+    }
+    return result;
+}
+
+// The dnsmasq config build in applyBlocklistChanges
+static std::string configLegacy(const std::string& content) {
+    std::string config;
+    size_t startPos = 0;
+    size_t newlinePos;
+    while ((newlinePos = content.find('\n', startPos)) != std::string::npos) {
+        std::string line = content.substr(startPos, newlinePos - startPos);
+        trim(line);
+        if (line.length() > 0) {
+            config += "address=/" + line + "/0.0.0.0\n";
+            config += "address=/" + line + "/::\n";
+        }
+        startPos = newlinePos + 1;
+    }
+    return config;
+}
+
+static std::string configSpans(const std::string& content) {
+    size_t configLength = 0;
+    LineReader sizing(content.c_str(), content.length());
+    TextSpan line;
+    while (sizing.next(line)) {
+        line = line.trimmed();
+        if (!line.empty()) configLength += 2 * line.len + 31;
+    }
+    std::string config;
+    config.reserve(configLength);
+    LineReader lines(content.c_str(), content.length());
+    while (lines.next(line)) {
+        line = line.trimmed();
+        if (!line.empty()) {
+            config += "address=/";
+            config.append(line.data, line.len);
+            config += "/0.0.0.0\naddress=/";
+            config.append(line.data, line.len);
+            config += "/::\n";
+        }
+    }
+    return config;
+}
+
+template <typename F>
+static void run(const char* name, int lines, F body) {
+    unsigned long before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    size_t size = body().size();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double us = std::chrono::duration<double, std::micro>(elapsed).count();
+    printf("%-16s %8lu allocations  %9.0f us  %6.1f ns/line  (%zu bytes out)\n",
+           name, allocations - before, us, us * 1000 / lines, size);
+}
+
+int main(int argc, char** argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 10000;
+
+    std::string content;
+    char domain[64];
+    for (int i = 0; i < lines; i++) {
+        snprintf(domain, sizeof(domain), "ads%d.tracker-network.example.com\n", i);
+        content += domain;
+    }
+    const char* target = "ads4242.tracker-network.example.com";
+
+    printf("%d lines, %zu bytes\n", lines, content.size());
+    run("remove/legacy", lines, [&]() { return removeLegacy(content, target); });
+    run("remove/spans", lines, [&]() { return removeSpans(content, target); });
+    run("config/legacy", lines, [&]() { return configLegacy(content); });
+    run("config/spans", lines, [&]() { return configSpans(content); });
+    return 0;
+}
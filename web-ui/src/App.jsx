@@ -524,15 +524,15 @@ const App = () => {
 
         // Update devices list if available
         if (data.devices && Array.isArray(data.devices)) {
-          // Map OpenWrt lease object to our UI format
-          // OpenWrt lease: { hostname, macaddr, ipaddr, expires }
+          // Map firmware device table entries to our UI format
+          // Entry: { hostname, macaddr, ipaddr, online, firstSeen, lastSeen, usage? }
           const mappedDevices = data.devices.map((d, index) => ({
             id: d.macaddr || index,
             name: d.hostname || d.macaddr || `Device ${index + 1}`,
             type: 'unknown', // We don't know type from DHCP
-            status: 'online', // If in lease, usually active, but strictly means "has IP"
+            status: d.online === false ? 'offline' : 'online',
             blocked: false, // We'd need to check blocklist for this
-            usage: '0 GB' // Per-device usage not easily available without extra tools
+            usage: d.usage || '0 B' // Last 24 h, from the firmware's usage history
           }));
           setDevices(mappedDevices);
         }